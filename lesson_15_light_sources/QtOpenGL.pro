@@ -1,6 +1,5 @@
-QT       += core gui 3drender
-
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+# Everything but main.cpp is shared with headless/headless_benchmark.pro
+include(renderer.pri)
 
 CONFIG += c++11 \
     #sdk_no_version_check
@@ -11,20 +10,7 @@ CONFIG += c++11 \
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
-    main.cpp \
-    processModels.cpp \
-    renderwindow.cpp \
-    stb_image.cpp
-
-HEADERS += \
-    direction.h \
-    keyboard_state.h \
-    materials.h \
-    mouse_state.h \
-    renderwindow.h
-
-INCLUDEPATH += \
-    $$PWD/include
+    main.cpp
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -32,10 +18,19 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
 DISTFILES += \
+    shaders/camera.glsl \
+    shaders/deferred.glsl \
+    shaders/deferred_directional.fs \
+    shaders/deferred_fullscreen.vs \
+    shaders/deferred_point.fs \
+    shaders/deferred_point.vs \
+    shaders/gbuffer.fs \
+    shaders/gbuffer.glsl \
     shaders/lamp.fs \
     shaders/lamp.vs \
     shaders/light_casters.fs \
     shaders/light_casters.vs \
+    shaders/lights.glsl \
     textures/awesomeface.png \
     textures/box_edging.png \
     textures/box_metal.png \
@@ -0,0 +1,58 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Allocator for std::vector that starts every array on a cache line, so SIMD
+// loops over structure of arrays data never split their first loads and two
+// arrays never share a line
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T* allocate(size_t count)
+    {
+        // Whole lines, so the end of the array does not share one either
+        size_t bytes = (count * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+        void *p_memory = nullptr;
+#if defined(_MSC_VER)
+        p_memory = _aligned_malloc(bytes, Alignment);
+#else
+        if (posix_memalign(&p_memory, Alignment, bytes) != 0)
+            p_memory = nullptr;
+#endif
+        if (p_memory == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T*>(p_memory);
+    }
+
+    void deallocate(T *p_memory, size_t)
+    {
+#if defined(_MSC_VER)
+        _aligned_free(p_memory);
+#else
+        free(p_memory);
+#endif
+    }
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) { return true; }
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) { return false; }
+
+template <typename T>
+using AlignedArray = std::vector<T, AlignedAllocator<T>>;
+
+#endif // ALIGNED_ALLOCATOR_H
@@ -0,0 +1,393 @@
+#include "benchmark.h"
+#include "normal_matrix.h"
+#include "frustum_culling.h"
+#include "job_system.h"
+#include "render_queue.h"
+#include "scene_store.h"
+#include "transform_kernel.h"
+
+#include <QElapsedTimer>
+#include <QThread>
+#include <QVector3D>
+#include <QtDebug>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace
+{
+    const int           cm_objectsCount = 100000;
+    const int           cm_cubeVertices = 36;
+    const int           cm_cullingObjectsCount = 1000000;
+    const int           cm_cullingRepeats = 20;
+    const int           cm_queueDrawsCount = 100000;
+    const int           cm_queueRepeats = 20;
+    const int           cm_transformsCount = 100000;
+    const int           cm_transformRepeats = 20;
+    // Share of objects that move per frame in the dirty skipping run
+    const int           cm_movingEvery = 10;
+    // Synthetic frame for the job system: transforms, culling, then the sorted draw list
+    const int           cm_jobTransformsCount = 200000;
+    const int           cm_jobFrames = 20;
+    const unsigned int  cm_jobTransformGrain = 2048;
+    const unsigned int  cm_jobCullGrain = 16384;
+    // Scene store churn: add, then remove every k-th object by handle
+    const int           cm_sceneObjectsCount = 100000;
+    const int           cm_sceneLampsCount = 1000;
+    const int           cm_removeEvery = 7;
+
+    std::vector<QMatrix4x4> makeModelMatrices(int count)
+    {
+        std::vector<QMatrix4x4> models(count);
+        for (int i = 0; i < count; i++)
+        {
+            models[i].translate(QVector3D(i % 100, (i / 100) % 100, -(i / 10000)));
+            models[i].rotate(20.0f * i, QVector3D(1.0f, 0.3f, 0.5f));
+        }
+        return models;
+    }
+
+    // Keeps the compiler from dropping the measured work
+    float checksum(const QMatrix3x3 &matrix)
+    {
+        return matrix(0, 0) + matrix(1, 1) + matrix(2, 2);
+    }
+
+    double nsPerObject(const QElapsedTimer &timer, int count)
+    {
+        return static_cast<double>(timer.nsecsElapsed()) / count;
+    }
+}
+
+void Benchmark::normalMatrices()
+{
+    std::vector<QMatrix4x4> models = makeModelMatrices(cm_objectsCount);
+    float sum = 0.0f;
+    QElapsedTimer timer;
+
+    // Before: light_casters.vs inverted the model matrix for each of the 36 cube
+    // vertices. On llvmpipe that runs on the CPU exactly like this loop does.
+    timer.start();
+    for (const QMatrix4x4 &model: models)
+        for (int vertex = 0; vertex < cm_cubeVertices; vertex++)
+            sum += checksum(model.inverted().transposed().toGenericMatrix<3, 3>());
+    double perVertex = nsPerObject(timer, cm_objectsCount);
+
+    // After, general path: one inverse per object
+    timer.restart();
+    for (const QMatrix4x4 &model: models)
+        sum += checksum(model.normalMatrix());
+    double perObject = nsPerObject(timer, cm_objectsCount);
+
+    // After, uniform scale fast path: no inverse at all
+    timer.restart();
+    for (const QMatrix4x4 &model: models)
+        sum += checksum(normalMatrixFor(model));
+    double fastPath = nsPerObject(timer, cm_objectsCount);
+
+    qDebug().nospace() << "normal matrix, ns per cube: per-vertex inverse " << perVertex
+                       << ", per-object inverse " << perObject
+                       << ", uniform scale fast path " << fastPath
+                       << " (checksum " << sum << ")";
+}
+
+void Benchmark::frustumCulling()
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+    BoundsSoA bounds;
+    bounds.reserve(cm_cullingObjectsCount);
+    for (int i = 0; i < cm_cullingObjectsCount; i++)
+    {
+        float halfSize = size(random);
+        bounds.add(QVector3D(position(random), position(random), position(random)),
+                   halfSize * sqrtf(3.0f), QVector3D(halfSize, halfSize, halfSize));
+    }
+
+    QMatrix4x4 projection;
+    projection.perspective(45.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+    QMatrix4x4 view;
+    view.lookAt(QVector3D(0.0f, 0.0f, 3.0f), QVector3D(0.0f, 0.0f, -1.0f), QVector3D(0.0f, 1.0f, 0.0f));
+    Frustum frustum = Culling::extractFrustum(projection * view);
+
+    std::vector<unsigned int> visible;
+    QElapsedTimer timer;
+
+    timer.start();
+    for (int repeat = 0; repeat < cm_cullingRepeats; repeat++)
+        Culling::cullSpheres(frustum, bounds, &visible);
+    double spheres = timer.nsecsElapsed() / 1e6 / cm_cullingRepeats;
+
+    timer.restart();
+    for (int repeat = 0; repeat < cm_cullingRepeats; repeat++)
+        Culling::cullBoxes(frustum, bounds, &visible);
+    double boxes = timer.nsecsElapsed() / 1e6 / cm_cullingRepeats;
+
+    qDebug().nospace() << "frustum culling of " << cm_cullingObjectsCount << " objects: spheres "
+                       << spheres << " ms, boxes " << boxes << " ms, " << visible.size() << " visible";
+}
+
+void Benchmark::renderQueueSort()
+{
+    std::mt19937 random(1);
+    std::uniform_int_distribution<unsigned int> pipeline(0, 7);
+    std::uniform_int_distribution<unsigned int> material(0, 255);
+    std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+
+    std::vector<RenderQueue::Draw> draws(cm_queueDrawsCount);
+    for (int i = 0; i < cm_queueDrawsCount; i++)
+        draws[i] = {RenderQueue::makeKey(RenderQueue::OpaquePass, pipeline(random), material(random), depth(random)),
+                    quint32(i)};
+
+    // Refilled every repeat, like a real frame
+    RenderQueue queue;
+    queue.reserve(cm_queueDrawsCount);
+    QElapsedTimer timer;
+    qint64 radix = 0;
+    for (int repeat = 0; repeat < cm_queueRepeats; repeat++)
+    {
+        queue.clear();
+        for (const RenderQueue::Draw &draw: draws)
+            queue.push(draw.key, draw.item);
+        timer.start();
+        queue.sort();
+        radix += timer.nsecsElapsed();
+    }
+
+    std::vector<RenderQueue::Draw> sorted;
+    qint64 comparison = 0;
+    for (int repeat = 0; repeat < cm_queueRepeats; repeat++)
+    {
+        sorted = draws;
+        timer.start();
+        std::sort(sorted.begin(), sorted.end(), [](const RenderQueue::Draw &a, const RenderQueue::Draw &b)
+        {
+            return a.key < b.key;
+        });
+        comparison += timer.nsecsElapsed();
+    }
+
+    bool same = std::equal(sorted.begin(), sorted.end(), queue.draws().begin(),
+                           [](const RenderQueue::Draw &a, const RenderQueue::Draw &b) { return a.key == b.key; });
+    qDebug().nospace() << "render queue sort of " << cm_queueDrawsCount << " draws: radix "
+                       << radix / 1e6 / cm_queueRepeats << " ms (" << queue.sortPasses() << " passes), std::sort "
+                       << comparison / 1e6 / cm_queueRepeats << " ms" << (same ? "" : " MISMATCH");
+}
+
+void Benchmark::transformKernel()
+{
+    const QVector3D axis(1.0f, 0.3f, 0.5f);
+    const int stride = 16 + 9;
+    std::vector<float> output(cm_transformsCount * stride);
+    float sum = 0.0f;
+    QElapsedTimer timer;
+
+    // Before: translate and rotate per object, the rotation redoing its trig and a general 4x4 multiply
+    timer.start();
+    for (int repeat = 0; repeat < cm_transformRepeats; repeat++)
+        for (int i = 0; i < cm_transformsCount; i++)
+        {
+            QMatrix4x4 model;
+            model.translate(QVector3D(i % 100, (i / 100) % 100, -(i / 10000)));
+            model.rotate(20.0f * i + repeat, axis);
+            QMatrix3x3 normal = normalMatrixFor(model);
+            float *p_out = output.data() + i * stride;
+            std::copy(model.constData(), model.constData() + 16, p_out);
+            std::copy(normal.constData(), normal.constData() + 9, p_out + 16);
+        }
+    double matrices = timer.nsecsElapsed() / 1e6 / cm_transformRepeats;
+    sum += checksum(QMatrix3x3(output.data() + 16));
+
+    // Rotations are set as quaternions outside the timing, as a simulation would keep them
+    TransformsSoA transforms;
+    transforms.reserve(cm_transformsCount);
+    for (int i = 0; i < cm_transformsCount; i++)
+        transforms.add(QVector3D(i % 100, (i / 100) % 100, -(i / 10000)), QQuaternion::fromAxisAndAngle(axis, 20.0f * i));
+
+    qint64 kernel = 0;
+    for (int repeat = 0; repeat < cm_transformRepeats; repeat++)
+    {
+        transforms.markAllDirty();
+        timer.start();
+        Transforms::update(&transforms, output.data(), stride, output.data() + 16, stride);
+        kernel += timer.nsecsElapsed();
+    }
+    sum += checksum(QMatrix3x3(output.data() + 16));
+
+    qint64 partial = 0;
+    unsigned int written = 0;
+    for (int repeat = 0; repeat < cm_transformRepeats; repeat++)
+    {
+        for (int i = repeat % cm_movingEvery; i < cm_transformsCount; i += cm_movingEvery)
+            transforms.setRotation(i, QQuaternion::fromAxisAndAngle(axis, 20.0f * i + repeat));
+        timer.start();
+        written += Transforms::update(&transforms, output.data(), stride, output.data() + 16, stride);
+        partial += timer.nsecsElapsed();
+    }
+    sum += checksum(QMatrix3x3(output.data() + 16));
+
+    qDebug().nospace() << "model and normal matrices of " << cm_transformsCount << " objects: QMatrix4x4 "
+                       << matrices << " ms, kernel " << kernel / 1e6 / cm_transformRepeats << " ms, kernel with 1 in "
+                       << cm_movingEvery << " moving " << partial / 1e6 / cm_transformRepeats << " ms ("
+                       << written / cm_transformRepeats << " written, checksum " << sum << ")";
+}
+
+void Benchmark::jobScaling()
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+    BoundsSoA bounds;
+    bounds.reserve(cm_cullingObjectsCount);
+    for (int i = 0; i < cm_cullingObjectsCount; i++)
+    {
+        float halfSize = size(random);
+        bounds.add(QVector3D(position(random), position(random), position(random)),
+                   halfSize * sqrtf(3.0f), QVector3D(halfSize, halfSize, halfSize));
+    }
+
+    const QVector3D axis(1.0f, 0.3f, 0.5f);
+    TransformsSoA transforms;
+    transforms.reserve(cm_jobTransformsCount);
+    for (int i = 0; i < cm_jobTransformsCount; i++)
+        transforms.add(QVector3D(i % 100, (i / 100) % 100, -(i / 10000)), QQuaternion::fromAxisAndAngle(axis, 20.0f * i));
+    const int stride = 16 + 9;
+    std::vector<float> output(size_t(cm_jobTransformsCount) * stride);
+
+    QMatrix4x4 projection;
+    projection.perspective(45.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+    QMatrix4x4 view;
+    view.lookAt(QVector3D(0.0f, 0.0f, 3.0f), QVector3D(0.0f, 0.0f, -1.0f), QVector3D(0.0f, 1.0f, 0.0f));
+    const Frustum frustum = Culling::extractFrustum(projection * view);
+
+    std::vector<std::vector<unsigned int>> visibleRanges((cm_cullingObjectsCount + cm_jobCullGrain - 1) / cm_jobCullGrain);
+    RenderQueue queue;
+    queue.reserve(cm_cullingObjectsCount);
+
+    // 0 workers runs everything on the waiting thread, the serial baseline
+    std::vector<int> workerCounts = {0};
+    for (int workers = 1; workers < QThread::idealThreadCount(); workers *= 2)
+        workerCounts.push_back(workers);
+    if (workerCounts.back() != QThread::idealThreadCount() - 1)
+        workerCounts.push_back(QThread::idealThreadCount() - 1);
+
+    double serial = 0.0;
+    for (int workers: workerCounts)
+    {
+        JobSystem jobs(workers);
+        QElapsedTimer timer;
+        timer.start();
+        for (int frame = 0; frame < cm_jobFrames; frame++)
+        {
+            transforms.markAllDirty();
+            JobHandle transformed = jobs.parallelFor(transforms.size(), cm_jobTransformGrain,
+                                                     [&](unsigned int first, unsigned int last)
+            {
+                Transforms::update(&transforms, first, last, output.data(), stride, output.data() + 16, stride);
+            });
+            JobHandle culled = jobs.parallelFor(bounds.size(), cm_jobCullGrain, [&](unsigned int first, unsigned int last)
+            {
+                Culling::cullBoxes(frustum, bounds, first, last, &visibleRanges[first / cm_jobCullGrain]);
+            });
+            JobHandle sorted = jobs.run([&]()
+            {
+                queue.clear();
+                for (const std::vector<unsigned int> &range: visibleRanges)
+                    for (unsigned int i: range)
+                        queue.push(RenderQueue::makeKey(RenderQueue::OpaquePass, i % 3, i % 64,
+                                                        output[size_t(i % cm_jobTransformsCount) * stride + 14] / -100.0f), i);
+                queue.sort();
+            }, {transformed, culled});
+            jobs.wait(sorted);
+        }
+        double frameMs = timer.nsecsElapsed() / 1e6 / cm_jobFrames;
+        if (workers == 0)
+            serial = frameMs;
+
+        qDebug().nospace() << "job system frame with " << workers << " workers: " << frameMs << " ms, speedup "
+                           << serial / frameMs << "x (" << jobs.executed() << " jobs, " << jobs.stolen()
+                           << " stolen, " << queue.size() << " draws)";
+    }
+}
+
+void Benchmark::sceneStore()
+{
+    SceneStore scene;
+    std::vector<EntityHandle> cubes(cm_sceneObjectsCount);
+    std::vector<EntityHandle> lamps(cm_sceneLampsCount);
+    auto cubeAt = [](int i) { return QVector3D(i % 100, (i / 100) % 100, -(i / 10000)); };
+    bool same = true;
+    QElapsedTimer timer;
+
+    timer.start();
+    for (int i = 0; i < cm_sceneObjectsCount; i++)
+        cubes[i] = scene.addCube(cubeAt(i), QQuaternion(), i % 4);
+    qint64 added = timer.nsecsElapsed();
+    for (int i = 0; i < cm_sceneLampsCount; i++)
+    {
+        PointLight light;
+        light.position = cubeAt(i);
+        lamps[i] = scene.addLamp(light, 0.05f);
+    }
+
+    // Only rows moved by the removals should come out dirty
+    std::fill(scene.cubes.transforms.dirty.begin(), scene.cubes.transforms.dirty.end(), 0);
+
+    timer.start();
+    int removed = 0;
+    for (int i = 0; i < cm_sceneObjectsCount; i += cm_removeEvery)
+    {
+        same = same && scene.removeCube(cubes[i]);
+        removed++;
+    }
+    qint64 removing = timer.nsecsElapsed();
+    for (int i = 0; i < cm_sceneLampsCount; i += cm_removeEvery)
+        same = same && scene.removeLamp(lamps[i]);
+
+    // Survivors still resolve to their own data, removed handles are stale for good
+    int moved = 0;
+    for (int i = 0; i < cm_sceneObjectsCount; i++)
+    {
+        int row = scene.cubeRow(cubes[i]);
+        if (i % cm_removeEvery == 0)
+        {
+            same = same && row == -1 && !scene.removeCube(cubes[i]);
+            continue;
+        }
+        same = same && row >= 0 && scene.cubePosition(row) == cubeAt(i) && scene.cubes.materials[row] == unsigned(i % 4);
+        moved += scene.cubes.transforms.dirty[row];
+    }
+    for (int i = 0; i < cm_sceneLampsCount; i++)
+    {
+        int row = scene.lampRow(lamps[i]);
+        same = same && (i % cm_removeEvery == 0 ? row == -1 : row >= 0 && scene.lampPosition(row) == cubeAt(i));
+    }
+    same = same && scene.cubeCount() == unsigned(cm_sceneObjectsCount - removed) &&
+           moved > 0 && moved <= removed;
+
+    // A cleared store reuses the slots, but the old handles stay stale
+    scene.clear();
+    same = same && scene.cubeCount() == 0 && scene.lampCount() == 0;
+    EntityHandle reused = scene.addCube(cubeAt(1), QQuaternion(), 0);
+    for (int i = 0; i < cm_sceneObjectsCount; i++)
+        same = same && scene.cubeRow(cubes[i]) == -1;
+    same = same && scene.cubeRow(reused) == 0;
+
+    qDebug().nospace() << "scene store with " << cm_sceneObjectsCount << " cubes: add "
+                       << added / 1e6 << " ms, remove every " << cm_removeEvery << "th (" << removed << ") "
+                       << removing / 1e6 << " ms, " << moved << " rows moved" << (same ? "" : " MISMATCH");
+}
+
+void Benchmark::runAll()
+{
+    normalMatrices();
+    frustumCulling();
+    renderQueueSort();
+    transformKernel();
+    jobScaling();
+    sceneStore();
+}
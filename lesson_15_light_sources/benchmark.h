@@ -0,0 +1,18 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// CPU micro-benchmarks, run with the --benchmark command line argument
+
+namespace Benchmark
+{
+    void normalMatrices();
+    void frustumCulling();
+    void renderQueueSort();
+    void transformKernel();
+    void jobScaling();
+    void sceneStore();
+
+    void runAll();
+}
+
+#endif // BENCHMARK_H
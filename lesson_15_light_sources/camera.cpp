@@ -0,0 +1,130 @@
+#include "camera.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CAMERA_SSE
+#endif
+
+namespace
+{
+    // p_result = a * b for column-major 4x4 matrices: every result column is the
+    // columns of a weighted by one column of b, four lanes at a time
+    void multiply(const float *a, const float *b, float *p_result)
+    {
+#if defined(CAMERA_SSE)
+        const __m128 columns[4] = {_mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8), _mm_loadu_ps(a + 12)};
+        for (int j = 0; j < 4; j++)
+        {
+            const float *weights = b + 4 * j;
+            __m128 column = _mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(weights[0])),
+                                       _mm_mul_ps(columns[1], _mm_set1_ps(weights[1])));
+            column = _mm_add_ps(column, _mm_add_ps(_mm_mul_ps(columns[2], _mm_set1_ps(weights[2])),
+                                                   _mm_mul_ps(columns[3], _mm_set1_ps(weights[3]))));
+            _mm_storeu_ps(p_result + 4 * j, column);
+        }
+#else
+        for (int j = 0; j < 4; j++)
+            for (int i = 0; i < 4; i++)
+                p_result[4 * j + i] = a[i] * b[4 * j] + a[4 + i] * b[4 * j + 1] +
+                                      a[8 + i] * b[4 * j + 2] + a[12 + i] * b[4 * j + 3];
+#endif
+    }
+}
+
+void Camera::setPosition(const QVector3D &position)
+{
+    if (position == m_position)
+        return;
+    m_position = position;
+    viewChanged();
+}
+
+void Camera::lookAlong(const QVector3D &position, const QVector3D &front, const QVector3D &up)
+{
+    // fromDirection() turns +Z onto its argument, the camera looks down -Z
+    QQuaternion orientation = QQuaternion::fromDirection(-front, up);
+    if (position == m_position && orientation == m_orientation)
+        return;
+    m_position = position;
+    m_orientation = orientation;
+    viewChanged();
+}
+
+void Camera::setPerspective(float fov, float aspectRatio, float nearPlane, float farPlane)
+{
+    if (fov == m_fov && aspectRatio == m_aspectRatio && nearPlane == m_nearPlane && farPlane == m_farPlane)
+        return;
+    m_fov = fov;
+    m_aspectRatio = aspectRatio;
+    m_nearPlane = nearPlane;
+    m_farPlane = farPlane;
+    m_projectionDirty = m_viewProjectionDirty = true;
+}
+
+void Camera::translateWorld(const QVector3D &offset)
+{
+    m_position += offset;
+    viewChanged();
+}
+
+void Camera::pan(float angle)
+{
+    rotateLocal(QVector3D(0.0f, 1.0f, 0.0f), -angle);
+}
+
+void Camera::tilt(float angle)
+{
+    rotateLocal(QVector3D(1.0f, 0.0f, 0.0f), angle);
+}
+
+void Camera::roll(float angle)
+{
+    rotateLocal(QVector3D(0.0f, 0.0f, 1.0f), angle);
+}
+
+void Camera::rotateLocal(const QVector3D &axis, float angle)
+{
+    // Renormalised, or the rounding of thousands of small turns would start to scale the view
+    m_orientation = (m_orientation * QQuaternion::fromAxisAndAngle(axis, angle)).normalized();
+    viewChanged();
+}
+
+const QMatrix4x4& Camera::viewMatrix() const
+{
+    if (m_viewDirty)
+    {
+        // The inverse of the camera transform: the transposed rotation, then the position moved back
+        const QVector3D right = rightVector();
+        const QVector3D up = upVector();
+        const QVector3D back = -viewVector();
+        m_viewMatrix = QMatrix4x4(right.x(), right.y(), right.z(), -QVector3D::dotProduct(right, m_position),
+                                  up.x(),    up.y(),    up.z(),    -QVector3D::dotProduct(up, m_position),
+                                  back.x(),  back.y(),  back.z(),  -QVector3D::dotProduct(back, m_position),
+                                  0.0f,      0.0f,      0.0f,      1.0f);
+        m_viewDirty = false;
+    }
+    return m_viewMatrix;
+}
+
+const QMatrix4x4& Camera::projectionMatrix() const
+{
+    if (m_projectionDirty)
+    {
+        m_projectionMatrix.setToIdentity();
+        m_projectionMatrix.perspective(m_fov, m_aspectRatio, m_nearPlane, m_farPlane);
+        m_projectionDirty = false;
+    }
+    return m_projectionMatrix;
+}
+
+const QMatrix4x4& Camera::viewProjectionMatrix() const
+{
+    if (m_viewProjectionDirty)
+    {
+        QMatrix4x4 product;
+        multiply(projectionMatrix().constData(), viewMatrix().constData(), product.data());
+        m_viewProjectionMatrix = product;
+        m_viewProjectionDirty = false;
+    }
+    return m_viewProjectionMatrix;
+}
@@ -0,0 +1,133 @@
+#include "clustered_lighting.h"
+
+#include <QtDebug>
+
+#include <algorithm>
+#include <math.h>
+
+float PointLight::attenuationRadius() const
+{
+    if (radius > 0.0f)
+        return radius;
+
+    // constant + linear * d + quadratic * d^2 = 256 * brightest channel
+    float brightest = 0.0f;
+    for (const QVector3D &color: {ambient, diffuse, specular})
+        brightest = std::max({brightest, color.x(), color.y(), color.z()});
+    float c = constant - 256.0f * brightest;
+    if (c >= 0.0f)
+        return 0.0f;
+    if (quadratic <= 0.0f)
+        return linear > 0.0f ? -c / linear : 1e6f;
+    return (-linear + sqrtf(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+}
+
+ClusteredLighting::ClusteredLighting(GLStateCache *p_stateCache)
+    : mp_stateCache(p_stateCache)
+{
+    initializeOpenGLFunctions();
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &m_maxTexels);
+
+    const GLenum formats[BuffersCount] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+    glGenBuffers(BuffersCount, m_buffers);
+    glGenTextures(BuffersCount, m_textures);
+    for (int i = 0; i < BuffersCount; i++)
+    {
+        mp_stateCache->bindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        mp_stateCache->bindTexture(0, GL_TEXTURE_BUFFER, m_textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+    }
+    mp_stateCache->bindTexture(0, GL_TEXTURE_BUFFER, 0);
+}
+
+ClusteredLighting::~ClusteredLighting()
+{
+    glDeleteTextures(BuffersCount, m_textures);
+    glDeleteBuffers(BuffersCount, m_buffers);
+}
+
+void ClusteredLighting::assign(const std::vector<PointLight> &lights, const QMatrix4x4 &view,
+                               const QMatrix4x4 &projection, float nearPlane, float farPlane)
+{
+    m_spheres.resize(lights.size());
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        QVector3D center = view.map(lights[i].position);
+        m_spheres[i] = {center.x(), center.y(), center.z(), lights[i].attenuationRadius()};
+    }
+
+    m_params.nearPlane = nearPlane;
+    m_params.farPlane = farPlane;
+    m_params.p_projection = projection.constData();
+    m_grid.build(m_params, m_spheres);
+    m_params.p_projection = nullptr;
+
+    if (!m_overflowReported && m_grid.indices().size() > size_t(m_maxTexels))
+    {
+        qDebug() << "Light index list exceeds GL_MAX_TEXTURE_BUFFER_SIZE:" << m_grid.indices().size();
+        m_overflowReported = true;
+    }
+
+    packLights(lights);
+    m_clustersAssigned = true;
+}
+
+void ClusteredLighting::packLights(const std::vector<PointLight> &lights)
+{
+    m_clustersAssigned = false;
+    m_lightTexels.resize(lights.size() * 16);
+
+    float *p_texel = m_lightTexels.data();
+    for (const PointLight &light: lights)
+    {
+        const float radius = light.attenuationRadius();
+
+        // Same layout as PointLight in light_casters.fs
+        std140Copy(p_texel, light.position);
+        p_texel[3] = radius;
+        std140Copy(p_texel + 4, light.ambient);
+        p_texel[7] = light.constant;
+        std140Copy(p_texel + 8, light.diffuse);
+        p_texel[11] = light.linear;
+        std140Copy(p_texel + 12, light.specular);
+        p_texel[15] = light.quadratic;
+        p_texel += 16;
+    }
+}
+
+void ClusteredLighting::upload()
+{
+    upload(LightsBuffer, m_lightTexels.data(), m_lightTexels.size() * sizeof(float));
+    if (!m_clustersAssigned)
+        return;
+    upload(ClustersBuffer, m_grid.clusters().data(), m_grid.clusters().size() * sizeof(uint32_t));
+    upload(IndicesBuffer, m_grid.indices().data(), m_grid.indices().size() * sizeof(uint32_t));
+}
+
+void ClusteredLighting::upload(TextureBuffer buffer, const void *p_data, size_t bytes)
+{
+    // Orphaned every frame; an empty buffer still gets one element so the texture stays valid
+    mp_stateCache->bindBuffer(GL_TEXTURE_BUFFER, m_buffers[buffer]);
+    glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(std::max<size_t>(bytes, 16)), nullptr, GL_STREAM_DRAW);
+    if (bytes)
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, GLsizeiptr(bytes), p_data);
+}
+
+void ClusteredLighting::fillBlock(ClusterBlock *p_block, int viewportWidth, int viewportHeight) const
+{
+    p_block->grid[0] = m_params.tilesX;
+    p_block->grid[1] = m_params.tilesY;
+    p_block->grid[2] = m_params.slices;
+    p_block->grid[3] = unsigned(m_spheres.size());
+    p_block->sliceScale = m_grid.sliceScale();
+    p_block->sliceBias = m_grid.sliceBias();
+    p_block->tileWidth = float(viewportWidth) / m_params.tilesX;
+    p_block->tileHeight = float(viewportHeight) / m_params.tilesY;
+}
+
+void ClusteredLighting::bind(unsigned int firstUnit)
+{
+    for (int i = 0; i < BuffersCount; i++)
+        mp_stateCache->bindTexture(firstUnit + i, GL_TEXTURE_BUFFER, m_textures[i]);
+}
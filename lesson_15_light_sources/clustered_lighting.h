@@ -0,0 +1,78 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <vector>
+
+#include <gl_state_cache.h>
+#include <light_grid.h>
+#include <uniform_blocks.h>
+
+struct PointLight
+{
+    QVector3D   position;
+    QVector3D   ambient;
+    QVector3D   diffuse;
+    QVector3D   specular;
+    float       constant = 1.0f;
+    float       linear = 0.09f;
+    float       quadratic = 0.032f;
+    float       radius = 0.0f;      // 0: derived from the attenuation
+
+    // Distance at which the brightest channel falls below 1/256
+    float attenuationRadius() const;
+};
+
+// Point lights for the forward shader, any number of them. Every frame the
+// lights are assigned to a LightGrid of view clusters on the CPU and the
+// result goes to three texture buffers: light parameters (4 RGBA32F texels
+// per light), (offset, count) per cluster and the flat light index list.
+// assign() and packLights() touch no GL state and may run on a job thread;
+// upload() then hands the result to the driver from the context thread.
+class ClusteredLighting : protected QOpenGLFunctions_3_3_Core
+{
+public:
+    enum TextureBuffer
+    {
+        LightsBuffer = 0,
+        ClustersBuffer = 1,
+        IndicesBuffer = 2,
+        BuffersCount = 3
+    };
+private:
+    GLStateCache*                       mp_stateCache;
+    GLuint                              m_buffers[BuffersCount];
+    GLuint                              m_textures[BuffersCount];
+    GLint                               m_maxTexels = 0;
+    bool                                m_overflowReported = false;
+
+    LightGrid                           m_grid;
+    LightGrid::Params                   m_params;
+    std::vector<LightSphere>            m_spheres;
+    std::vector<float>                  m_lightTexels;
+    bool                                m_clustersAssigned = false;
+public:
+    explicit ClusteredLighting(GLStateCache *p_stateCache);
+    ~ClusteredLighting();
+
+    void assign(const std::vector<PointLight> &lights, const QMatrix4x4 &view, const QMatrix4x4 &projection,
+                float nearPlane, float farPlane);
+    // Light parameters only, without the cluster assignment; for the deferred path
+    void packLights(const std::vector<PointLight> &lights);
+    // Whatever the last assign() or packLights() produced
+    void upload();
+    void fillBlock(ClusterBlock *p_block, int viewportWidth, int viewportHeight) const;
+    // Binds the three buffers to units firstUnit .. firstUnit + 2, in TextureBuffer order
+    void bind(unsigned int firstUnit);
+
+    size_t lights() const { return m_spheres.size(); }
+    size_t clusters() const { return m_grid.clusterCount(); }
+    size_t lightIndices() const { return m_grid.indices().size(); }
+private:
+    void upload(TextureBuffer buffer, const void *p_data, size_t bytes);
+};
+
+#endif // CLUSTERED_LIGHTING_H
@@ -0,0 +1,113 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Linear buffer of draw command packets. Recording makes no GL call, so any
+// thread can fill one; the context thread then walks it front to back and
+// issues the calls. A packet is one 32-bit header word (opcode in the high
+// half, payload size in words in the low half) followed by the payload struct.
+// clear() keeps the capacity, so a buffer reused every frame stops allocating.
+class CommandBuffer
+{
+private:
+    std::vector<uint32_t>               m_words;
+    unsigned int                        m_packets = 0;
+public:
+    template <class Packet>
+    void record(const Packet &packet)
+    {
+        static_assert(sizeof(Packet) % sizeof(uint32_t) == 0, "Packets are whole 32-bit words");
+        const size_t words = sizeof(Packet) / sizeof(uint32_t);
+        const size_t at = m_words.size();
+        m_words.resize(at + 1 + words);
+        m_words[at] = (uint32_t(Packet::opcode) << 16) | uint32_t(words);
+        std::memcpy(&m_words[at + 1], &packet, sizeof(Packet));
+        m_packets++;
+    }
+
+    // Calls visitor(opcode, p_payload) for every packet, in recording order
+    template <class Visitor>
+    void replay(Visitor visitor) const
+    {
+        for (size_t at = 0; at < m_words.size(); at += 1 + (m_words[at] & 0xffff))
+            visitor(m_words[at] >> 16, &m_words[at + 1]);
+    }
+
+    template <class Packet>
+    static Packet payload(const uint32_t *p_payload)
+    {
+        Packet packet;
+        std::memcpy(&packet, p_payload, sizeof(Packet));
+        return packet;
+    }
+
+    void clear() { m_words.clear(); m_packets = 0; }
+    unsigned int packets() const { return m_packets; }
+    size_t bytes() const { return m_words.size() * sizeof(uint32_t); }
+};
+
+// Packets of the lesson's draw list, in the order a draw needs them
+namespace DrawCommands
+{
+    enum Opcode
+    {
+        BindPipelineOp = 1,
+        BindMaterialOp,
+        SetInstancesOp,
+        SetCubeOp,
+        SetLampOp,
+        DrawOp
+    };
+
+    // Program variant and its fixed uniforms; resets the instance range
+    struct BindPipeline
+    {
+        static const Opcode opcode = BindPipelineOp;
+        uint32_t    pipeline;
+        uint32_t    features;
+    };
+
+    // Diffuse and specular texture arrays of a cube batch
+    struct BindMaterial
+    {
+        static const Opcode opcode = BindMaterialOp;
+        uint32_t    diffuseArray;
+        uint32_t    specularArray;
+    };
+
+    // Instances [first, first + count) of the visible instance buffer feed the next draws
+    struct SetInstances
+    {
+        static const Opcode opcode = SetInstancesOp;
+        uint32_t    first;
+        uint32_t    count;
+    };
+
+    // Per-draw uniforms of the reference path, matrices column-major
+    struct SetCube
+    {
+        static const Opcode opcode = SetCubeOp;
+        float       model[16];
+        float       normal[9];
+        float       layers[2];
+    };
+
+    struct SetLamp
+    {
+        static const Opcode opcode = SetLampOp;
+        float       model[16];
+    };
+
+    // Instanced when the last SetInstances gave a range, a single draw otherwise
+    struct Draw
+    {
+        static const Opcode opcode = DrawOp;
+        uint32_t    vertexCount;
+    };
+}
+
+#endif // COMMAND_BUFFER_H
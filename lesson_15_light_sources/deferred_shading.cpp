@@ -0,0 +1,255 @@
+#include "deferred_shading.h"
+
+#include <QVector3D>
+#include <QtDebug>
+
+#include <algorithm>
+
+DeferredShading::DeferredShading(GLStateCache *p_stateCache, const QString &shaderDirectory,
+                                 const ShaderVariants::LoadFunction &load, UniformBuffer *p_cameraBlock,
+                                 UniformBuffer *p_lightsBlock)
+    : mp_stateCache(p_stateCache),
+      mp_directionalVariants(nullptr),
+      mp_pointVariants(nullptr)
+{
+    initializeOpenGLFunctions();
+
+    // The full-screen triangle comes from gl_VertexID, core profile still wants a VAO bound
+    glGenVertexArrays(1, &m_fullscreenVAO);
+
+    glGenVertexArrays(1, &m_rectVAO);
+    glGenBuffers(1, &m_rectVBO);
+    glBindVertexArray(m_rectVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_rectVBO);
+    const GLsizei stride = cm_rectStride * sizeof(float);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, 1);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, stride, (void*)(4 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+
+    // Light passes read the G-buffer with texelFetch, depth is neither tested nor written
+    PipelineState::Description directional;
+    directional.vertexArray = m_fullscreenVAO;
+    directional.depthTest = false;
+    directional.depthWrite = false;
+    mp_directionalVariants = new ShaderVariants(shaderDirectory + QString("deferred_fullscreen.vs"),
+                                                shaderDirectory + QString("deferred_directional.fs"), 0,
+                                                directional, load,
+                                                [this, p_cameraBlock, p_lightsBlock](QOpenGLShaderProgram *p_program,
+                                                                                     UniformBinding *p_uniforms)
+    {
+        resolve(p_uniforms);
+        p_cameraBlock->attach(p_program, "Camera");
+        p_lightsBlock->attach(p_program, "Lights");
+    });
+
+    PipelineState::Description point = directional;
+    point.vertexArray = m_rectVAO;
+    point.blend = true;
+    point.blendSource = GL_ONE;
+    point.blendDestination = GL_ONE;
+    mp_pointVariants = new ShaderVariants(shaderDirectory + QString("deferred_point.vs"),
+                                          shaderDirectory + QString("deferred_point.fs"), 0, point, load,
+                                          [this, p_cameraBlock](QOpenGLShaderProgram *p_program,
+                                                                UniformBinding *p_uniforms)
+    {
+        resolve(p_uniforms);
+        p_cameraBlock->attach(p_program, "Camera");
+    });
+
+    mp_directionalVariants->compileAll();
+    mp_pointVariants->compileAll();
+
+    mp_stateCache->invalidate();
+}
+
+DeferredShading::~DeferredShading()
+{
+    delete mp_directionalVariants;
+    delete mp_pointVariants;
+
+    glDeleteFramebuffers(1, &m_framebuffer);
+    glDeleteTextures(TargetsCount, m_targets);
+    glDeleteVertexArrays(1, &m_fullscreenVAO);
+    glDeleteVertexArrays(1, &m_rectVAO);
+    glDeleteBuffers(1, &m_rectVBO);
+}
+
+void DeferredShading::resolve(UniformBinding *p_binding)
+{
+    // Fixed order, so both programs and every reload produce the same handles
+    m_handles.gAlbedoSpecular = p_binding->resolve("gAlbedoSpecular");
+    m_handles.gNormal = p_binding->resolve("gNormal");
+    m_handles.gDepth = p_binding->resolve("gDepth");
+    m_handles.inverseViewProjection = p_binding->resolve("inverseViewProjection");
+    m_handles.shininess = p_binding->resolve("shininess");
+    m_handles.pointLightData = p_binding->resolve("pointLightData");
+}
+
+void DeferredShading::resize(int width, int height)
+{
+    width = std::max(width, 1);
+    height = std::max(height, 1);
+    if (width == m_width && height == m_height)
+        return;
+    m_width = width;
+    m_height = height;
+
+    if (m_framebuffer == 0)
+    {
+        glGenFramebuffers(1, &m_framebuffer);
+        glGenTextures(TargetsCount, m_targets);
+    }
+
+    // Depth-stencil matches the window's format, so glBlitFramebuffer can copy it
+    const GLenum internalFormats[TargetsCount] = {GL_RGBA8, GL_RG16F, GL_DEPTH24_STENCIL8};
+    const GLenum formats[TargetsCount] = {GL_RGBA, GL_RG, GL_DEPTH_STENCIL};
+    const GLenum types[TargetsCount] = {GL_UNSIGNED_BYTE, GL_HALF_FLOAT, GL_UNSIGNED_INT_24_8};
+    for (int i = 0; i < TargetsCount; i++)
+    {
+        mp_stateCache->bindTexture(0, GL_TEXTURE_2D, m_targets[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GLint(internalFormats[i]), width, height, 0, formats[i], types[i], nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    mp_stateCache->bindTexture(0, GL_TEXTURE_2D, 0);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_targets[AlbedoSpecularTarget], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_targets[NormalTarget], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, m_targets[DepthTarget], 0);
+    const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        qDebug() << "G-buffer framebuffer is incomplete:" << width << "x" << height;
+    glBindFramebuffer(GL_FRAMEBUFFER, GLuint(previous));
+}
+
+void DeferredShading::beginGeometry()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    mp_stateCache->depthMask(true);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+bool DeferredShading::lightRect(const PointLight &light, const QMatrix4x4 &view, const QMatrix4x4 &projection,
+                                float nearPlane, float *p_rect) const
+{
+    const float radius = light.attenuationRadius();
+    const QVector3D center = view.map(light.position);
+    const float depth = -center.z();
+    if (radius <= 0.0f || depth + radius < nearPlane)
+        return false;
+
+    // A sphere crossing the near plane can cover any part of the screen
+    float x0 = -1.0f, y0 = -1.0f, x1 = 1.0f, y1 = 1.0f;
+    if (depth - radius >= nearPlane)
+    {
+        // Corners of the view space box around the sphere, all in front of the camera
+        x0 = y0 = 1.0f;
+        x1 = y1 = -1.0f;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            QVector3D offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius,
+                             (corner & 4) ? radius : -radius);
+            QVector3D ndc = projection.map(center + offset);
+            x0 = std::min(x0, ndc.x());
+            y0 = std::min(y0, ndc.y());
+            x1 = std::max(x1, ndc.x());
+            y1 = std::max(y1, ndc.y());
+        }
+        x0 = std::max(x0, -1.0f);
+        y0 = std::max(y0, -1.0f);
+        x1 = std::min(x1, 1.0f);
+        y1 = std::min(y1, 1.0f);
+        if (x0 >= x1 || y0 >= y1)
+            return false;
+    }
+
+    p_rect[0] = x0;
+    p_rect[1] = y0;
+    p_rect[2] = x1;
+    p_rect[3] = y1;
+    return true;
+}
+
+void DeferredShading::setUniforms(UniformBinding *p_binding, const QMatrix4x4 &inverseViewProjection,
+                                  unsigned int firstTargetUnit, unsigned int pointLightUnit)
+{
+    const DeferredLightUniforms &handles = m_handles;
+    p_binding->set(handles.gAlbedoSpecular, int(firstTargetUnit + AlbedoSpecularTarget));
+    p_binding->set(handles.gNormal, int(firstTargetUnit + NormalTarget));
+    p_binding->set(handles.gDepth, int(firstTargetUnit + DepthTarget));
+    p_binding->set(handles.inverseViewProjection, inverseViewProjection);
+    // Same constant the forward path passes as material.shininess
+    p_binding->set(handles.shininess, 64.0f);
+    p_binding->set(handles.pointLightData, int(pointLightUnit));
+}
+
+void DeferredShading::shade(const std::vector<PointLight> &lights, const QMatrix4x4 &view,
+                            const QMatrix4x4 &projection, float nearPlane, GLuint targetFramebuffer,
+                            unsigned int firstTargetUnit, unsigned int pointLightUnit)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    for (int i = 0; i < TargetsCount; i++)
+        mp_stateCache->bindTexture(firstTargetUnit + i, GL_TEXTURE_2D, m_targets[i]);
+
+    const QMatrix4x4 inverseViewProjection = (projection * view).inverted();
+
+    // Directional light and torch: once per visible pixel
+    const ShaderVariants::Variant &directional = mp_directionalVariants->variant(0);
+    mp_stateCache->apply(*directional.p_pipeline);
+    setUniforms(directional.p_uniforms, inverseViewProjection, firstTargetUnit, pointLightUnit);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // Point lights: the screen rectangle of each light sphere bounds its pixels the way a
+    // scissor rectangle would, but all rectangles go out as one instanced draw
+    m_rects.clear();
+    m_rectPixels = 0.0;
+    float rect[4];
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        if (!lightRect(lights[i], view, projection, nearPlane, rect))
+            continue;
+        m_rects.insert(m_rects.end(), rect, rect + 4);
+        m_rects.push_back(float(i));
+        m_rectPixels += 0.25 * (rect[2] - rect[0]) * m_width * (rect[3] - rect[1]) * m_height;
+    }
+
+    if (!m_rects.empty())
+    {
+        const ShaderVariants::Variant &point = mp_pointVariants->variant(0);
+        mp_stateCache->apply(*point.p_pipeline);
+        setUniforms(point.p_uniforms, inverseViewProjection, firstTargetUnit, pointLightUnit);
+        mp_stateCache->bindBuffer(GL_ARRAY_BUFFER, m_rectVBO);
+        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(m_rects.size() * sizeof(float)), m_rects.data(), GL_STREAM_DRAW);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GLsizei(shadedLights()));
+    }
+
+    // Forward geometry drawn after this (the lamps) is depth tested against the scene
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+}
+
+UniformStats DeferredShading::uniformStats() const
+{
+    UniformStats directional = mp_directionalVariants->uniformStats();
+    UniformStats point = mp_pointVariants->uniformStats();
+    directional.lookups += point.lookups;
+    directional.uploads += point.uploads;
+    directional.skipped += point.skipped;
+    return directional;
+}
+
+void DeferredShading::resetStats()
+{
+    mp_directionalVariants->resetStats();
+    mp_pointVariants->resetStats();
+}
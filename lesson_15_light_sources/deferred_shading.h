@@ -0,0 +1,84 @@
+#ifndef DEFERRED_SHADING_H
+#define DEFERRED_SHADING_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLShaderProgram>
+#include <QMatrix4x4>
+
+#include <vector>
+
+#include <clustered_lighting.h>
+#include <gl_state_cache.h>
+#include <shader_uniforms.h>
+#include <shader_variants.h>
+#include <uniform_buffer.h>
+
+// Deferred alternative to the forward light_casters program. The geometry pass
+// renders into a G-buffer: albedo + specular intensity (RGBA8), octahedral
+// normal (RG16F) and depth-stencil, 8 bytes of colour per pixel. Positions are
+// rebuilt from depth. The directional light and the torch then shade every
+// visible pixel once, and each point light shades only its screen rectangle.
+class DeferredShading : protected QOpenGLFunctions_3_3_Core
+{
+public:
+    enum Target
+    {
+        AlbedoSpecularTarget = 0,
+        NormalTarget = 1,
+        DepthTarget = 2,
+        TargetsCount = 3
+    };
+private:
+    // NDC rectangle and light index per point light instance
+    static const int                    cm_rectStride = 5;
+
+    GLStateCache*                       mp_stateCache;
+    GLuint                              m_framebuffer = 0;
+    GLuint                              m_targets[TargetsCount] = {};
+    int                                 m_width = 0;
+    int                                 m_height = 0;
+
+    GLuint                              m_fullscreenVAO;
+    GLuint                              m_rectVAO, m_rectVBO;
+    std::vector<float>                  m_rects;
+    double                              m_rectPixels = 0.0;
+
+    // Single variants, so the shader reloader can swap them like any other program
+    ShaderVariants*                     mp_directionalVariants;
+    ShaderVariants*                     mp_pointVariants;
+    DeferredLightUniforms               m_handles;      // same for both programs
+public:
+    // Programs are loaded from shaderDirectory through load, which goes through the ShaderCache
+    DeferredShading(GLStateCache *p_stateCache, const QString &shaderDirectory,
+                    const ShaderVariants::LoadFunction &load, UniformBuffer *p_cameraBlock,
+                    UniformBuffer *p_lightsBlock);
+    ~DeferredShading();
+
+    // (Re)allocates the G-buffer, called from resizeGL()
+    void resize(int width, int height);
+
+    // Binds and clears the G-buffer; the caller then draws the opaque geometry
+    void beginGeometry();
+
+    // Lights the G-buffer into targetFramebuffer and copies the depth there, so forward
+    // geometry drawn afterwards is still depth tested. The point light parameters are
+    // expected in the texture buffer bound to pointLightUnit, in the order of lights.
+    void shade(const std::vector<PointLight> &lights, const QMatrix4x4 &view, const QMatrix4x4 &projection,
+               float nearPlane, GLuint targetFramebuffer, unsigned int firstTargetUnit, unsigned int pointLightUnit);
+
+    size_t shadedLights() const { return m_rects.size() / cm_rectStride; }
+    // Pixels covered by the point light rectangles, the deferred counterpart of the cluster list length
+    double rectPixels() const { return m_rectPixels; }
+
+    std::vector<ShaderVariants*> shaderVariants() const { return {mp_directionalVariants, mp_pointVariants}; }
+    UniformStats uniformStats() const;
+    void resetStats();
+private:
+    void resolve(UniformBinding *p_binding);
+    void setUniforms(UniformBinding *p_binding, const QMatrix4x4 &inverseViewProjection,
+                     unsigned int firstTargetUnit, unsigned int pointLightUnit);
+    bool lightRect(const PointLight &light, const QMatrix4x4 &view, const QMatrix4x4 &projection,
+                   float nearPlane, float *p_rect) const;
+};
+
+#endif // DEFERRED_SHADING_H
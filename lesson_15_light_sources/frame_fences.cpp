@@ -0,0 +1,48 @@
+#include "frame_fences.h"
+
+#include <QElapsedTimer>
+
+namespace
+{
+    // Re-checked in steps, so a lost context does not hang the render thread for good
+    const GLuint64      cm_waitStep = 100000000;    // 100 ms
+}
+
+FrameFences::FrameFences(unsigned int framesInFlight)
+    : m_fences(framesInFlight, nullptr)
+{
+    initializeOpenGLFunctions();
+}
+
+FrameFences::~FrameFences()
+{
+    for (GLsync fence: m_fences)
+        if (fence)
+            glDeleteSync(fence);
+}
+
+void FrameFences::wait()
+{
+    GLsync &fence = m_fences[m_next];
+    if (!fence)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int step = 0; step < 10; step++)
+    {
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, cm_waitStep);
+        if (status != GL_TIMEOUT_EXPIRED)
+            break;
+    }
+    m_waitNs += timer.nsecsElapsed();
+
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void FrameFences::insert()
+{
+    m_fences[m_next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_next = (m_next + 1) % m_fences.size();
+}
@@ -0,0 +1,32 @@
+#ifndef FRAME_FENCES_H
+#define FRAME_FENCES_H
+
+#include <QOpenGLFunctions_3_3_Core>
+
+#include <vector>
+
+// Bounds how far the CPU runs ahead of the GPU. insert() puts a fence behind
+// the commands of a frame, wait() blocks until the frame framesInFlight
+// frames back has finished on the GPU. The CPU work done before wait() thus
+// overlaps with the GPU still drawing the previous frame, while per-frame
+// buffers are never rewritten more than framesInFlight frames ahead.
+class FrameFences : protected QOpenGLFunctions_3_3_Core
+{
+private:
+    std::vector<GLsync>                 m_fences;       // ring, one slot per frame in flight
+    size_t                              m_next = 0;
+    qint64                              m_waitNs = 0;
+public:
+    explicit FrameFences(unsigned int framesInFlight);
+    ~FrameFences();
+
+    // Before the first GL command that writes this frame's data
+    void wait();
+    // After the last command of the frame
+    void insert();
+
+    qint64 waitNs() const { return m_waitNs; }
+    void resetStats() { m_waitNs = 0; }
+};
+
+#endif // FRAME_FENCES_H
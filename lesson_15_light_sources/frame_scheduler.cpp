@@ -0,0 +1,105 @@
+#include "frame_scheduler.h"
+
+#include <QMutexLocker>
+#include <QThread>
+
+#include <algorithm>
+
+void FrameHistogram::add(qint64 intervalNs)
+{
+    if (m_samples.size() < size_t(cm_window))
+    {
+        m_samples.push_back(intervalNs);
+    }
+    else
+    {
+        qint64 &oldest = m_samples[m_next];
+        m_buckets[bucket(oldest)]--;
+        m_sumNs -= oldest;
+        oldest = intervalNs;
+        m_next = (m_next + 1) % m_samples.size();
+    }
+    m_buckets[bucket(intervalNs)]++;
+    m_sumNs += intervalNs;
+}
+
+int FrameHistogram::bucket(qint64 intervalNs)
+{
+    return int(std::min<qint64>(intervalNs / cm_bucketNs, cm_bucketsCount - 1));
+}
+
+double FrameHistogram::meanMs() const
+{
+    return m_samples.empty() ? 0.0 : m_sumNs / 1e6 / m_samples.size();
+}
+
+double FrameHistogram::percentileMs(double fraction) const
+{
+    size_t rank = size_t(fraction * m_samples.size());
+    size_t counted = 0;
+    for (int i = 0; i < cm_bucketsCount; i++)
+    {
+        counted += m_buckets[i];
+        if (counted > rank)
+            return (i + 1) * cm_bucketNs / 1e6;
+    }
+    return cm_bucketsCount * cm_bucketNs / 1e6;
+}
+
+FrameScheduler::FrameScheduler()
+{
+    m_clock.start();
+}
+
+void FrameScheduler::configure(const Settings &settings)
+{
+    m_settings = settings;
+}
+
+void FrameScheduler::wake()
+{
+    QMutexLocker locker(&m_mutex);
+    m_woken = true;
+    m_wakeUp.wakeOne();
+}
+
+bool FrameScheduler::waitForFrame()
+{
+    if (m_settings.idle && !m_frameRequested)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_woken)
+            m_wakeUp.wait(&m_mutex, cm_idleTimeout);
+        m_woken = false;
+        m_idleWaits++;
+        m_resumed = true;
+        return false;
+    }
+    m_frameRequested = false;
+
+    if (m_settings.targetFps > 0)
+    {
+        qint64 remainingNs = m_nextFrameNs - m_clock.nsecsElapsed();
+        if (remainingNs > 0)
+            QThread::usleep(static_cast<unsigned long>(remainingNs / 1000));
+    }
+    return true;
+}
+
+void FrameScheduler::frameDone()
+{
+    qint64 now = m_clock.nsecsElapsed();
+    // The gap across an idle wait is not a frame time
+    if (m_lastFrameNs >= 0 && !m_resumed)
+        m_histogram.add(now - m_lastFrameNs);
+    m_lastFrameNs = now;
+    m_resumed = false;
+
+    if (m_settings.targetFps > 0)
+    {
+        // From the previous deadline, so sleep overshoot does not accumulate;
+        // a frame that ran late starts a new schedule instead of a catch-up burst
+        const qint64 periodNs = 1000000000 / m_settings.targetFps;
+        m_nextFrameNs = std::max(m_nextFrameNs + periodNs, now);
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <vector>
+
+// Frame intervals of the last cm_window frames, counted in fixed-width buckets.
+// The oldest sample leaves its bucket when a new one arrives, so percentiles
+// always describe the recent past and cost a walk over the buckets, no sort.
+class FrameHistogram
+{
+private:
+    static const int                    cm_window = 240;
+    static const int                    cm_bucketsCount = 200;
+    static const qint64                 cm_bucketNs = 250000;       // 0.25 ms, the last bucket takes the rest
+
+    std::vector<qint64>                 m_samples;
+    size_t                              m_next = 0;
+    unsigned int                        m_buckets[cm_bucketsCount] = {};
+    qint64                              m_sumNs = 0;
+public:
+    void add(qint64 intervalNs);
+
+    size_t size() const { return m_samples.size(); }
+    double meanMs() const;
+    // Upper edge of the bucket holding the given fraction of the samples
+    double percentileMs(double fraction) const;
+private:
+    static int bucket(qint64 intervalNs);
+};
+
+// Decides when the render thread draws. A target frame rate spaces the frames
+// out by sleeping, on top of whatever the swap interval does; in idle mode a
+// frame is drawn only after requestFrame(), for input or while something
+// animates, and the thread sleeps until the GUI thread wakes it otherwise.
+class FrameScheduler
+{
+public:
+    struct Settings
+    {
+        int                             targetFps = 0;      // 0: as fast as the swap interval allows
+        bool                            idle = false;
+    };
+private:
+    // Idle sleeps are cut short now and then so the caller can service its own events
+    static const unsigned long          cm_idleTimeout = 100;
+
+    Settings                            m_settings;
+    QElapsedTimer                       m_clock;
+    qint64                              m_nextFrameNs = 0;
+    qint64                              m_lastFrameNs = -1;
+    bool                                m_frameRequested = true;
+    bool                                m_resumed = false;
+
+    QMutex                              m_mutex;
+    QWaitCondition                      m_wakeUp;
+    bool                                m_woken = false;
+
+    FrameHistogram                      m_histogram;
+    unsigned int                        m_idleWaits = 0;
+public:
+    FrameScheduler();
+
+    // Before the render thread starts
+    void configure(const Settings &settings);
+    const Settings& settings() const { return m_settings; }
+
+    // GUI thread: input is waiting in the queue
+    void wake();
+
+    // Render thread: something changed or keeps moving
+    void requestFrame() { m_frameRequested = true; }
+    // Render thread: sleeps until the next frame is due and returns true, or returns
+    // false after an idle wait, so the caller can poll and ask again
+    bool waitForFrame();
+    // True for the first frame after an idle wait, time stood still meanwhile
+    bool resumed() const { return m_resumed; }
+    // Render thread: after the swap
+    void frameDone();
+
+    const FrameHistogram& histogram() const { return m_histogram; }
+    unsigned int idleWaits() const { return m_idleWaits; }
+    void resetStats() { m_idleWaits = 0; }
+};
+
+#endif // FRAME_SCHEDULER_H
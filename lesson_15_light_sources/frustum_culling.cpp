@@ -0,0 +1,284 @@
+#include "frustum_culling.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULLING_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE
+#endif
+
+void BoundsSoA::clear()
+{
+    for (AlignedArray<float> *p_array: {&centerX, &centerY, &centerZ, &radius, &extentX, &extentY, &extentZ})
+        p_array->clear();
+}
+
+void BoundsSoA::reserve(unsigned int count)
+{
+    for (AlignedArray<float> *p_array: {&centerX, &centerY, &centerZ, &radius, &extentX, &extentY, &extentZ})
+        p_array->reserve(count);
+}
+
+void BoundsSoA::add(const QVector3D &center, float sphereRadius, const QVector3D &halfExtents)
+{
+    centerX.push_back(center.x());
+    centerY.push_back(center.y());
+    centerZ.push_back(center.z());
+    radius.push_back(sphereRadius);
+    extentX.push_back(halfExtents.x());
+    extentY.push_back(halfExtents.y());
+    extentZ.push_back(halfExtents.z());
+}
+
+Frustum Culling::extractFrustum(const QMatrix4x4 &viewProjection)
+{
+    // Gribb & Hartmann: planes are sums and differences of the matrix rows
+    const QVector4D rows[4] = {viewProjection.row(0), viewProjection.row(1),
+                               viewProjection.row(2), viewProjection.row(3)};
+    const QVector4D planes[6] = {rows[3] + rows[0], rows[3] - rows[0],
+                                 rows[3] + rows[1], rows[3] - rows[1],
+                                 rows[3] + rows[2], rows[3] - rows[2]};
+
+    Frustum frustum;
+    for (int i = 0; i < 6; i++)
+    {
+        float length = planes[i].toVector3D().length();
+        for (int j = 0; j < 4; j++)
+            frustum.planes[i][j] = planes[i][j] / length;
+    }
+    return frustum;
+}
+
+namespace
+{
+    inline bool sphereVisible(const Frustum &frustum, const BoundsSoA &bounds, unsigned int i)
+    {
+        for (const float *plane: frustum.planes)
+        {
+            float distance = plane[0] * bounds.centerX[i] + plane[1] * bounds.centerY[i] +
+                             plane[2] * bounds.centerZ[i] + plane[3];
+            if (distance < -bounds.radius[i])
+                return false;
+        }
+        return true;
+    }
+
+    inline bool boxVisible(const Frustum &frustum, const BoundsSoA &bounds, unsigned int i)
+    {
+        for (const float *plane: frustum.planes)
+        {
+            float distance = plane[0] * bounds.centerX[i] + plane[1] * bounds.centerY[i] +
+                             plane[2] * bounds.centerZ[i] + plane[3];
+            float projectedExtent = std::fabs(plane[0]) * bounds.extentX[i] +
+                                    std::fabs(plane[1]) * bounds.extentY[i] +
+                                    std::fabs(plane[2]) * bounds.extentZ[i];
+            if (distance < -projectedExtent)
+                return false;
+        }
+        return true;
+    }
+
+    // Branchless compaction: every lane is written, only visible ones advance the output.
+    // The output must have room for 8 entries past the current position.
+    inline unsigned int *appendVisible(int mask, int lanes, unsigned int base, unsigned int *p_out)
+    {
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            *p_out = base + lane;
+            p_out += (mask >> lane) & 1;
+        }
+        return p_out;
+    }
+}
+
+#if defined(CULLING_AVX)
+
+void Culling::cullSpheres(const Frustum &frustum, const BoundsSoA &bounds, unsigned int first, unsigned int last,
+                          std::vector<unsigned int> *p_visible)
+{
+    p_visible->resize(last - first + 8);
+    unsigned int *p_out = p_visible->data();
+    unsigned int i = first;
+
+    __m256 planes[6][4];
+    for (int p = 0; p < 6; p++)
+        for (int j = 0; j < 4; j++)
+            planes[p][j] = _mm256_set1_ps(frustum.planes[p][j]);
+
+    for (; i + 8 <= last; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&bounds.centerX[i]);
+        __m256 y = _mm256_loadu_ps(&bounds.centerY[i]);
+        __m256 z = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&bounds.radius[i]));
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const __m256 *plane: planes)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, plane[0]), _mm256_mul_ps(y, plane[1])),
+                                            _mm256_add_ps(_mm256_mul_ps(z, plane[2]), plane[3]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+        }
+        p_out = appendVisible(_mm256_movemask_ps(inside), 8, i, p_out);
+    }
+
+    for (; i < last; i++)
+        if (sphereVisible(frustum, bounds, i))
+            *p_out++ = i;
+
+    p_visible->resize(p_out - p_visible->data());
+}
+
+void Culling::cullBoxes(const Frustum &frustum, const BoundsSoA &bounds, unsigned int first, unsigned int last,
+                        std::vector<unsigned int> *p_visible)
+{
+    p_visible->resize(last - first + 8);
+    unsigned int *p_out = p_visible->data();
+    unsigned int i = first;
+
+    // Plane coefficients followed by their absolute values for the extent projection
+    __m256 planes[6][7];
+    for (int p = 0; p < 6; p++)
+        for (int j = 0; j < 4; j++)
+        {
+            planes[p][j] = _mm256_set1_ps(frustum.planes[p][j]);
+            if (j < 3)
+                planes[p][4 + j] = _mm256_set1_ps(std::fabs(frustum.planes[p][j]));
+        }
+
+    for (; i + 8 <= last; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&bounds.centerX[i]);
+        __m256 y = _mm256_loadu_ps(&bounds.centerY[i]);
+        __m256 z = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const __m256 *plane: planes)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, plane[0]), _mm256_mul_ps(y, plane[1])),
+                                            _mm256_add_ps(_mm256_mul_ps(z, plane[2]), plane[3]));
+            __m256 extent = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, plane[4]), _mm256_mul_ps(ey, plane[5])),
+                                          _mm256_mul_ps(ez, plane[6]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, extent),
+                                                         _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        p_out = appendVisible(_mm256_movemask_ps(inside), 8, i, p_out);
+    }
+
+    for (; i < last; i++)
+        if (boxVisible(frustum, bounds, i))
+            *p_out++ = i;
+
+    p_visible->resize(p_out - p_visible->data());
+}
+
+#elif defined(CULLING_SSE)
+
+void Culling::cullSpheres(const Frustum &frustum, const BoundsSoA &bounds, unsigned int first, unsigned int last,
+                          std::vector<unsigned int> *p_visible)
+{
+    p_visible->resize(last - first + 8);
+    unsigned int *p_out = p_visible->data();
+    unsigned int i = first;
+
+    __m128 planes[6][4];
+    for (int p = 0; p < 6; p++)
+        for (int j = 0; j < 4; j++)
+            planes[p][j] = _mm_set1_ps(frustum.planes[p][j]);
+
+    for (; i + 4 <= last; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 y = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 z = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const __m128 *plane: planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, plane[0]), _mm_mul_ps(y, plane[1])),
+                                         _mm_add_ps(_mm_mul_ps(z, plane[2]), plane[3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+        }
+        p_out = appendVisible(_mm_movemask_ps(inside), 4, i, p_out);
+    }
+
+    for (; i < last; i++)
+        if (sphereVisible(frustum, bounds, i))
+            *p_out++ = i;
+
+    p_visible->resize(p_out - p_visible->data());
+}
+
+void Culling::cullBoxes(const Frustum &frustum, const BoundsSoA &bounds, unsigned int first, unsigned int last,
+                        std::vector<unsigned int> *p_visible)
+{
+    p_visible->resize(last - first + 8);
+    unsigned int *p_out = p_visible->data();
+    unsigned int i = first;
+
+    // Plane coefficients followed by their absolute values for the extent projection
+    __m128 planes[6][7];
+    for (int p = 0; p < 6; p++)
+        for (int j = 0; j < 4; j++)
+        {
+            planes[p][j] = _mm_set1_ps(frustum.planes[p][j]);
+            if (j < 3)
+                planes[p][4 + j] = _mm_set1_ps(std::fabs(frustum.planes[p][j]));
+        }
+
+    for (; i + 4 <= last; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 y = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 z = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+        __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+        __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const __m128 *plane: planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, plane[0]), _mm_mul_ps(y, plane[1])),
+                                         _mm_add_ps(_mm_mul_ps(z, plane[2]), plane[3]));
+            __m128 extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, plane[4]), _mm_mul_ps(ey, plane[5])),
+                                       _mm_mul_ps(ez, plane[6]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, extent), _mm_setzero_ps()));
+        }
+        p_out = appendVisible(_mm_movemask_ps(inside), 4, i, p_out);
+    }
+
+    for (; i < last; i++)
+        if (boxVisible(frustum, bounds, i))
+            *p_out++ = i;
+
+    p_visible->resize(p_out - p_visible->data());
+}
+
+#else
+
+void Culling::cullSpheres(const Frustum &frustum, const BoundsSoA &bounds, unsigned int first, unsigned int last,
+                          std::vector<unsigned int> *p_visible)
+{
+    p_visible->clear();
+    for (unsigned int i = first; i < last; i++)
+        if (sphereVisible(frustum, bounds, i))
+            p_visible->push_back(i);
+}
+
+void Culling::cullBoxes(const Frustum &frustum, const BoundsSoA &bounds, unsigned int first, unsigned int last,
+                        std::vector<unsigned int> *p_visible)
+{
+    p_visible->clear();
+    for (unsigned int i = first; i < last; i++)
+        if (boxVisible(frustum, bounds, i))
+            p_visible->push_back(i);
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <aligned_allocator.h>
+
+#include <vector>
+
+// Six planes (a, b, c, d) with normals pointing inside: a*x + b*y + c*z + d >= 0
+struct Frustum
+{
+    float   planes[6][4];
+};
+
+// Bounding volumes packed as structure of arrays, so that the culling loops
+// test 4 (SSE) or 8 (AVX) objects per instruction
+struct BoundsSoA
+{
+    AlignedArray<float> centerX;
+    AlignedArray<float> centerY;
+    AlignedArray<float> centerZ;
+    AlignedArray<float> radius;
+    AlignedArray<float> extentX;
+    AlignedArray<float> extentY;
+    AlignedArray<float> extentZ;
+
+    unsigned int size() const { return static_cast<unsigned int>(centerX.size()); }
+    void clear();
+    void reserve(unsigned int count);
+    void add(const QVector3D &center, float sphereRadius, const QVector3D &halfExtents);
+};
+
+namespace Culling
+{
+    Frustum extractFrustum(const QMatrix4x4 &viewProjection);
+
+    // Clear p_visible and fill it with the indices of objects in [first, last) intersecting
+    // the frustum; separate ranges can be culled on separate threads
+    void cullSpheres(const Frustum &frustum, const BoundsSoA &bounds, unsigned int first, unsigned int last,
+                     std::vector<unsigned int> *p_visible);
+    void cullBoxes(const Frustum &frustum, const BoundsSoA &bounds, unsigned int first, unsigned int last,
+                   std::vector<unsigned int> *p_visible);
+
+    inline void cullSpheres(const Frustum &frustum, const BoundsSoA &bounds, std::vector<unsigned int> *p_visible)
+    {
+        cullSpheres(frustum, bounds, 0, bounds.size(), p_visible);
+    }
+    inline void cullBoxes(const Frustum &frustum, const BoundsSoA &bounds, std::vector<unsigned int> *p_visible)
+    {
+        cullBoxes(frustum, bounds, 0, bounds.size(), p_visible);
+    }
+}
+
+#endif // FRUSTUM_CULLING_H
@@ -0,0 +1,215 @@
+#include "gl_state_cache.h"
+
+GLStateCache::GLStateCache()
+{
+    initializeOpenGLFunctions();
+    invalidate();
+}
+
+void GLStateCache::invalidate()
+{
+    m_program = cm_unknown;
+    m_vertexArray = cm_unknown;
+    for (GLuint &buffer: m_buffers)
+        buffer = cm_unknown;
+    m_activeUnit = cm_unknown;
+    for (auto &unit: m_textures)
+        for (GLuint &texture: unit)
+            texture = cm_unknown;
+    for (GLuint &enabled: m_enabled)
+        enabled = cm_unknown;
+    m_depthWrite = cm_unknown;
+    m_depthFunc = cm_unknown;
+    m_blendSource = m_blendDestination = cm_unknown;
+    m_cullMode = cm_unknown;
+    mp_applied = nullptr;
+}
+
+bool GLStateCache::changes(GLuint *p_shadow, GLuint value)
+{
+    if (*p_shadow == value)
+    {
+        m_stats.filtered++;
+        return false;
+    }
+    *p_shadow = value;
+    m_stats.issued++;
+    return true;
+}
+
+int GLStateCache::bufferSlot(GLenum target)
+{
+    switch (target)
+    {
+    case GL_ARRAY_BUFFER:           return 0;
+    case GL_UNIFORM_BUFFER:         return 1;
+    case GL_TEXTURE_BUFFER:         return 2;
+    case GL_PIXEL_UNPACK_BUFFER:    return 3;
+    default:                        return -1;
+    }
+}
+
+int GLStateCache::textureSlot(GLenum target)
+{
+    switch (target)
+    {
+    case GL_TEXTURE_2D:             return 0;
+    case GL_TEXTURE_2D_ARRAY:       return 1;
+    case GL_TEXTURE_BUFFER:         return 2;
+    case GL_TEXTURE_CUBE_MAP:       return 3;
+    default:                        return -1;
+    }
+}
+
+int GLStateCache::capabilitySlot(GLenum capability)
+{
+    switch (capability)
+    {
+    case GL_DEPTH_TEST:             return 0;
+    case GL_BLEND:                  return 1;
+    case GL_CULL_FACE:              return 2;
+    case GL_SCISSOR_TEST:           return 3;
+    case GL_STENCIL_TEST:           return 4;
+    default:                        return -1;
+    }
+}
+
+void GLStateCache::apply(const PipelineState &state)
+{
+    // Nothing was touched since this very object was applied
+    if (mp_applied == &state)
+    {
+        m_stats.filtered++;
+        return;
+    }
+
+    const PipelineState::Description &d = state.description();
+    useProgram(d.program);
+    bindVertexArray(d.vertexArray);
+    setEnabled(GL_DEPTH_TEST, d.depthTest);
+    if (d.depthTest)
+    {
+        depthMask(d.depthWrite);
+        depthFunc(d.depthFunc);
+    }
+    setEnabled(GL_BLEND, d.blend);
+    if (d.blend)
+        blendFunc(d.blendSource, d.blendDestination);
+    setEnabled(GL_CULL_FACE, d.cullFace);
+    if (d.cullFace)
+        cullFace(d.cullMode);
+
+    mp_applied = &state;
+}
+
+void GLStateCache::useProgram(GLuint program)
+{
+    if (changes(&m_program, program))
+    {
+        glUseProgram(program);
+        mp_applied = nullptr;
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint vertexArray)
+{
+    if (changes(&m_vertexArray, vertexArray))
+    {
+        glBindVertexArray(vertexArray);
+        mp_applied = nullptr;
+    }
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+    int slot = bufferSlot(target);
+    if (slot < 0)
+    {
+        // Untracked target, e.g. GL_ELEMENT_ARRAY_BUFFER which belongs to the VAO
+        m_stats.issued++;
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (changes(&m_buffers[slot], buffer))
+        glBindBuffer(target, buffer);
+}
+
+void GLStateCache::bindTexture(unsigned int unit, GLenum target, GLuint texture)
+{
+    int slot = textureSlot(target);
+    if (slot < 0 || unit >= unsigned(cm_textureUnits))
+    {
+        m_stats.issued += 2;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        m_activeUnit = GL_TEXTURE0 + unit;
+        return;
+    }
+
+    // The unit switch is only paid when the binding itself changes
+    if (m_textures[unit][slot] == texture)
+    {
+        m_stats.filtered++;
+        return;
+    }
+    if (changes(&m_activeUnit, GL_TEXTURE0 + unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+    changes(&m_textures[unit][slot], texture);
+    glBindTexture(target, texture);
+}
+
+void GLStateCache::setEnabled(GLenum capability, bool enabled)
+{
+    int slot = capabilitySlot(capability);
+    if (slot >= 0 && !changes(&m_enabled[slot], enabled ? 1u : 0u))
+        return;
+    if (slot < 0)
+        m_stats.issued++;
+
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+    mp_applied = nullptr;
+}
+
+void GLStateCache::depthMask(bool write)
+{
+    if (changes(&m_depthWrite, write ? 1u : 0u))
+    {
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+        mp_applied = nullptr;
+    }
+}
+
+void GLStateCache::depthFunc(GLenum func)
+{
+    if (changes(&m_depthFunc, func))
+    {
+        glDepthFunc(func);
+        mp_applied = nullptr;
+    }
+}
+
+void GLStateCache::blendFunc(GLenum source, GLenum destination)
+{
+    if (m_blendSource == source && m_blendDestination == destination)
+    {
+        m_stats.filtered++;
+        return;
+    }
+    m_blendSource = source;
+    m_blendDestination = destination;
+    m_stats.issued++;
+    glBlendFunc(source, destination);
+    mp_applied = nullptr;
+}
+
+void GLStateCache::cullFace(GLenum mode)
+{
+    if (changes(&m_cullMode, mode))
+    {
+        glCullFace(mode);
+        mp_applied = nullptr;
+    }
+}
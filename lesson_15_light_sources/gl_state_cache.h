@@ -0,0 +1,90 @@
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+#include <QOpenGLFunctions_3_3_Core>
+
+struct GLStateStats
+{
+    unsigned int    issued = 0;
+    unsigned int    filtered = 0;
+};
+
+// Fixed-function and binding state of one draw kind. Built once and never
+// changed afterwards, so GLStateCache::apply() can skip a repeated object.
+class PipelineState
+{
+public:
+    struct Description
+    {
+        GLuint      program = 0;
+        GLuint      vertexArray = 0;
+        bool        depthTest = true;
+        bool        depthWrite = true;
+        GLenum      depthFunc = GL_LESS;
+        bool        blend = false;
+        GLenum      blendSource = GL_ONE;
+        GLenum      blendDestination = GL_ZERO;
+        bool        cullFace = false;
+        GLenum      cullMode = GL_BACK;
+    };
+private:
+    const Description                   m_description;
+public:
+    explicit PipelineState(const Description &description) : m_description(description) {}
+
+    const Description& description() const { return m_description; }
+};
+
+// Shadow of the GL binding and enable state. Calls that would not change
+// anything are dropped before they reach the driver. Anything that changes
+// tracked state directly through GL must be followed by invalidate().
+class GLStateCache : protected QOpenGLFunctions_3_3_Core
+{
+private:
+    static const int                    cm_textureUnits = 16;
+    static const int                    cm_textureTargets = 4;  // 2D, 2D array, buffer, cube map
+    static const int                    cm_bufferTargets = 4;   // array, uniform, texture, pixel unpack
+    static const int                    cm_capabilities = 5;    // depth, blend, cull, scissor, stencil
+    static const GLuint                 cm_unknown = ~GLuint(0);
+
+    GLuint                              m_program;
+    GLuint                              m_vertexArray;
+    GLuint                              m_buffers[cm_bufferTargets];
+    GLenum                              m_activeUnit;
+    GLuint                              m_textures[cm_textureUnits][cm_textureTargets];
+    GLuint                              m_enabled[cm_capabilities];     // 0, 1 or cm_unknown
+    GLuint                              m_depthWrite;
+    GLenum                              m_depthFunc;
+    GLenum                              m_blendSource, m_blendDestination;
+    GLenum                              m_cullMode;
+
+    const PipelineState*                mp_applied = nullptr;
+    GLStateStats                        m_stats;
+public:
+    GLStateCache();
+
+    void apply(const PipelineState &state);
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vertexArray);
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindTexture(unsigned int unit, GLenum target, GLuint texture);
+    void setEnabled(GLenum capability, bool enabled);
+    void depthMask(bool write);
+    void depthFunc(GLenum func);
+    void blendFunc(GLenum source, GLenum destination);
+    void cullFace(GLenum mode);
+
+    // Forget everything, the next call of each kind goes to GL
+    void invalidate();
+
+    const GLStateStats& stats() const { return m_stats; }
+    void resetStats() { m_stats = GLStateStats(); }
+private:
+    bool changes(GLuint *p_shadow, GLuint value);
+    static int bufferSlot(GLenum target);
+    static int textureSlot(GLenum target);
+    static int capabilitySlot(GLenum capability);
+};
+
+#endif // GL_STATE_CACHE_H
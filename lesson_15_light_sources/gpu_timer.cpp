@@ -0,0 +1,53 @@
+#include "gpu_timer.h"
+
+GpuTimer::GpuTimer(unsigned int framesInFlight)
+    : m_queries(framesInFlight + 1, 0)
+{
+    initializeOpenGLFunctions();
+    glGenQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+GpuTimer::~GpuTimer()
+{
+    glDeleteQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+void GpuTimer::begin()
+{
+    // The ring is full: the oldest query has to be read before it is reused
+    while (m_pending > 0 && collect(m_pending == m_queries.size()))
+        ;
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_next]);
+}
+
+void GpuTimer::end()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    m_next = (m_next + 1) % m_queries.size();
+    m_pending++;
+}
+
+void GpuTimer::finish()
+{
+    while (m_pending > 0)
+        collect(true);
+}
+
+bool GpuTimer::collect(bool wait)
+{
+    // Oldest outstanding query first, so the results stay in frame order
+    GLuint query = m_queries[(m_next + m_queries.size() - m_pending) % m_queries.size()];
+    if (!wait)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+    }
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    m_frameNs.push_back(qint64(elapsed));
+    m_pending--;
+    return true;
+}
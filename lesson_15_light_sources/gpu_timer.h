@@ -0,0 +1,34 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <QOpenGLFunctions_3_3_Core>
+
+#include <vector>
+
+// GPU time of every frame from GL_TIME_ELAPSED queries (core since 3.3).
+// begin() and end() bracket the commands of a frame; results are read back
+// several frames later, when they are there, so the CPU never waits on them.
+// finish() waits for the frames still outstanding.
+class GpuTimer : protected QOpenGLFunctions_3_3_Core
+{
+private:
+    std::vector<GLuint>                 m_queries;      // ring, one query per frame in flight
+    size_t                              m_next = 0;
+    size_t                              m_pending = 0;  // ended queries not read back yet
+    std::vector<qint64>                 m_frameNs;
+public:
+    explicit GpuTimer(unsigned int framesInFlight);
+    ~GpuTimer();
+
+    void begin();
+    void end();
+    // Blocks until every ended frame has its result
+    void finish();
+
+    // In frame order, for the frames read back so far
+    const std::vector<qint64>& frameNs() const { return m_frameNs; }
+private:
+    bool collect(bool wait);
+};
+
+#endif // GPU_TIMER_H
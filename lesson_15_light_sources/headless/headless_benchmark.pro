@@ -0,0 +1,13 @@
+# Headless benchmark: the lesson's renderer drawing a scripted camera path into
+# an offscreen FBO, no window or display needed. Prints frame times as JSON.
+
+include(../renderer.pri)
+
+TARGET = headless_benchmark
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += \
+    main.cpp
+
+# Like the window application, it reads shaders/ and textures/ from its own directory
@@ -0,0 +1,138 @@
+//  ravesli.com
+//
+//  Lesson #15, headless benchmark
+//
+//  Renders a fixed number of frames along a scripted camera path into an
+//  offscreen FBO and prints CPU and GPU frame time statistics as JSON.
+//  Without a display, e.g. on a CI box with Mesa's llvmpipe:
+//      xvfb-run -a env LIBGL_ALWAYS_SOFTWARE=1 ./headless_benchmark --frames=300
+//
+
+#include "renderwindow.h"
+
+#include <QGuiApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QOpenGLFunctions>
+#include <QTextStream>
+
+#include <algorithm>
+#include <math.h>
+
+namespace
+{
+    const int           cm_defaultFrames = 600;
+    // The path circles the middle of the cube field once over the run
+    const QVector3D     cm_pathCenter = QVector3D(0.0f, 0.0f, -6.0f);
+    const float         cm_pathRadius = 12.0f;
+    const float         cm_pathBob = 3.0f;
+
+    // "--name=value" from the command line, or fallback
+    int intArgument(const QStringList &arguments, const QString &name, int fallback)
+    {
+        const QString prefix = name + QStringLiteral("=");
+        for (const QString &argument: arguments)
+            if (argument.startsWith(prefix))
+            {
+                bool ok = false;
+                int value = argument.mid(prefix.size()).toInt(&ok);
+                return ok ? value : fallback;
+            }
+        return fallback;
+    }
+
+    QString stringArgument(const QStringList &arguments, const QString &name)
+    {
+        const QString prefix = name + QStringLiteral("=");
+        for (const QString &argument: arguments)
+            if (argument.startsWith(prefix))
+                return argument.mid(prefix.size());
+        return QString();
+    }
+
+    CameraPose pathPose(int frame, int frames)
+    {
+        const float angle = 6.2831853f * frame / frames;
+        CameraPose pose;
+        pose.position = cm_pathCenter + QVector3D(cm_pathRadius * sinf(angle), cm_pathBob * sinf(2.0f * angle),
+                                                  cm_pathRadius * cosf(angle));
+        pose.front = (cm_pathCenter - pose.position).normalized();
+        pose.up = QVector3D(0.0f, 1.0f, 0.0f);
+        return pose;
+    }
+
+    // Mean and nearest-rank percentiles, in milliseconds
+    QJsonObject statistics(std::vector<qint64> frameNs)
+    {
+        QJsonObject result;
+        if (frameNs.empty())
+            return result;
+
+        std::sort(frameNs.begin(), frameNs.end());
+        double sum = 0.0;
+        for (qint64 ns: frameNs)
+            sum += double(ns);
+        auto percentile = [&frameNs](double fraction)
+        {
+            size_t rank = size_t(ceil(fraction * frameNs.size()));
+            return frameNs[std::min(std::max<size_t>(rank, 1), frameNs.size()) - 1] / 1e6;
+        };
+
+        result.insert(QStringLiteral("mean"), sum / frameNs.size() / 1e6);
+        result.insert(QStringLiteral("p50"), percentile(0.50));
+        result.insert(QStringLiteral("p95"), percentile(0.95));
+        result.insert(QStringLiteral("p99"), percentile(0.99));
+        return result;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication a(argc, argv);
+    const QStringList arguments = a.arguments();
+
+    const int frames = std::max(intArgument(arguments, QStringLiteral("--frames"), cm_defaultFrames), 1);
+    RenderWindow::OffscreenSettings settings;
+    settings.width = intArgument(arguments, QStringLiteral("--width"), settings.width);
+    settings.height = intArgument(arguments, QStringLiteral("--height"), settings.height);
+    // Same keys as in the window, e.g. --toggles=GP for deferred shading with the light swarm
+    settings.toggles = stringArgument(arguments, QStringLiteral("--toggles"));
+    const int workers = intArgument(arguments, QStringLiteral("--workers"), -1);
+
+    QSurfaceFormat format;
+    format.setDepthBufferSize(24);
+    format.setStencilBufferSize(8);
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setRenderableType(QSurfaceFormat::OpenGL);
+
+    // Never shown; it only carries the pipeline
+    RenderWindow renderer;
+    renderer.setFormat(format);
+    renderer.setJobWorkers(workers);
+    if (!renderer.startOffscreen(settings))
+        return 1;
+
+    QOpenGLFunctions *p_functions = QOpenGLContext::currentContext()->functions();
+    const QString rendererName = QString::fromLatin1(
+        reinterpret_cast<const char*>(p_functions->glGetString(GL_RENDERER)));
+
+    std::vector<qint64> cpuFrameNs;
+    cpuFrameNs.reserve(frames);
+    for (int frame = 0; frame < frames; frame++)
+        cpuFrameNs.push_back(renderer.renderOffscreen(pathPose(frame, frames)));
+    std::vector<qint64> gpuFrameNs = renderer.finishOffscreen();
+
+    QJsonObject report;
+    report.insert(QStringLiteral("renderer"), rendererName);
+    report.insert(QStringLiteral("frames"), frames);
+    report.insert(QStringLiteral("width"), settings.width);
+    report.insert(QStringLiteral("height"), settings.height);
+    report.insert(QStringLiteral("workers"), workers < 0 ? QThread::idealThreadCount() - 1 : workers);
+    report.insert(QStringLiteral("toggles"), settings.toggles);
+    report.insert(QStringLiteral("cpu_ms"), statistics(cpuFrameNs));
+    report.insert(QStringLiteral("gpu_ms"), statistics(gpuFrameNs));
+
+    QTextStream(stdout) << QJsonDocument(report).toJson();
+    return 0;
+}
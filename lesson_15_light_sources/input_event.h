@@ -0,0 +1,24 @@
+#ifndef INPUT_EVENT_H
+#define INPUT_EVENT_H
+
+// What the GUI thread hands to the render thread. Mouse offsets are raw
+// pixels; the render thread scales them with its own frame delta.
+struct InputEvent
+{
+    enum Type
+    {
+        KeyPress,
+        KeyRelease,
+        MouseMove,
+        Wheel,
+        Resize,
+        Expose
+    };
+
+    Type    type = KeyPress;
+    int     key = 0;            // Qt::Key for KeyPress and KeyRelease, exposed flag for Expose
+    float   x = 0.0f;           // mouse offset, wheel delta or width in pixels
+    float   y = 0.0f;           // mouse offset or height in pixels
+};
+
+#endif // INPUT_EVENT_H
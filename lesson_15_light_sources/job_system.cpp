@@ -0,0 +1,201 @@
+#include "job_system.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+namespace
+{
+    // Queue of the current thread: its worker index, or -1 outside the pool
+    thread_local int t_queueIndex = -1;
+    thread_local unsigned int t_victimSeed = 0;
+}
+
+JobSystem::JobSystem(int workersCount)
+    : m_queued(0),
+      m_stopping(false),
+      m_executed(0),
+      m_stolen(0)
+{
+    workersCount = std::max(workersCount, 0);
+    for (int i = 0; i <= workersCount; i++)
+        m_queues.emplace_back(new Queue);
+
+    for (int i = 0; i < workersCount; i++)
+    {
+        QThread *p_worker = QThread::create([this, i]() { workerLoop(i); });
+        p_worker->start();
+        m_workers.push_back(p_worker);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        QMutexLocker locker(&m_sleepMutex);
+        m_stopping.store(true, std::memory_order_release);
+        m_wakeUp.wakeAll();
+    }
+    for (QThread *p_worker: m_workers)
+    {
+        p_worker->wait();
+        delete p_worker;
+    }
+}
+
+JobHandle JobSystem::run(const Work &work, const std::vector<JobHandle> &dependencies)
+{
+    JobHandle job = std::make_shared<Job>(work);
+    for (const JobHandle &dependency: dependencies)
+    {
+        QMutexLocker locker(&dependency->m_mutex);
+        if (dependency->finished())
+            continue;
+        job->m_blockers.fetch_add(1, std::memory_order_relaxed);
+        dependency->m_dependents.push_back(job);
+    }
+    // Drops the submission guard; the job may already be free to run
+    release(job);
+    return job;
+}
+
+JobHandle JobSystem::parallelFor(unsigned int count, unsigned int grain, const RangeWork &work,
+                                 const std::vector<JobHandle> &dependencies)
+{
+    grain = std::max(grain, 1u);
+    std::vector<JobHandle> ranges;
+    ranges.reserve((count + grain - 1) / grain);
+    for (unsigned int first = 0; first < count; first += grain)
+    {
+        unsigned int last = std::min(first + grain, count);
+        ranges.push_back(run([work, first, last]() { work(first, last); }, dependencies));
+    }
+    // Empty join job, finished inline by whichever range ends last
+    return run(Work(), ranges.empty() ? dependencies : ranges);
+}
+
+void JobSystem::wait(const JobHandle &job)
+{
+    while (!job->finished())
+        if (!runOne())
+            QThread::yieldCurrentThread();
+}
+
+void JobSystem::resetStats()
+{
+    m_executed.store(0, std::memory_order_relaxed);
+    m_stolen.store(0, std::memory_order_relaxed);
+}
+
+void JobSystem::workerLoop(int index)
+{
+    t_queueIndex = index;
+    t_victimSeed = unsigned(index) * 2654435761u;
+    while (!m_stopping.load(std::memory_order_acquire))
+    {
+        if (runOne())
+            continue;
+
+        // enqueue() raises m_queued before it takes the lock, so no wake-up is lost
+        QMutexLocker locker(&m_sleepMutex);
+        if (m_queued.load(std::memory_order_acquire) == 0 && !m_stopping.load(std::memory_order_acquire))
+            m_wakeUp.wait(&m_sleepMutex);
+    }
+}
+
+void JobSystem::release(const JobHandle &job)
+{
+    if (job->m_blockers.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    // Joins carry no work and would only cost a round trip through a queue
+    if (!job->m_work)
+        finish(job);
+    else
+        enqueue(job);
+}
+
+void JobSystem::enqueue(const JobHandle &job)
+{
+    int index = t_queueIndex >= 0 ? t_queueIndex : int(m_queues.size()) - 1;
+    {
+        QMutexLocker locker(&m_queues[index]->mutex);
+        m_queues[index]->jobs.push_back(job);
+    }
+    m_queued.fetch_add(1, std::memory_order_release);
+
+    if (!m_workers.empty())
+    {
+        QMutexLocker locker(&m_sleepMutex);
+        m_wakeUp.wakeOne();
+    }
+}
+
+bool JobSystem::runOne()
+{
+    int own = t_queueIndex >= 0 ? t_queueIndex : int(m_queues.size()) - 1;
+    JobHandle job = take(own);
+    if (!job)
+        return false;
+    execute(job);
+    return true;
+}
+
+JobHandle JobSystem::take(int queueIndex)
+{
+    if (m_queued.load(std::memory_order_acquire) == 0)
+        return JobHandle();
+
+    {
+        Queue &own = *m_queues[queueIndex];
+        QMutexLocker locker(&own.mutex);
+        if (!own.jobs.empty())
+        {
+            JobHandle job = own.jobs.back();
+            own.jobs.pop_back();
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+
+    // Steal the oldest job of a victim, starting somewhere else each time so
+    // thieves spread over the queues
+    const unsigned int count = unsigned(m_queues.size());
+    t_victimSeed = t_victimSeed * 1664525u + 1013904223u;
+    unsigned int start = t_victimSeed >> 8;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        unsigned int victim = (start + i) % count;
+        if (int(victim) == queueIndex)
+            continue;
+        Queue &other = *m_queues[victim];
+        QMutexLocker locker(&other.mutex);
+        if (!other.jobs.empty())
+        {
+            JobHandle job = other.jobs.front();
+            other.jobs.pop_front();
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            m_stolen.fetch_add(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    return JobHandle();
+}
+
+void JobSystem::execute(const JobHandle &job)
+{
+    job->m_work();
+    m_executed.fetch_add(1, std::memory_order_relaxed);
+    finish(job);
+}
+
+void JobSystem::finish(const JobHandle &job)
+{
+    std::vector<JobHandle> dependents;
+    {
+        QMutexLocker locker(&job->m_mutex);
+        job->m_finished.store(true, std::memory_order_release);
+        dependents.swap(job->m_dependents);
+    }
+    for (const JobHandle &dependent: dependents)
+        release(dependent);
+}
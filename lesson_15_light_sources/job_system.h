@@ -0,0 +1,92 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class Job;
+typedef std::shared_ptr<Job> JobHandle;
+
+// One unit of work. It is queued once every job it depends on has finished.
+class Job
+{
+    friend class JobSystem;
+private:
+    std::function<void()>               m_work;
+    std::atomic<int>                    m_blockers;     // unfinished dependencies, plus one while submitting
+    std::atomic<bool>                   m_finished;
+    QMutex                              m_mutex;
+    std::vector<JobHandle>              m_dependents;   // guarded by m_mutex until finished
+public:
+    explicit Job(const std::function<void()> &work)
+        : m_work(work),
+          m_blockers(1),
+          m_finished(false)
+    {
+    }
+
+    bool finished() const { return m_finished.load(std::memory_order_acquire); }
+};
+
+// Work-stealing scheduler for the CPU side of a frame. Every worker thread
+// owns a deque: it pushes and pops its own jobs at the back, where they are
+// still warm in its cache, and an idle worker steals from the front of
+// another's. Threads outside the pool share one more deque. wait() runs queued
+// jobs on the calling thread until the awaited one is done, so the render
+// thread helps rather than blocks, and a pool of zero workers still works.
+// Jobs must not touch OpenGL, only the render thread has a context.
+class JobSystem
+{
+public:
+    typedef std::function<void()> Work;
+    // Called with consecutive sub-ranges [first, last) of the whole range
+    typedef std::function<void(unsigned int first, unsigned int last)> RangeWork;
+private:
+    struct Queue
+    {
+        QMutex                          mutex;
+        std::deque<JobHandle>           jobs;
+    };
+
+    std::vector<QThread*>               m_workers;
+    std::vector<std::unique_ptr<Queue>> m_queues;       // one per worker, the last one for other threads
+    std::atomic<int>                    m_queued;
+    std::atomic<bool>                   m_stopping;
+    QMutex                              m_sleepMutex;
+    QWaitCondition                      m_wakeUp;
+
+    std::atomic<unsigned int>           m_executed;
+    std::atomic<unsigned int>           m_stolen;
+public:
+    explicit JobSystem(int workersCount = QThread::idealThreadCount() - 1);
+    ~JobSystem();
+
+    JobHandle run(const Work &work, const std::vector<JobHandle> &dependencies = std::vector<JobHandle>());
+    // Splits [0, count) into ranges of grain items (the last one shorter); the
+    // returned job finishes after all of them
+    JobHandle parallelFor(unsigned int count, unsigned int grain, const RangeWork &work,
+                          const std::vector<JobHandle> &dependencies = std::vector<JobHandle>());
+    void wait(const JobHandle &job);
+
+    int workersCount() const { return static_cast<int>(m_workers.size()); }
+    unsigned int executed() const { return m_executed.load(std::memory_order_relaxed); }
+    unsigned int stolen() const { return m_stolen.load(std::memory_order_relaxed); }
+    void resetStats();
+private:
+    void workerLoop(int index);
+    void release(const JobHandle &job);
+    void enqueue(const JobHandle &job);
+    bool runOne();
+    JobHandle take(int queueIndex);
+    void execute(const JobHandle &job);
+    void finish(const JobHandle &job);
+};
+
+#endif // JOB_SYSTEM_H
@@ -10,6 +10,12 @@ struct KeyboardState
     bool    Q_keyPressed = false;
     bool    E_keyPressed = false;
     bool    Light_key_activated = false;
+    bool    Instancing_key_activated = true;
+    bool    Stats_key_activated = false;
+    bool    Culling_key_activated = true;
+    bool    Swarm_key_activated = false;
+    bool    Deferred_key_activated = false;
+    bool    Churn_key_activated = false;
 };
 
 #endif // KEYBOARD_STATE_H
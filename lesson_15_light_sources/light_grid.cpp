@@ -0,0 +1,132 @@
+#include "light_grid.h"
+
+#include <algorithm>
+#include <cmath>
+
+unsigned int LightGrid::slice(float depth) const
+{
+    float s = std::log(std::max(depth, m_params.nearPlane)) * m_sliceScale + m_sliceBias;
+    return std::min(unsigned(std::max(s, 0.0f)), m_params.slices - 1);
+}
+
+float LightGrid::sliceDepth(unsigned int slice) const
+{
+    return std::exp((float(slice) - m_sliceBias) / m_sliceScale);
+}
+
+bool LightGrid::tileRect(const LightSphere &light, float depthMin, float depthMax, uint32_t *p_rect) const
+{
+    // A slab reaching through the near plane may cover any tile
+    if (depthMin <= m_params.nearPlane)
+    {
+        p_rect[0] = 0;
+        p_rect[1] = m_params.tilesX - 1;
+        p_rect[2] = 0;
+        p_rect[3] = m_params.tilesY - 1;
+        return true;
+    }
+
+    // Screen rectangle of the sphere's bounding box cut down to [depthMin, depthMax]
+    const float *m = m_params.p_projection;
+    float minX = 1.0f, maxX = -1.0f, minY = 1.0f, maxY = -1.0f;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        float x = light.x + ((corner & 1) ? light.radius : -light.radius);
+        float y = light.y + ((corner & 2) ? light.radius : -light.radius);
+        float z = (corner & 4) ? -depthMin : -depthMax;
+        float w = m[3] * x + m[7] * y + m[11] * z + m[15];
+        float ndcX = (m[0] * x + m[4] * y + m[8] * z + m[12]) / w;
+        float ndcY = (m[1] * x + m[5] * y + m[9] * z + m[13]) / w;
+        minX = std::min(minX, ndcX);
+        maxX = std::max(maxX, ndcX);
+        minY = std::min(minY, ndcY);
+        maxY = std::max(maxY, ndcY);
+    }
+    if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+        return false;
+
+    auto tile = [](float ndc, unsigned int tiles)
+    {
+        float t = (std::min(std::max(ndc, -1.0f), 1.0f) * 0.5f + 0.5f) * tiles;
+        return std::min(unsigned(t), tiles - 1);
+    };
+    p_rect[0] = tile(minX, m_params.tilesX);
+    p_rect[1] = tile(maxX, m_params.tilesX);
+    p_rect[2] = tile(minY, m_params.tilesY);
+    p_rect[3] = tile(maxY, m_params.tilesY);
+    return true;
+}
+
+void LightGrid::build(const Params &params, const std::vector<LightSphere> &lights)
+{
+    m_params = params;
+    const float logRatio = std::log(params.farPlane / params.nearPlane);
+    m_sliceScale = params.slices / logRatio;
+    m_sliceBias = -float(params.slices) * std::log(params.nearPlane) / logRatio;
+
+    const uint32_t clusterCount = params.tilesX * params.tilesY * params.slices;
+    m_clusters.assign(size_t(clusterCount) * 2, 0);
+    m_sliceRanges.resize(lights.size() * 3);
+    m_rects.clear();
+
+    // Tile rectangles per covered slice, counted into their clusters
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const LightSphere &light = lights[i];
+        uint32_t *p_range = &m_sliceRanges[i * 3];
+        p_range[0] = 1;     // empty unless a slice below is accepted
+        p_range[1] = 0;
+        p_range[2] = uint32_t(m_rects.size() / 4);
+
+        const float depthMin = std::max(-light.z - light.radius, params.nearPlane);
+        const float depthMax = std::min(-light.z + light.radius, params.farPlane);
+        if (depthMax < depthMin)
+            continue;
+
+        const uint32_t first = slice(depthMin);
+        const uint32_t last = slice(depthMax);
+        for (uint32_t z = first; z <= last; z++)
+        {
+            uint32_t rect[4] = {};
+            float slabMin = std::max(depthMin, z == first ? depthMin : sliceDepth(z));
+            float slabMax = std::min(depthMax, z == last ? depthMax : sliceDepth(z + 1));
+            if (!tileRect(light, slabMin, slabMax, rect))
+            {
+                // Slab is off screen, the slot stays so rects line up with slices
+                rect[0] = 1;
+                rect[1] = 0;
+                rect[2] = 1;
+                rect[3] = 0;
+            }
+
+            m_rects.insert(m_rects.end(), rect, rect + 4);
+            for (uint32_t y = rect[2]; rect[0] <= rect[1] && y <= rect[3]; y++)
+                for (uint32_t x = rect[0]; x <= rect[1]; x++)
+                    m_clusters[2 * (x + params.tilesX * (y + params.tilesY * z)) + 1]++;
+        }
+        p_range[0] = first;
+        p_range[1] = last;
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t cluster = 0; cluster < clusterCount; cluster++)
+    {
+        m_clusters[2 * cluster] = offset;
+        offset += m_clusters[2 * cluster + 1];
+        m_clusters[2 * cluster + 1] = 0;
+    }
+
+    m_indices.resize(offset);
+    for (size_t i = 0; i < lights.size(); i++)
+    {
+        const uint32_t *p_range = &m_sliceRanges[i * 3];
+        const uint32_t *p_rect = &m_rects[size_t(p_range[2]) * 4];
+        for (uint32_t z = p_range[0]; z <= p_range[1]; z++, p_rect += 4)
+            for (uint32_t y = p_rect[2]; p_rect[0] <= p_rect[1] && y <= p_rect[3]; y++)
+                for (uint32_t x = p_rect[0]; x <= p_rect[1]; x++)
+                {
+                    uint32_t *p_cluster = &m_clusters[2 * (x + params.tilesX * (y + params.tilesY * z))];
+                    m_indices[p_cluster[0] + p_cluster[1]++] = uint32_t(i);
+                }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// View-space sphere of influence of one light
+struct LightSphere
+{
+    float   x, y, z;        // view space, the camera looks down -z
+    float   radius;
+};
+
+// Clustered light assignment on the CPU. The view frustum is cut into
+// tilesX x tilesY screen tiles and `slices` depth slices spaced exponentially
+// between the near and far planes; every cluster gets the list of lights whose
+// sphere overlaps it. The result is a flat index list plus (offset, count)
+// per cluster, laid out for texture buffers.
+class LightGrid
+{
+public:
+    struct Params
+    {
+        unsigned int    tilesX = 16;
+        unsigned int    tilesY = 9;
+        unsigned int    slices = 24;
+        float           nearPlane = 0.1f;
+        float           farPlane = 100.0f;
+        const float*    p_projection = nullptr;     // column-major 4x4
+    };
+private:
+    Params                              m_params;
+    float                               m_sliceScale = 0.0f;
+    float                               m_sliceBias = 0.0f;
+
+    std::vector<uint32_t>               m_clusters;     // offset, count per cluster
+    std::vector<uint32_t>               m_indices;
+    std::vector<uint32_t>               m_sliceRanges;  // first slice, last slice, first rect per light
+    std::vector<uint32_t>               m_rects;        // x0, x1, y0, y1 per covered slice
+public:
+    void build(const Params &params, const std::vector<LightSphere> &lights);
+
+    // slice = floor(log(depth) * sliceScale + sliceBias), as the shader computes it
+    float sliceScale() const { return m_sliceScale; }
+    float sliceBias() const { return m_sliceBias; }
+    unsigned int slice(float depth) const;
+
+    size_t clusterCount() const { return m_clusters.size() / 2; }
+    const std::vector<uint32_t>& clusters() const { return m_clusters; }
+    const std::vector<uint32_t>& indices() const { return m_indices; }
+private:
+    float sliceDepth(unsigned int slice) const;
+    bool tileRect(const LightSphere &light, float depthMin, float depthMax, uint32_t *p_rect) const;
+};
+
+#endif // LIGHT_GRID_H
@@ -6,23 +6,61 @@
 //
 
 #include "renderwindow.h"
+#include "benchmark.h"
 #include <QApplication>
 
+namespace
+{
+    // "--name=value" from the command line, or fallback
+    int intArgument(const QStringList &arguments, const QString &name, int fallback)
+    {
+        const QString prefix = name + QStringLiteral("=");
+        for (const QString &argument: arguments)
+            if (argument.startsWith(prefix))
+            {
+                bool ok = false;
+                int value = argument.mid(prefix.size()).toInt(&ok);
+                return ok ? value : fallback;
+            }
+        return fallback;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
+    if (a.arguments().contains(QStringLiteral("--benchmark")))
+    {
+        Benchmark::runAll();
+        return 0;
+    }
+
     RenderWindow *p_rWindow = new RenderWindow;
 
+    // A kiosk that shows a still scene most of the time saves power with
+    // --idle, which renders only on input or animation, and a --fps cap
+    FrameScheduler::Settings schedule;
+    schedule.targetFps = intArgument(a.arguments(), QStringLiteral("--fps"), 0);
+    schedule.idle = a.arguments().contains(QStringLiteral("--idle"));
+    p_rWindow->setFrameSchedule(schedule);
+    // Job system threads besides the render thread, which helps while it waits
+    p_rWindow->setJobWorkers(intArgument(a.arguments(), QStringLiteral("--workers"), -1));
+
     QSurfaceFormat format;
     format.setDepthBufferSize(24);
     format.setStencilBufferSize(8);
     format.setVersion(3, 3);
     format.setProfile(QSurfaceFormat::CoreProfile);
     format.setRenderableType(QSurfaceFormat::OpenGL);
+    // 1 waits for vsync, 0 swaps immediately, 2 halves the refresh rate
+    format.setSwapInterval(intArgument(a.arguments(), QStringLiteral("--swap-interval"), 1));
     p_rWindow->setFormat(format);
 
     p_rWindow->showMaximized();
 
-    return a.exec();
+    // Stops the render thread before the application goes away
+    int result = a.exec();
+    delete p_rWindow;
+    return result;
 }
@@ -0,0 +1,40 @@
+#ifndef NORMAL_MATRIX_H
+#define NORMAL_MATRIX_H
+
+#include <QMatrix4x4>
+
+#include <cmath>
+
+// Rotation times a uniform scale: columns of equal length that are also
+// pairwise orthogonal. Equal lengths alone would let a shear through.
+inline bool hasUniformScale(const QMatrix4x4 &model)
+{
+    const float tolerance = 1e-4f;
+
+    const QVector3D x = model.column(0).toVector3D();
+    const QVector3D y = model.column(1).toVector3D();
+    const QVector3D z = model.column(2).toVector3D();
+    float scaleX = x.lengthSquared();
+    float scaleY = y.lengthSquared();
+    float scaleZ = z.lengthSquared();
+
+    return std::fabs(scaleX - scaleY) <= tolerance * scaleX &&
+           std::fabs(scaleX - scaleZ) <= tolerance * scaleX &&
+           std::fabs(QVector3D::dotProduct(x, y)) <= tolerance * scaleX &&
+           std::fabs(QVector3D::dotProduct(x, z)) <= tolerance * scaleX &&
+           std::fabs(QVector3D::dotProduct(y, z)) <= tolerance * scaleX;
+}
+
+// Normal matrix computed once per object instead of once per vertex.
+// With rotation and uniform scale only the upper 3x3 of the model matrix is
+// already correct up to a factor, which the fragment shader normalizes away,
+// so the inverse is skipped.
+inline QMatrix3x3 normalMatrixFor(const QMatrix4x4 &model)
+{
+    if (hasUniformScale(model))
+        return model.toGenericMatrix<3, 3>();
+
+    return model.normalMatrix();
+}
+
+#endif // NORMAL_MATRIX_H
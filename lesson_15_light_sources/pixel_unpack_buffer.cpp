@@ -0,0 +1,68 @@
+#include "pixel_unpack_buffer.h"
+
+#include <QtDebug>
+
+#include <cstring>
+
+PixelUnpackBuffer::PixelUnpackBuffer()
+{
+    initializeOpenGLFunctions();
+}
+
+PixelUnpackBuffer::~PixelUnpackBuffer()
+{
+    if (m_buffer)
+        glDeleteBuffers(1, &m_buffer);
+}
+
+bool PixelUnpackBuffer::stage(const BakedTexture &image)
+{
+    // The levels are contiguous in the image, so the whole chain goes through the
+    // buffer in a single copy straight from the cache mapping
+    const std::vector<BakedTexture::Level> &levels = image.levels();
+    m_first = levels.front().offset;
+    GLsizeiptr size = GLsizeiptr(levels.back().offset + levels.back().size - m_first);
+
+    if (!m_buffer)
+        glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+
+    // Orphan the previous storage so the driver never waits on an upload still in flight
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void *p_mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!p_mapped)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        qDebug() << "Failed to map pixel buffer!";
+        return false;
+    }
+    std::memcpy(p_mapped, image.data() + m_first, size_t(size));
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // Rows of 1- and 3-channel images are not 4-byte aligned in general
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    return true;
+}
+
+const void* PixelUnpackBuffer::levelOffset(const BakedTexture &image, size_t level) const
+{
+    return reinterpret_cast<const void*>(uintptr_t(image.levels()[level].offset - m_first));
+}
+
+void PixelUnpackBuffer::release()
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+GLenum PixelUnpackBuffer::format(int channels)
+{
+    if (channels == 1)
+        return GL_RED;
+    if (channels == 2)
+        return GL_RG;
+    if (channels == 4)
+        return GL_RGBA;
+    return GL_RGB;
+}
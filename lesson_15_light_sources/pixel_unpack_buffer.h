@@ -0,0 +1,27 @@
+#ifndef PIXEL_UNPACK_BUFFER_H
+#define PIXEL_UNPACK_BUFFER_H
+
+#include <QOpenGLFunctions_3_3_Core>
+
+#include <texture_cache.h>
+
+// Staging buffer for texture uploads. stage() copies the whole mip chain of an
+// image into a freshly orphaned GL_PIXEL_UNPACK_BUFFER and leaves it bound, so
+// the following glTex(Sub)Image calls take levelOffset() instead of a pointer.
+class PixelUnpackBuffer : protected QOpenGLFunctions_3_3_Core
+{
+private:
+    GLuint                              m_buffer = 0;
+    quint64                             m_first = 0;
+public:
+    PixelUnpackBuffer();
+    ~PixelUnpackBuffer();
+
+    bool stage(const BakedTexture &image);
+    const void* levelOffset(const BakedTexture &image, size_t level) const;
+    void release();
+
+    static GLenum format(int channels);
+};
+
+#endif // PIXEL_UNPACK_BUFFER_H
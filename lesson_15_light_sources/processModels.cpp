@@ -1,22 +1,78 @@
 #include "renderwindow.h"
 
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <random>
+#include <math.h>
+
 void RenderWindow::processModels()
 {
-    m_cubePositions.push_back(QVector3D(0.0f,  0.0f,  0.0f));
-    m_cubePositions.push_back(QVector3D(2.0f,  5.0f, -15.0f));
-    m_cubePositions.push_back(QVector3D(-1.5f, -2.2f, -2.5f));
-    m_cubePositions.push_back(QVector3D(-3.8f, -2.0f, -12.3f));
-    m_cubePositions.push_back(QVector3D(2.4f, -0.4f, -3.5f));
-    m_cubePositions.push_back(QVector3D(-1.7f,  3.0f, -7.5f));
-    m_cubePositions.push_back(QVector3D( 1.3f, -2.0f, -2.5f));
-    m_cubePositions.push_back(QVector3D(1.5f,  2.0f, -2.5f));
-    m_cubePositions.push_back(QVector3D(1.5f,  0.2f, -1.5f));
-    m_cubePositions.push_back(QVector3D(-1.3f,  1.0f, -1.5f));
-
-    m_pointLightPositions.push_back(QVector3D(0.7f,  0.2f,  2.0f));
-    m_pointLightPositions.push_back(QVector3D(2.3f, -3.3f, -4.0f));
-    m_pointLightPositions.push_back(QVector3D(-4.0f,  2.0f, -12.0f));
-    m_pointLightPositions.push_back(QVector3D(0.0f,  0.0f, -3.0f));
+    const QVector3D cubePositions[] = {
+        QVector3D(0.0f,  0.0f,  0.0f),
+        QVector3D(2.0f,  5.0f, -15.0f),
+        QVector3D(-1.5f, -2.2f, -2.5f),
+        QVector3D(-3.8f, -2.0f, -12.3f),
+        QVector3D(2.4f, -0.4f, -3.5f),
+        QVector3D(-1.7f,  3.0f, -7.5f),
+        QVector3D( 1.3f, -2.0f, -2.5f),
+        QVector3D(1.5f,  2.0f, -2.5f),
+        QVector3D(1.5f,  0.2f, -1.5f),
+        QVector3D(-1.3f,  1.0f, -1.5f)
+    };
+
+    const QVector3D pointLightPositions[] = {
+        QVector3D(0.7f,  0.2f,  2.0f),
+        QVector3D(2.3f, -3.3f, -4.0f),
+        QVector3D(-4.0f,  2.0f, -12.0f),
+        QVector3D(0.0f,  0.0f, -3.0f)
+    };
+
+    m_scene.clear();
+    // Their handles went stale with the store
+    m_churnCubes.clear();
+    m_churnRandom.seed(11);
+
+    // Texture materials are handed out round-robin
+    unsigned int index = 0;
+    for (const QVector3D &position: cubePositions)
+    {
+        m_scene.addCube(position, QQuaternion::fromAxisAndAngle(QVector3D(1.0f, 0.3f, 0.5f), 20.0f * index),
+                        index % m_textureMaterials.size());
+        index++;
+    }
+
+    // Lamps are unit cubes scaled by cm_lampScale
+    for (const QVector3D &position: pointLightPositions)
+    {
+        PointLight point;
+        point.position = position;
+        point.ambient = QVector3D(0.05f, 0.05f, 0.05f);
+        point.diffuse = QVector3D(0.8f, 0.8f, 0.8f);
+        point.specular = QVector3D(1.0f, 1.0f, 1.0f);
+        m_scene.addLamp(point, 0.5f * cm_lampScale);
+    }
+
+    // Swarm lights: small radius, so each one touches only a few clusters
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    m_swarmLights.clear();
+    for (unsigned int i = 0; i < cm_swarmLightsCount; i++)
+    {
+        PointLight point;
+        point.position = QVector3D(-8.0f + 16.0f * unit(random), -6.0f + 12.0f * unit(random),
+                                   2.0f - 20.0f * unit(random));
+        QVector3D color(unit(random), unit(random), unit(random));
+        point.diffuse = 0.6f * color;
+        point.specular = 0.6f * color;
+        point.constant = 1.0f;
+        point.linear = 0.7f;
+        point.quadratic = 1.8f;
+        point.radius = 1.5f;
+        m_swarmLights.push_back(point);
+    }
+
+    m_cubeInstancesDirty = true;
 
     float vertices[] = {
         -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
@@ -65,8 +121,28 @@ void RenderWindow::processModels()
         glGenVertexArrays(1, &m_cubeVAO);
         glGenBuffers(1, &m_VBO);
 
+        // Storage is allocated here, so the VAOs below can point into it; the
+        // vertices are written on the upload thread and nothing is drawn before
         glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), nullptr, GL_STATIC_DRAW);
+        m_cubeMeshResident = false;
+        const unsigned int vertexBuffer = m_VBO;
+        std::vector<float> vertexData(vertices, vertices + sizeof(vertices) / sizeof(float));
+        mp_uploadThread->submit([vertexBuffer, vertexData](QOpenGLFunctions_3_3_Core *p_functions, PixelUnpackBuffer *)
+        {
+            p_functions->glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            p_functions->glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(vertexData.size() * sizeof(float)),
+                                         vertexData.data());
+            p_functions->glBindBuffer(GL_ARRAY_BUFFER, 0);
+        },
+        [this]()
+        {
+            // Bound again on this context to see the written contents; the
+            // cache may believe it is bound already, so it is bypassed
+            glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+            mp_stateCache->invalidate();
+            m_cubeMeshResident = true;
+        });
 
 
         glBindVertexArray(m_cubeVAO);
@@ -77,6 +153,19 @@ void RenderWindow::processModels()
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
         glEnableVertexAttribArray(2);
 
+        // Per-instance model matrix (locations 3-6), normal matrix (locations 7-9)
+        // and texture array layers (location 10)
+        glGenBuffers(1, &m_cubeInstanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_cubeInstanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+
+        bindCubeInstanceAttributes(0);
+        for (unsigned int location = 3; location <= 10; location++)
+        {
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+
 //----------------------------------------------------------------
         glGenVertexArrays(1, &m_lightVAO);
         glBindVertexArray(m_lightVAO);
@@ -88,3 +177,201 @@ void RenderWindow::processModels()
 
 
 }
+
+void RenderWindow::bindCubeInstanceAttributes(unsigned int firstInstance)
+{
+    // Without glDrawArraysInstancedBaseInstance (GL 4.2) a batch starts where the pointers do
+    const GLsizei instanceStride = cm_cubeInstanceStride * sizeof(float);
+    const size_t base = size_t(firstInstance) * instanceStride;
+
+    mp_stateCache->bindBuffer(GL_ARRAY_BUFFER, m_cubeInstanceVBO);
+    for (unsigned int column = 0; column < 4; column++)
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, instanceStride,
+                              (void*)(base + 4 * column * sizeof(float)));
+    for (unsigned int column = 0; column < 3; column++)
+        glVertexAttribPointer(7 + column, 3, GL_FLOAT, GL_FALSE, instanceStride,
+                              (void*)(base + (16 + 3 * column) * sizeof(float)));
+    glVertexAttribPointer(10, 2, GL_FLOAT, GL_FALSE, instanceStride, (void*)(base + 25 * sizeof(float)));
+}
+
+QMatrix4x4 RenderWindow::cubeModelMatrix(unsigned int index) const
+{
+    // Written by the transform kernel in updateCubeInstances()
+    const float *p_model = m_cubeInstanceData.data() + index * cm_cubeInstanceStride;
+    QMatrix4x4 model;
+    std::copy(p_model, p_model + 16, model.data());
+    return model;
+}
+
+JobHandle RenderWindow::updateCubeInstances()
+{
+    // Rebuilt only when the scene's cubes or the texture arrays change
+    m_materialBatch.resize(m_textureMaterials.size());
+    m_cubeBatches.clear();
+    for (unsigned int i = 0; i < m_textureMaterials.size(); i++)
+    {
+        CubeBatch batch = {mp_textureArrays->array(m_textureMaterials[i].diffuse),
+                           mp_textureArrays->array(m_textureMaterials[i].specular), 0, 0};
+        auto found = std::find_if(m_cubeBatches.begin(), m_cubeBatches.end(), [&batch](const CubeBatch &other)
+        {
+            return other.diffuseArray == batch.diffuseArray && other.specularArray == batch.specularArray;
+        });
+        m_materialBatch[i] = static_cast<unsigned int>(found - m_cubeBatches.begin());
+        if (found == m_cubeBatches.end())
+            m_cubeBatches.push_back(batch);
+    }
+
+    CubeComponents &cubes = m_scene.cubes;
+    const size_t instanceDataSize = m_scene.cubeCount() * cm_cubeInstanceStride;
+    if (m_cubeInstanceData.size() != instanceDataSize)
+    {
+        m_cubeInstanceData.resize(instanceDataSize);
+        cubes.transforms.markAllDirty();
+    }
+    m_cubeInstancesDirty = false;
+    m_cubeInstancesUploaded = false;
+
+    // Model and normal matrices straight into the instance records, for the cubes that moved
+    return mp_jobs->parallelFor(m_scene.cubeCount(), cm_transformGrain, [this](unsigned int first, unsigned int last)
+    {
+        CubeComponents &cubes = m_scene.cubes;
+        Transforms::update(&cubes.transforms, first, last, m_cubeInstanceData.data(), cm_cubeInstanceStride,
+                           m_cubeInstanceData.data() + 16, cm_cubeInstanceStride);
+
+        float *p_instance = m_cubeInstanceData.data() + size_t(first) * cm_cubeInstanceStride;
+        for (unsigned int i = first; i < last; i++)
+        {
+            const TextureMaterial &material = m_textureMaterials[cubes.materials[i]];
+            p_instance[25] = mp_textureArrays->layer(material.diffuse);
+            p_instance[26] = mp_textureArrays->layer(material.specular);
+            p_instance += cm_cubeInstanceStride;
+        }
+    });
+}
+
+void RenderWindow::churnCubes()
+{
+    // Toggled off: the extra cubes go, the ten fixed ones stay
+    if (!m_buttonsState.Churn_key_activated)
+    {
+        if (m_churnCubes.empty())
+            return;
+        for (const EntityHandle &handle: m_churnCubes)
+        {
+            bool removed = m_scene.removeCube(handle);
+            assert(removed);
+            (void)removed;
+        }
+        m_churnCubes.clear();
+        m_cubeInstancesDirty = true;
+        return;
+    }
+
+    // Swap-remove moved other cubes into the freed rows, the handles still find them
+    if (m_churnCubes.size() >= cm_churnCubesCount)
+    {
+        bool removed = m_scene.removeCube(m_churnCubes.front());
+        assert(removed);
+        (void)removed;
+        m_churnCubes.pop_front();
+    }
+
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    QVector3D position(-8.0f + 16.0f * unit(m_churnRandom), -6.0f + 12.0f * unit(m_churnRandom),
+                       2.0f - 20.0f * unit(m_churnRandom));
+    float angle = 360.0f * unit(m_churnRandom);
+    m_churnCubes.push_back(m_scene.addCube(position, QQuaternion::fromAxisAndAngle(QVector3D(1.0f, 0.3f, 0.5f), angle),
+                                           m_churnRandom() % m_textureMaterials.size(),
+                                           QVector3D(0.5f, 0.5f, 0.5f)));
+    m_cubeInstancesDirty = true;
+}
+
+void RenderWindow::packVisibleCubeInstances()
+{
+    // The GPU buffer holds only the visible cubes, refilled when that set changes
+    if (m_cubeInstancesUploaded && m_visibleCubes == m_uploadedCubes)
+        return;
+
+    m_visibleInstanceData.resize(m_visibleCubes.size() * cm_cubeInstanceStride);
+
+    // Counting sort by batch, so every batch is a contiguous instance range
+    for (CubeBatch &batch: m_cubeBatches)
+        batch.count = 0;
+    for (unsigned int index: m_visibleCubes)
+        m_cubeBatches[m_materialBatch[m_scene.cubes.materials[index]]].count++;
+    unsigned int first = 0;
+    for (CubeBatch &batch: m_cubeBatches)
+    {
+        batch.first = first;
+        first += batch.count;
+        batch.count = 0;
+    }
+
+    for (unsigned int index: m_visibleCubes)
+    {
+        CubeBatch &batch = m_cubeBatches[m_materialBatch[m_scene.cubes.materials[index]]];
+        const float *p_source = m_cubeInstanceData.data() + index * cm_cubeInstanceStride;
+        std::copy(p_source, p_source + cm_cubeInstanceStride,
+                  m_visibleInstanceData.data() + (batch.first + batch.count) * cm_cubeInstanceStride);
+        batch.count++;
+    }
+
+    m_uploadedCubes = m_visibleCubes;
+    m_cubeInstancesPacked = true;
+}
+
+void RenderWindow::uploadVisibleCubeInstances()
+{
+    // packVisibleCubeInstances() ran on a job thread, only the context thread may upload
+    if (!m_cubeInstancesPacked)
+        return;
+
+    mp_stateCache->bindBuffer(GL_ARRAY_BUFFER, m_cubeInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, m_visibleInstanceData.size() * sizeof(float),
+                 m_visibleInstanceData.data(), GL_DYNAMIC_DRAW);
+
+    m_cubeInstancesPacked = false;
+    m_cubeInstancesUploaded = true;
+}
+
+JobHandle RenderWindow::cullScene()
+{
+    std::vector<JobHandle> culling;
+    if (m_buttonsState.Culling_key_activated == true)
+    {
+        // Each cube range fills its own list, the join below concatenates them in order
+        Frustum frustum = Culling::extractFrustum(m_frameCamera.viewProjectionMatrix());
+        m_visibleCubeRanges.resize((m_scene.cubeCount() + cm_cullGrain - 1) / cm_cullGrain);
+        culling.push_back(mp_jobs->parallelFor(m_scene.cubeCount(), cm_cullGrain,
+                                               [this, frustum](unsigned int first, unsigned int last)
+        {
+            Culling::cullBoxes(frustum, m_scene.cubes.bounds, first, last,
+                               &m_visibleCubeRanges[first / cm_cullGrain]);
+        }));
+        culling.push_back(mp_jobs->run([this, frustum]()
+        {
+            Culling::cullSpheres(frustum, m_scene.lamps.bounds, &m_visibleLamps);
+        }));
+    }
+
+    const bool enabled = m_buttonsState.Culling_key_activated;
+    return mp_jobs->run([this, enabled]()
+    {
+        if (enabled)
+        {
+            m_visibleCubes.clear();
+            for (const std::vector<unsigned int> &range: m_visibleCubeRanges)
+                m_visibleCubes.insert(m_visibleCubes.end(), range.begin(), range.end());
+        }
+        else
+        {
+            m_visibleCubes.resize(m_scene.cubeCount());
+            std::iota(m_visibleCubes.begin(), m_visibleCubes.end(), 0);
+            m_visibleLamps.resize(m_scene.lampCount());
+            std::iota(m_visibleLamps.begin(), m_visibleLamps.end(), 0);
+        }
+
+        m_statsCulledCubes += m_scene.cubeCount() - m_visibleCubes.size();
+        m_statsCulledLamps += m_scene.lampCount() - m_visibleLamps.size();
+    }, culling);
+}
@@ -0,0 +1,58 @@
+#include "render_queue.h"
+
+#include <algorithm>
+
+quint64 RenderQueue::makeKey(Pass pass, unsigned int pipeline, unsigned int material, float depth)
+{
+    const quint32 maxDepth = (1u << 24) - 1;
+    float clamped = std::min(std::max(depth, 0.0f), 1.0f);
+    quint64 quantised = quint64(clamped * maxDepth);
+    if (pass == TransparentPass)
+        quantised = maxDepth - quantised;
+
+    return (quint64(pass & 0x3) << 62) |
+           (quint64(pipeline & 0x3ff) << 52) |
+           (quint64(material & 0xffff) << 36) |
+           (quantised << 12);
+}
+
+void RenderQueue::sort()
+{
+    const size_t count = m_draws.size();
+    m_sortPasses = 0;
+    if (count < 2)
+        return;
+
+    // All eight histograms in one read over the keys
+    size_t histograms[8][256] = {};
+    for (const Draw &draw: m_draws)
+        for (int byte = 0; byte < 8; byte++)
+            histograms[byte][(draw.key >> (8 * byte)) & 0xff]++;
+
+    m_scratch.resize(count);
+    Draw *p_source = m_draws.data();
+    Draw *p_destination = m_scratch.data();
+    for (int byte = 0; byte < 8; byte++)
+    {
+        size_t *p_counts = histograms[byte];
+        const int shift = 8 * byte;
+        if (p_counts[(p_source[0].key >> shift) & 0xff] == count)
+            continue;
+
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            size_t digitCount = p_counts[digit];
+            p_counts[digit] = offset;
+            offset += digitCount;
+        }
+        for (size_t i = 0; i < count; i++)
+            p_destination[p_counts[(p_source[i].key >> shift) & 0xff]++] = p_source[i];
+
+        std::swap(p_source, p_destination);
+        m_sortPasses++;
+    }
+
+    if (p_source != m_draws.data())
+        m_draws.swap(m_scratch);
+}
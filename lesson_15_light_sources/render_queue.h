@@ -0,0 +1,53 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+// Per-frame list of draws ordered by a 64-bit sort key. From the most
+// significant bit down the key holds:
+//   pass      2 bits   opaque before transparent
+//   pipeline 10 bits   program and fixed-function state
+//   material 16 bits   texture set
+//   depth    24 bits   view depth quantised over [0, far]
+//   (12 low bits are free)
+// so sorting the keys groups draws by state first and then runs each state
+// group front to back (back to front for the transparent pass).
+class RenderQueue
+{
+public:
+    enum Pass
+    {
+        OpaquePass = 0,
+        TransparentPass = 1
+    };
+
+    struct Draw
+    {
+        quint64                         key;
+        quint32                         item;       // meaning is up to the submitter
+    };
+private:
+    std::vector<Draw>                   m_draws;
+    std::vector<Draw>                   m_scratch;
+    unsigned int                        m_sortPasses = 0;
+public:
+    static quint64 makeKey(Pass pass, unsigned int pipeline, unsigned int material, float depth);
+    static unsigned int pipeline(quint64 key) { return unsigned((key >> 52) & 0x3ff); }
+    static unsigned int material(quint64 key) { return unsigned((key >> 36) & 0xffff); }
+
+    void clear() { m_draws.clear(); }
+    void reserve(size_t count) { m_draws.reserve(count); }
+    void push(quint64 key, quint32 item) { m_draws.push_back({key, item}); }
+
+    // LSD radix sort, 8 bits per pass; passes over bytes that are equal in
+    // every key are skipped, so the unused and constant fields cost nothing
+    void sort();
+
+    const std::vector<Draw>& draws() const { return m_draws; }
+    size_t size() const { return m_draws.size(); }
+    unsigned int sortPasses() const { return m_sortPasses; }
+};
+
+#endif // RENDER_QUEUE_H
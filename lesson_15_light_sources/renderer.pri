@@ -0,0 +1,82 @@
+# Renderer sources shared by the window application and the headless benchmark
+
+QT       += core gui concurrent
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += c++11
+
+SOURCES += \
+    $$PWD/benchmark.cpp \
+    $$PWD/camera.cpp \
+    $$PWD/clustered_lighting.cpp \
+    $$PWD/deferred_shading.cpp \
+    $$PWD/frame_fences.cpp \
+    $$PWD/frame_scheduler.cpp \
+    $$PWD/frustum_culling.cpp \
+    $$PWD/gl_state_cache.cpp \
+    $$PWD/gpu_timer.cpp \
+    $$PWD/job_system.cpp \
+    $$PWD/light_grid.cpp \
+    $$PWD/pixel_unpack_buffer.cpp \
+    $$PWD/processModels.cpp \
+    $$PWD/render_queue.cpp \
+    $$PWD/scene_store.cpp \
+    $$PWD/renderwindow.cpp \
+    $$PWD/shader_cache.cpp \
+    $$PWD/shader_reloader.cpp \
+    $$PWD/shader_variants.cpp \
+    $$PWD/stb_image.cpp \
+    $$PWD/texture_array_manager.cpp \
+    $$PWD/texture_cache.cpp \
+    $$PWD/texture_loader.cpp \
+    $$PWD/transform_kernel.cpp \
+    $$PWD/uniform_binding.cpp \
+    $$PWD/uniform_buffer.cpp \
+    $$PWD/upload_thread.cpp
+
+HEADERS += \
+    $$PWD/aligned_allocator.h \
+    $$PWD/benchmark.h \
+    $$PWD/camera.h \
+    $$PWD/clustered_lighting.h \
+    $$PWD/command_buffer.h \
+    $$PWD/deferred_shading.h \
+    $$PWD/direction.h \
+    $$PWD/fixed_timestep.h \
+    $$PWD/frame_fences.h \
+    $$PWD/frame_scheduler.h \
+    $$PWD/frustum_culling.h \
+    $$PWD/gl_state_cache.h \
+    $$PWD/gpu_timer.h \
+    $$PWD/input_event.h \
+    $$PWD/job_system.h \
+    $$PWD/keyboard_state.h \
+    $$PWD/light_grid.h \
+    $$PWD/materials.h \
+    $$PWD/mouse_state.h \
+    $$PWD/normal_matrix.h \
+    $$PWD/pixel_unpack_buffer.h \
+    $$PWD/render_queue.h \
+    $$PWD/scene_store.h \
+    $$PWD/renderwindow.h \
+    $$PWD/shader_cache.h \
+    $$PWD/shader_reloader.h \
+    $$PWD/shader_uniforms.h \
+    $$PWD/shader_variants.h \
+    $$PWD/spsc_queue.h \
+    $$PWD/texture_array_manager.h \
+    $$PWD/texture_cache.h \
+    $$PWD/texture_loader.h \
+    $$PWD/transform_kernel.h \
+    $$PWD/uniform_binding.h \
+    $$PWD/uniform_blocks.h \
+    $$PWD/uniform_buffer.h \
+    $$PWD/upload_thread.h
+
+INCLUDEPATH += \
+    $$PWD \
+    $$PWD/include
+
+# SIMD kernels use SSE2 by default, uncomment to build the AVX paths
+#QMAKE_CXXFLAGS += -mavx
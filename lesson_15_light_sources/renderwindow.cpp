@@ -2,31 +2,92 @@
 
 #include <QApplication>
 #include <QtDebug>
-#include <QFile>
 
+#include <algorithm>
 #include <cassert>
 #include <math.h>
 #define PI 3.14159265f
-#include "stb_image.h"
 
 #include <materials.h>
 
 
 RenderWindow::RenderWindow(/*QOpenGLContext *shareContext*/)
-    : QOpenGLWindow(/*shareContext, QOpenGLWindow::NoPartialUpdate*/),
-      mp_shaderProgLight(nullptr),
-      mp_shaderProgLamp(nullptr)
+    : QWindow(),
+      mp_context(nullptr),
+      mp_uploadSurface(nullptr),
+      mp_renderThread(nullptr),
+      m_stopping(false),
+      mp_frameFences(nullptr),
+      mp_offscreenSurface(nullptr),
+      mp_offscreenTarget(nullptr),
+      mp_gpuTimer(nullptr),
+      mp_jobs(nullptr),
+      mp_lightVariants(nullptr),
+      mp_gBufferVariants(nullptr),
+      mp_lampVariants(nullptr),
+      mp_shaderReloader(nullptr),
+      mp_cameraBlock(nullptr),
+      mp_lightsBlock(nullptr),
+      mp_clusterBlock(nullptr),
+      mp_clusteredLighting(nullptr),
+      mp_deferredShading(nullptr),
+      mp_shaderCache(nullptr),
+      mp_uploadThread(nullptr),
+      mp_textureLoader(nullptr),
+      mp_textureArrays(nullptr),
+      mp_stateCache(nullptr)
 {
+    setSurfaceType(QWindow::OpenGLSurface);
     setKeyboardGrabEnabled(true);
     setMouseGrabEnabled(true);
 
     setCursor(QCursor(Qt::BlankCursor));
 }
 
+void RenderWindow::setFrameSchedule(const FrameScheduler::Settings &settings)
+{
+    m_frameScheduler.configure(settings);
+}
+
+void RenderWindow::setJobWorkers(int workersCount)
+{
+    m_jobWorkers = workersCount;
+}
+
 RenderWindow::~RenderWindow()
 {
-    delete mp_shaderProgLight;
-    delete mp_shaderProgLamp;
+    // The render thread releases the GL objects itself before it ends, see cleanupGL()
+    if (mp_renderThread != nullptr)
+    {
+        m_stopping.store(true, std::memory_order_release);
+        mp_renderThread->wait();
+        delete mp_renderThread;
+    }
+    delete mp_context;
+    delete mp_uploadSurface;
+    delete mp_offscreenSurface;
+}
+
+void RenderWindow::cleanupGL()
+{
+    // paintGL() waits for every job it started, the workers are idle here
+    delete mp_jobs;
+    delete mp_shaderReloader;
+    delete mp_lightVariants;
+    delete mp_gBufferVariants;
+    delete mp_lampVariants;
+    delete mp_cameraBlock;
+    delete mp_lightsBlock;
+    delete mp_clusterBlock;
+    delete mp_clusteredLighting;
+    delete mp_deferredShading;
+    delete mp_shaderCache;
+    // Stopped first, so no upload job outlives the textures it writes
+    delete mp_uploadThread;
+    delete mp_textureLoader;
+    delete mp_textureArrays;
+    delete mp_stateCache;
+    delete mp_frameFences;
 
     for(auto p_shader: mp_shadersList)
     {
@@ -37,28 +98,33 @@ RenderWindow::~RenderWindow()
     glDeleteVertexArrays(1, &m_lightVAO);
     glDeleteBuffers(1, &m_VBO);
     glDeleteBuffers(1, &m_EBO);
+    glDeleteBuffers(1, &m_cubeInstanceVBO);
 }
 
-QOpenGLShaderProgram *RenderWindow::loadShaders(const QString& vertexShaderFileName, const QString& fragmentShaderFileName)
+QOpenGLShaderProgram *RenderWindow::loadShaders(const QString& vertexShaderFileName, const QString& fragmentShaderFileName,
+                                                const QByteArray &defines)
 {
-    QOpenGLShader * p_vertexShader = new QOpenGLShader(QOpenGLShader::Vertex);
-    mp_shadersList.push_back(p_vertexShader);
-    QOpenGLShader * p_fragmentShader = new QOpenGLShader(QOpenGLShader::Fragment);
-    mp_shadersList.push_back(p_fragmentShader);
     QOpenGLShaderProgram * p_shaderProg = new QOpenGLShaderProgram;
 
+    // Includes expanded and defines injected, so the cache key covers the whole text
+    QByteArray vertexSource;
+    bool vertexOpened = ShaderSource::load(vertexShaderFileName, defines, &vertexSource);
+    assert(vertexOpened && "Vertex shader file opening failed!");
 
-    QFile vertex(vertexShaderFileName);
-    assert(vertex.open(QIODevice::ReadOnly) && "Vertex shader file opening failed!");
-    QByteArray vertexSource = vertex.readAll();
-
-    QFile fragment(fragmentShaderFileName);
-    assert(fragment.open(QIODevice::ReadOnly) && "Fragment shader file opening failed!");
-    QByteArray fragmentSource = fragment.readAll();
+    QByteArray fragmentSource;
+    bool fragmentOpened = ShaderSource::load(fragmentShaderFileName, defines, &fragmentSource);
+    assert(fragmentOpened && "Fragment shader file opening failed!");
 
-    vertex.close();
-    fragment.close();
+    // Warm start: restore the linked binary, no compilation at all
+    QByteArray cacheKey = mp_shaderCache->key(vertexSource, fragmentSource, defines);
+    if (mp_shaderCache->load(p_shaderProg, cacheKey))
+        return p_shaderProg;
 
+    // Cold start or rejected binary: full compile and link, then store the result
+    QOpenGLShader * p_vertexShader = new QOpenGLShader(QOpenGLShader::Vertex);
+    mp_shadersList.push_back(p_vertexShader);
+    QOpenGLShader * p_fragmentShader = new QOpenGLShader(QOpenGLShader::Fragment);
+    mp_shadersList.push_back(p_fragmentShader);
 
     if (!p_vertexShader->compileSourceCode(vertexSource))
         {
@@ -71,9 +137,11 @@ QOpenGLShaderProgram *RenderWindow::loadShaders(const QString& vertexShaderFileN
     p_shaderProg->addShader(p_vertexShader);
     p_shaderProg->addShader(p_fragmentShader);
 
-    assert(p_shaderProg->link() && "ShaderProgram: Linking Failed!");
+    mp_shaderCache->prepareLink(p_shaderProg);
+    bool linked = p_shaderProg->link();
+    assert(linked && "ShaderProgram: Linking Failed!");
 
-    //qDebug() << p_shaderProg->isLinked();
+    mp_shaderCache->store(p_shaderProg, cacheKey);
 
     return p_shaderProg;
 
@@ -81,29 +149,261 @@ QOpenGLShaderProgram *RenderWindow::loadShaders(const QString& vertexShaderFileN
 
 void RenderWindow::loadTexture(unsigned int *p_texture, const QString &texture_FileName)
 {
-    glGenTextures(1, p_texture);
+    // Decoding runs on the thread pool; the texture shows a placeholder until poll() uploads it
+    *p_texture = mp_textureLoader->request(texture_FileName);
+}
+
+void RenderWindow::addTextureMaterial(const QString &diffuse_FileName, const QString &specular_FileName)
+{
+    TextureMaterial material;
+    material.diffuse = mp_textureArrays->request(diffuse_FileName);
+    material.specular = mp_textureArrays->request(specular_FileName);
+    m_textureMaterials.push_back(material);
+}
+
+void RenderWindow::resolveLightCasterUniforms(QOpenGLShaderProgram *p_program, UniformBinding *p_uniforms)
+{
+    // Same names in the same order for every variant and for the G-buffer programs,
+    // which leave the light handles inactive; the handles are therefore shared
+    m_lightCasterUniforms.model = p_uniforms->resolve("model");
+    m_lightCasterUniforms.normalMatrix = p_uniforms->resolve("normalMatrix");
+    m_lightCasterUniforms.layers = p_uniforms->resolve("layers");
+    m_lightCasterUniforms.materialDiffuse = p_uniforms->resolve("material.diffuse");
+    m_lightCasterUniforms.materialSpecular = p_uniforms->resolve("material.specular");
+    m_lightCasterUniforms.materialShininess = p_uniforms->resolve("material.shininess");
+    m_lightCasterUniforms.pointLightData = p_uniforms->resolve("pointLightData");
+    m_lightCasterUniforms.clusterData = p_uniforms->resolve("clusterData");
+    m_lightCasterUniforms.clusterLightIndices = p_uniforms->resolve("clusterLightIndices");
+
+    mp_cameraBlock->attach(p_program, "Camera");
+}
+
+void RenderWindow::resolveUniforms()
+{
+    // Camera and lights are shared by every program through fixed binding points;
+    // the programs attach themselves as their variants are compiled
+    mp_cameraBlock = new UniformBuffer(mp_stateCache, CameraBlockBinding, sizeof(CameraBlock));
+    mp_lightsBlock = new UniformBuffer(mp_stateCache, LightsBlockBinding, sizeof(LightsBlock));
+    mp_clusterBlock = new UniformBuffer(mp_stateCache, ClusterBlockBinding, sizeof(ClusterBlock));
+
+    m_cameraBlockData = CameraBlock();
+    m_lightsBlockData = LightsBlock();
+    m_clusterBlockData = ClusterBlock();
+}
+
+void RenderWindow::createPipelines()
+{
+    auto load = [this](const QString &vertexFileName, const QString &fragmentFileName, const QByteArray &defines)
+    {
+        return loadShaders(vertexFileName, fragmentFileName, defines);
+    };
+
+    // Forward and G-buffer cube programs, one per feature combination; the program
+    // of each variant replaces the placeholder in this description
+    PipelineState::Description cube;
+    cube.vertexArray = m_cubeVAO;
+    mp_lightVariants = new ShaderVariants(m_shaderDirectory + QString("light_casters.vs"),
+                                          m_shaderDirectory + QString("light_casters.fs"),
+                                          InstancedFeature | SpotLightFeature, cube, load,
+                                          [this](QOpenGLShaderProgram *p_program, UniformBinding *p_uniforms)
+    {
+        resolveLightCasterUniforms(p_program, p_uniforms);
+        mp_lightsBlock->attach(p_program, "Lights");
+        mp_clusterBlock->attach(p_program, "Clusters");
+    });
+    mp_gBufferVariants = new ShaderVariants(m_shaderDirectory + QString("light_casters.vs"),
+                                            m_shaderDirectory + QString("gbuffer.fs"),
+                                            InstancedFeature, cube, load,
+                                            [this](QOpenGLShaderProgram *p_program, UniformBinding *p_uniforms)
+    {
+        resolveLightCasterUniforms(p_program, p_uniforms);
+    });
+    mp_lightVariants->compileAll();
+    mp_gBufferVariants->compileAll();
+
+    PipelineState::Description lamp;
+    lamp.vertexArray = m_lightVAO;
+    mp_lampVariants = new ShaderVariants(m_shaderDirectory + QString("lamp.vs"),
+                                         m_shaderDirectory + QString("lamp.fs"), 0, lamp, load,
+                                         [this](QOpenGLShaderProgram *p_program, UniformBinding *p_uniforms)
+    {
+        m_lampUniforms.model = p_uniforms->resolve("model");
+        mp_cameraBlock->attach(p_program, "Camera");
+    });
+    mp_lampVariants->compileAll();
+
+    mp_deferredShading = new DeferredShading(mp_stateCache, m_shaderDirectory, load,
+                                             mp_cameraBlock, mp_lightsBlock);
+    mp_deferredShading->resize(m_viewportWidth, m_viewportHeight);
+
+    // Edited shaders are rebuilt while the old programs keep drawing
+    mp_shaderReloader = new ShaderReloader(mp_shaderCache);
+    for (ShaderVariants *p_variants: {mp_lightVariants, mp_gBufferVariants, mp_lampVariants})
+        mp_shaderReloader->watch(p_variants);
+    for (ShaderVariants *p_variants: mp_deferredShading->shaderVariants())
+        mp_shaderReloader->watch(p_variants);
+
+    // Set-up code above bound VAOs and buffers directly
+    mp_stateCache->invalidate();
+}
+
+void RenderWindow::updateUniformBlocks()
+{
+    CameraBlock &camera = m_cameraBlockData;
+    std140Copy(camera.view, m_frameCamera.viewMatrix());
+    std140Copy(camera.projection, m_frameCamera.projectionMatrix());
+    std140Copy(camera.viewPos, m_renderCamera.position);
+    mp_cameraBlock->update(&camera);
 
-    glBindTexture(GL_TEXTURE_2D, *p_texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    LightsBlock &lights = m_lightsBlockData;
 
-    glBindTexture(GL_TEXTURE_2D, *p_texture);
-    int width, height, nrChannels;
-    unsigned char *p_data = stbi_load(texture_FileName.toStdString().data(), &width, &height, &nrChannels, 0);
+    // Direct light
+    std140Copy(lights.dirLight.direction, QVector3D(-0.2f, -1.0f, -0.3f));
+    std140Copy(lights.dirLight.ambient, QVector3D(0.05f, 0.05f, 0.05f));
+    std140Copy(lights.dirLight.diffuse, QVector3D(0.4f, 0.4f, 0.4f));
+    std140Copy(lights.dirLight.specular, QVector3D(0.5f, 0.5f, 0.5f));
+
+    // Torch
+    SpotLightBlock &spot = lights.spotLight;
+    std140Copy(spot.position, m_renderCamera.position);
+    std140Copy(spot.direction, m_renderCamera.front);
+    spot.cutOff = cosf(12.5f * PI/180.0f);
+    spot.outerCutOff = cosf(17.5f * PI/180.0f);
+    spot.activated = m_buttonsState.Light_key_activated;
+    std140Copy(spot.ambient, QVector3D(0.05f, 0.05f, 0.05f));
+    std140Copy(spot.diffuse, QVector3D(0.8f, 0.8f, 0.8f));
+    std140Copy(spot.specular, QVector3D(1.0f, 1.0f, 1.0f));
+    spot.constant = 1.0f;
+    spot.linear = 0.09f;
+    spot.quadratic = 0.032f;
+
+    // Nothing is uploaded unless the block contents changed
+    mp_lightsBlock->update(&lights);
+
+    mp_clusteredLighting->fillBlock(&m_clusterBlockData, m_viewportWidth, m_viewportHeight);
+    mp_clusterBlock->update(&m_clusterBlockData);
+}
 
-    if (p_data)
+JobHandle RenderWindow::updateLights()
+{
+    m_pointLights.clear();
+    m_scene.gatherLights(&m_pointLights);
+
+    // The swarm drifts around its seed positions
+    std::vector<JobHandle> swarm;
+    if (m_buttonsState.Swarm_key_activated == true)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, p_data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        const size_t base = m_pointLights.size();
+        const float time = m_renderTime;
+        m_pointLights.resize(base + m_swarmLights.size());
+        swarm.push_back(mp_jobs->parallelFor(unsigned(m_swarmLights.size()), cm_swarmGrain,
+                                             [this, base, time](unsigned int first, unsigned int last)
+        {
+            for (unsigned int i = first; i < last; i++)
+            {
+                PointLight point = m_swarmLights[i];
+                float phase = 0.37f * i;
+                point.position += 0.5f * QVector3D(sinf(1.3f * time + phase), cosf(0.7f * time + 2.0f * phase),
+                                                   sinf(time + 3.0f * phase));
+                m_pointLights[base + i] = point;
+            }
+        }));
     }
-    else
+
+    // The deferred path bounds each light on screen itself and needs no clusters
+    const bool deferred = m_buttonsState.Deferred_key_activated;
+    return mp_jobs->run([this, deferred]()
+    {
+        if (deferred)
+            mp_clusteredLighting->packLights(m_pointLights);
+        else
+            mp_clusteredLighting->assign(m_pointLights, m_frameCamera.viewMatrix(),
+                                         m_frameCamera.projectionMatrix(), cm_nearPlane, cm_farPlane);
+    }, swarm);
+}
+
+void RenderWindow::reportFrameStats()
+{
+    m_statsFrames++;
+    if (!m_statsTimer.hasExpired(cm_statsInterval))
+        return;
+
+    if (m_buttonsState.Stats_key_activated == true)
     {
-        qDebug() << "Failed to load texture!";
+        UniformStats uniforms;
+        for (const UniformStats &stats: {mp_lampVariants->uniformStats(), mp_lightVariants->uniformStats(),
+                                         mp_gBufferVariants->uniformStats(), mp_deferredShading->uniformStats()})
+        {
+            uniforms.lookups += stats.lookups;
+            uniforms.uploads += stats.uploads;
+            uniforms.skipped += stats.skipped;
+        }
+
+        unsigned int blockUploads = mp_cameraBlock->uploads() + mp_lightsBlock->uploads() +
+                                    mp_clusterBlock->uploads();
+        const GLStateStats &state = mp_stateCache->stats();
+
+        float frames = static_cast<float>(m_statsFrames);
+        qDebug().nospace() << "frame " << m_statsTimer.elapsed() / frames << " ms"
+                           << (m_buttonsState.Instancing_key_activated ? " (instanced" : " (per-draw")
+                           << (m_buttonsState.Deferred_key_activated ? ", deferred)" : ", forward)")
+                           << " | uniform lookups " << uniforms.lookups / frames
+                           << ", uploads " << uniforms.uploads / frames
+                           << ", skipped " << uniforms.skipped / frames
+                           << ", block uploads " << blockUploads / frames << " per frame";
+        qDebug().nospace() << "state calls per frame: issued " << state.issued / frames
+                           << ", filtered " << state.filtered / frames
+                           << " | queue " << m_renderQueue.size() << " draws, "
+                           << m_renderQueue.sortPasses() << " radix passes";
+        if (m_buttonsState.Deferred_key_activated == true)
+            qDebug().nospace() << "point lights " << m_pointLights.size() << ", " << mp_deferredShading->shadedLights()
+                               << " on screen, " << mp_deferredShading->rectPixels() / (m_viewportWidth * m_viewportHeight)
+                               << " light rectangles per pixel";
+        else
+            qDebug().nospace() << "point lights " << mp_clusteredLighting->lights()
+                               << ", " << double(mp_clusteredLighting->lightIndices()) / mp_clusteredLighting->clusters()
+                               << " per cluster on average";
+        qDebug().nospace() << "culled per frame: cubes " << m_statsCulledCubes / frames
+                           << " of " << m_scene.cubeCount()
+                           << ", lamps " << m_statsCulledLamps / frames
+                           << " of " << m_scene.lampCount()
+                           << (m_buttonsState.Culling_key_activated ? "" : " (culling off)");
+        qDebug().nospace() << cm_framesInFlight << " frames in flight, waited for the GPU "
+                           << mp_frameFences->waitNs() / 1e6 / frames << " ms per frame";
+        qDebug().nospace() << "jobs per frame " << mp_jobs->executed() / frames
+                           << ", stolen " << mp_jobs->stolen() / frames
+                           << " | " << mp_jobs->workersCount() << " workers and the render thread"
+                           << " | recorded " << m_statsPackets / frames << " packets, "
+                           << m_statsPacketBytes / 1024.0 / frames << " KB in "
+                           << m_commandBuffers.size() << " buffers";
+        const FrameHistogram &intervals = m_frameScheduler.histogram();
+        qDebug().nospace() << "frame interval over the last " << intervals.size() << " frames: mean "
+                           << intervals.meanMs() << " ms, p50 " << intervals.percentileMs(0.5)
+                           << ", p95 " << intervals.percentileMs(0.95) << ", p99 " << intervals.percentileMs(0.99)
+                           << " | idle waits " << m_frameScheduler.idleWaits();
+        if (mp_uploadThread->finished() > 0)
+            qDebug().nospace() << "uploads finished " << mp_uploadThread->finished() << ", "
+                               << mp_uploadThread->busyNs() / 1e6 << " ms spent "
+                               << (mp_uploadThread->threaded() ? "on the upload thread" : "inline");
     }
-    stbi_image_free(p_data);
-    p_data = nullptr;
+
+    mp_lightVariants->resetStats();
+    mp_gBufferVariants->resetStats();
+    mp_lampVariants->resetStats();
+    mp_deferredShading->resetStats();
+    mp_cameraBlock->resetStats();
+    mp_lightsBlock->resetStats();
+    mp_clusterBlock->resetStats();
+    mp_stateCache->resetStats();
+    mp_frameFences->resetStats();
+    mp_jobs->resetStats();
+    m_frameScheduler.resetStats();
+    m_statsFrames = 0;
+    m_statsCulledCubes = 0;
+    m_statsCulledLamps = 0;
+    m_statsPackets = 0;
+    m_statsPacketBytes = 0;
+    m_statsTimer.restart();
 }
 
 void RenderWindow::initializeGL()
@@ -113,111 +413,566 @@ void RenderWindow::initializeGL()
 
     initializeOpenGLFunctions();
 
+    QElapsedTimer initTimer;
+    initTimer.start();
+    mp_shaderCache = new ShaderCache;
+    mp_uploadThread = new UploadThread(mp_context, mp_uploadSurface);
+    mp_textureLoader = new TextureLoader(mp_uploadThread);
+    mp_textureArrays = new TextureArrayManager(mp_uploadThread);
+    mp_stateCache = new GLStateCache;
+    mp_frameFences = new FrameFences(cm_framesInFlight);
+    mp_clusteredLighting = new ClusteredLighting(mp_stateCache);
+    mp_jobs = m_jobWorkers < 0 ? new JobSystem : new JobSystem(m_jobWorkers);
+
     m_frameTimer.start();
 #ifdef Q_OS_WINDOWS
-    mp_shaderProgLight = loadShaders(QString(QApplication::applicationDirPath() + QString("\\shaders\\light_casters.vs")),
-                QString(QApplication::applicationDirPath() + QString("\\shaders\\light_casters.fs")));
-    mp_shaderProgLamp = loadShaders(QString(QApplication::applicationDirPath() + QString("\\shaders\\lamp.vs")),
-                QString(QApplication::applicationDirPath() + QString("\\shaders\\lamp.fs")));
-
-    loadTexture(&m_diffuseMap ,QString(QApplication::applicationDirPath() + QString("\\textures\\box_metal.jpg")));
-    loadTexture(&m_specularMap ,QString(QApplication::applicationDirPath() + QString("\\textures\\box_edging.jpg")));
+    // Textures first, so decoding overlaps with shader compilation
+    addTextureMaterial(QString(QApplication::applicationDirPath() + QString("\\textures\\box_metal.jpg")),
+                       QString(QApplication::applicationDirPath() + QString("\\textures\\box_edging.jpg")));
+    addTextureMaterial(QString(QApplication::applicationDirPath() + QString("\\textures\\box_edging.jpg")),
+                       QString(QApplication::applicationDirPath() + QString("\\textures\\box_metal.jpg")));
+    addTextureMaterial(QString(QApplication::applicationDirPath() + QString("\\textures\\container.jpg")),
+                       QString(QApplication::applicationDirPath() + QString("\\textures\\box_edging.jpg")));
     loadTexture(&m_emissionMap ,QString(QApplication::applicationDirPath() + QString("\\textures\\matrix.jpg")));
+
+    // Programs are compiled per variant in createPipelines()
+    m_shaderDirectory = QString(QApplication::applicationDirPath() + QString("\\shaders\\"));
 #endif
 
 #ifdef Q_OS_UNIX
-    mp_shaderProgLight = loadShaders(QString(QApplication::applicationDirPath() + QString("/shaders/light_casters.vs")),
-                QString(QApplication::applicationDirPath() + QString("/shaders/light_casters.fs")));
-    mp_shaderProgLamp = loadShaders(QString(QApplication::applicationDirPath() + QString("/shaders/lamp.vs")),
-                QString(QApplication::applicationDirPath() + QString("/shaders/lamp.fs")));
-
-    loadTexture(&m_diffuseMap ,QString(QApplication::applicationDirPath() + QString("/textures/box_metal.jpg")));
-    loadTexture(&m_specularMap ,QString(QApplication::applicationDirPath() + QString("/textures/box_edging.jpg")));
+    // Textures first, so decoding overlaps with shader compilation
+    addTextureMaterial(QString(QApplication::applicationDirPath() + QString("/textures/box_metal.jpg")),
+                       QString(QApplication::applicationDirPath() + QString("/textures/box_edging.jpg")));
+    addTextureMaterial(QString(QApplication::applicationDirPath() + QString("/textures/box_edging.jpg")),
+                       QString(QApplication::applicationDirPath() + QString("/textures/box_metal.jpg")));
+    addTextureMaterial(QString(QApplication::applicationDirPath() + QString("/textures/container.jpg")),
+                       QString(QApplication::applicationDirPath() + QString("/textures/box_edging.jpg")));
+
+    // Programs are compiled per variant in createPipelines()
+    m_shaderDirectory = QString(QApplication::applicationDirPath() + QString("/shaders/"));
 #endif
 
+    resolveUniforms();
+
     glClearColor(cm_clearColor.x(),
                  cm_clearColor.y(),
                  cm_clearColor.z(),
                  cm_clearColor.w());
 
-    glEnable(GL_DEPTH_TEST);
-
-    m_camera.setProjectionType(QCameraLens::PerspectiveProjection);
-    m_camera.setPosition(QVector3D(0.0f, 0.0f, 3.0f));
-    m_camera.setViewCenter(QVector3D(0.0f, 0.0f, -1.0f));
-    m_camera.setUpVector(QVector3D(0.0f, 1.0f, 0.0f));
+    m_camera.lookAlong(QVector3D(0.0f, 0.0f, 3.0f), QVector3D(0.0f, 0.0f, -1.0f), QVector3D(0.0f, 1.0f, 0.0f));
+    m_previousCamera = cameraPose();
+    m_renderCamera = m_previousCamera;
 
     processModels();
+    createPipelines();
+
+    // A start where every program came from the cache is a warm start
+    const char *start = !mp_shaderCache->supported() ? "uncached" :
+                        mp_shaderCache->hits() > 0 && mp_shaderCache->misses() == 0 ? "warm" : "cold";
+    qDebug().nospace() << "initializeGL: " << initTimer.nsecsElapsed() / 1e6 << " ms, "
+                       << start << " start (program cache: "
+                       << (mp_shaderCache->supported() ? "" : "disabled, ")
+                       << mp_shaderCache->hits() << " hits, " << mp_shaderCache->misses() << " misses)";
+
+    m_statsTimer.start();
+}
+
+float RenderWindow::viewDepth(const QVector3D &position) const
+{
+    // -z in view space, normalised over the projection depth range
+    const QMatrix4x4 &view = m_frameCamera.viewMatrix();
+    float z = view(2, 0) * position.x() + view(2, 1) * position.y() +
+              view(2, 2) * position.z() + view(2, 3);
+    return -z / cm_farPlane;
+}
+
+void RenderWindow::submitDraws()
+{
+    m_renderQueue.clear();
+    // Cubes and lamps share the vertex buffer, which is still on its way
+    if (!m_cubeMeshResident)
+        return;
+
+    // Same cube draws either way, only the program behind them differs
+    const unsigned int cubePipeline = m_buttonsState.Deferred_key_activated ? GBufferPipeline : CubePipeline;
+
+    if (m_buttonsState.Instancing_key_activated == true)
+    {
+        // One draw per texture set; the nearest instance stands for the batch
+        packVisibleCubeInstances();
+
+        m_batchDepths.assign(m_cubeBatches.size(), 1.0f);
+        for (unsigned int i: m_visibleCubes)
+        {
+            float &depth = m_batchDepths[m_materialBatch[m_scene.cubes.materials[i]]];
+            depth = std::min(depth, viewDepth(m_scene.cubePosition(i)));
+        }
+        for (unsigned int batch = 0; batch < m_cubeBatches.size(); batch++)
+            if (m_cubeBatches[batch].count > 0)
+                m_renderQueue.push(RenderQueue::makeKey(RenderQueue::OpaquePass, cubePipeline, batch,
+                                                        m_batchDepths[batch]), batch);
+    }
+    else
+    {
+        for (unsigned int i: m_visibleCubes)
+            m_renderQueue.push(RenderQueue::makeKey(RenderQueue::OpaquePass, cubePipeline,
+                                                    m_materialBatch[m_scene.cubes.materials[i]],
+                                                    viewDepth(m_scene.cubePosition(i))), i);
+    }
+
+    for (unsigned int i: m_visibleLamps)
+        m_renderQueue.push(RenderQueue::makeKey(RenderQueue::OpaquePass, LampPipeline, 0,
+                                                viewDepth(m_scene.lampPosition(i))), i);
+}
+
+JobHandle RenderWindow::recordDraws(const JobHandle &sorted)
+{
+    // One cube range per thread; the bounds are read once the queue is sorted
+    const unsigned int ranges = static_cast<unsigned int>(mp_jobs->workersCount()) + 1;
+    m_commandBuffers.resize(ranges + 1);
+    JobHandle cubes = mp_jobs->parallelFor(ranges, 1, [this, ranges](unsigned int range, unsigned int)
+    {
+        recordDraws(m_lampDraws * range / ranges, m_lampDraws * (range + 1) / ranges, &m_commandBuffers[range]);
+    }, {sorted});
+    JobHandle lamps = mp_jobs->run([this]()
+    {
+        recordDraws(m_lampDraws, m_renderQueue.size(), &m_commandBuffers.back());
+    }, {sorted});
+    return mp_jobs->run(JobSystem::Work(), {cubes, lamps});
+}
+
+void RenderWindow::recordDraws(size_t first, size_t last, CommandBuffer *p_commands) const
+{
+    using namespace DrawCommands;
+
+    // Every cube program variant shares the uniform handles; the features pick the variant
+    const bool instanced = m_buttonsState.Instancing_key_activated;
+    const unsigned int features = (instanced ? InstancedFeature : 0) |
+                                  (m_buttonsState.Light_key_activated ? SpotLightFeature : 0);
+
+    // Each buffer starts from unknown state; the state cache filters the repeated binds
+    p_commands->clear();
+    unsigned int currentPipeline = ~0u;
+    unsigned int currentMaterial = ~0u;
+    for (size_t index = first; index < last; index++)
+    {
+        const RenderQueue::Draw &draw = m_renderQueue.draws()[index];
+        unsigned int pipeline = RenderQueue::pipeline(draw.key);
+        if (pipeline != currentPipeline)
+        {
+            currentPipeline = pipeline;
+            currentMaterial = ~0u;
+            p_commands->record(BindPipeline{pipeline, pipeline == LampPipeline ? 0 : features});
+        }
+
+        if (pipeline == LampPipeline)
+        {
+            QMatrix4x4 model;
+            model.translate(m_scene.lampPosition(draw.item));
+            model.scale(cm_lampScale);
+            SetLamp lamp;
+            std::copy(model.constData(), model.constData() + 16, lamp.model);
+            p_commands->record(lamp);
+            p_commands->record(Draw{36});
+            continue;
+        }
+
+        unsigned int material = RenderQueue::material(draw.key);
+        if (material != currentMaterial)
+        {
+            currentMaterial = material;
+            p_commands->record(BindMaterial{m_cubeBatches[material].diffuseArray,
+                                            m_cubeBatches[material].specularArray});
+        }
+
+        if (instanced)
+        {
+            // The layers come with each instance
+            const CubeBatch &batch = m_cubeBatches[draw.item];
+            p_commands->record(SetInstances{batch.first, batch.count});
+        }
+        else
+        {
+            // Reference path: one draw per cube, its matrices worked out here rather than at replay
+            const TextureMaterial &textures = m_textureMaterials[m_scene.cubes.materials[draw.item]];
+            QMatrix4x4 model = cubeModelMatrix(draw.item);
+            QMatrix3x3 normal = normalMatrixFor(model);
+            SetCube cube;
+            std::copy(model.constData(), model.constData() + 16, cube.model);
+            std::copy(normal.constData(), normal.constData() + 9, cube.normal);
+            cube.layers[0] = mp_textureArrays->layer(textures.diffuse);
+            cube.layers[1] = mp_textureArrays->layer(textures.specular);
+            p_commands->record(cube);
+        }
+        p_commands->record(Draw{36});
+    }
+}
+
+void RenderWindow::replayDraws(const CommandBuffer &commands)
+{
+    using namespace DrawCommands;
+
+    // Locations were resolved after linking, unchanged values are skipped by the binding
+    const LightCasterUniforms &lc = m_lightCasterUniforms;
+    UniformBinding *p_uniforms = nullptr;
+    SetInstances instances = {0, 0};
+
+    commands.replay([&](unsigned int opcode, const uint32_t *p_payload)
+    {
+        switch (opcode)
+        {
+        case BindPipelineOp:
+        {
+            const BindPipeline packet = CommandBuffer::payload<BindPipeline>(p_payload);
+            instances = {0, 0};
+            if (packet.pipeline == LampPipeline)
+            {
+                const ShaderVariants::Variant &variant = mp_lampVariants->variant(0);
+                mp_stateCache->apply(*variant.p_pipeline);
+                p_uniforms = variant.p_uniforms;
+                break;
+            }
+            ShaderVariants *p_variants = packet.pipeline == GBufferPipeline ? mp_gBufferVariants : mp_lightVariants;
+            const ShaderVariants::Variant &variant = p_variants->variant(packet.features);
+            mp_stateCache->apply(*variant.p_pipeline);
+            p_uniforms = variant.p_uniforms;
+            p_uniforms->set(lc.materialDiffuse, 0);
+            p_uniforms->set(lc.materialSpecular, 1);
+            p_uniforms->set(lc.materialShininess, 64.0f);
+            // Inactive in the G-buffer programs, these are no-ops there
+            p_uniforms->set(lc.pointLightData, int(cm_clusterTextureUnit + ClusteredLighting::LightsBuffer));
+            p_uniforms->set(lc.clusterData, int(cm_clusterTextureUnit + ClusteredLighting::ClustersBuffer));
+            p_uniforms->set(lc.clusterLightIndices, int(cm_clusterTextureUnit + ClusteredLighting::IndicesBuffer));
+            if (packet.pipeline == CubePipeline)
+                mp_clusteredLighting->bind(cm_clusterTextureUnit);
+            break;
+        }
+        case BindMaterialOp:
+        {
+            const BindMaterial packet = CommandBuffer::payload<BindMaterial>(p_payload);
+            mp_stateCache->bindTexture(0, GL_TEXTURE_2D_ARRAY, packet.diffuseArray);
+            mp_stateCache->bindTexture(1, GL_TEXTURE_2D_ARRAY, packet.specularArray);
+            break;
+        }
+        case SetInstancesOp:
+            instances = CommandBuffer::payload<SetInstances>(p_payload);
+            bindCubeInstanceAttributes(instances.first);
+            break;
+        case SetCubeOp:
+        {
+            const SetCube packet = CommandBuffer::payload<SetCube>(p_payload);
+            QMatrix4x4 model;
+            std::copy(packet.model, packet.model + 16, model.data());
+            // The array constructors read row-major, the packets hold OpenGL's column-major order
+            QMatrix3x3 normal;
+            std::copy(packet.normal, packet.normal + 9, normal.data());
+            p_uniforms->set(lc.model, model);
+            p_uniforms->set(lc.normalMatrix, normal);
+            p_uniforms->set(lc.layers, QVector2D(packet.layers[0], packet.layers[1]));
+            break;
+        }
+        case SetLampOp:
+        {
+            const SetLamp packet = CommandBuffer::payload<SetLamp>(p_payload);
+            QMatrix4x4 model;
+            std::copy(packet.model, packet.model + 16, model.data());
+            p_uniforms->set(m_lampUniforms.model, model);
+            break;
+        }
+        case DrawOp:
+        {
+            const Draw packet = CommandBuffer::payload<Draw>(p_payload);
+            if (instances.count > 0)
+                glDrawArraysInstanced(GL_TRIANGLES, 0, GLsizei(packet.vertexCount), GLsizei(instances.count));
+            else
+                glDrawArrays(GL_TRIANGLES, 0, GLsizei(packet.vertexCount));
+            break;
+        }
+        }
+    });
 }
 
 void RenderWindow::resizeGL(int width, int height)
 {
     // Update projection matrix and other size related settings:
     glViewport(0, 0, width, height);
+    m_viewportWidth = width;
+    m_viewportHeight = height;
+    if (mp_deferredShading != nullptr)
+        mp_deferredShading->resize(width, height);
+}
+
+void RenderWindow::startRendering()
+{
+    // Surfaces and the context are created here on the GUI thread, the render thread takes the context over
+    mp_uploadSurface = new QOffscreenSurface;
+    mp_uploadSurface->setFormat(requestedFormat());
+    mp_uploadSurface->create();
+
+    mp_context = new QOpenGLContext;
+    mp_context->setFormat(requestedFormat());
+    if (!mp_context->create())
+    {
+        qDebug() << "Failed to create the OpenGL context!";
+        return;
+    }
+
+    mp_renderThread = QThread::create([this]() { renderLoop(); });
+    mp_context->moveToThread(mp_renderThread);
+    mp_renderThread->start();
+}
+
+bool RenderWindow::startOffscreen(const OffscreenSettings &settings)
+{
+    mp_uploadSurface = new QOffscreenSurface;
+    mp_uploadSurface->setFormat(requestedFormat());
+    mp_uploadSurface->create();
+    mp_offscreenSurface = new QOffscreenSurface;
+    mp_offscreenSurface->setFormat(requestedFormat());
+    mp_offscreenSurface->create();
+
+    mp_context = new QOpenGLContext;
+    mp_context->setFormat(requestedFormat());
+    if (!mp_context->create() || !mp_context->makeCurrent(mp_offscreenSurface))
+    {
+        qDebug() << "Failed to create the OpenGL context!";
+        return false;
+    }
 
-    m_lastMouseState.lastX = width/2;
-    m_lastMouseState.lastY = height/2;
-    QCursor::setPos(mapToGlobal(QPoint(width/2, height/2)));
+    initializeGL();
+    // Depth-stencil like the window's, the deferred path blits its depth into it
+    QOpenGLFramebufferObjectFormat targetFormat;
+    targetFormat.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+    mp_offscreenTarget = new QOpenGLFramebufferObject(settings.width, settings.height, targetFormat);
+    mp_offscreenTarget->bind();
+    resizeGL(settings.width, settings.height);
+    m_exposed = true;
+
+    for (const QChar &key: settings.toggles)
+        pressKey(key.toUpper().unicode());
+
+    // Textures and the cube mesh stream in on the upload thread, timing starts once they are all there
+    QElapsedTimer loading;
+    loading.start();
+    while ((mp_textureLoader->pending() || mp_textureArrays->pending() || !m_cubeMeshResident) &&
+           !loading.hasExpired(cm_offscreenLoadTimeout))
+    {
+        paintGL();
+        glFlush();
+        QThread::msleep(1);
+    }
 
-    m_projectionMatrix.setToIdentity();
-    m_projectionMatrix.perspective(m_lastMouseState.fov, (float)width/(float)height, 0.1f, 100.0f);
-    m_camera.setProjectionMatrix(m_projectionMatrix);
+    mp_gpuTimer = new GpuTimer(cm_framesInFlight);
+    return true;
+}
+
+qint64 RenderWindow::renderOffscreen(const CameraPose &pose)
+{
+    // The scripted pose stands for both simulation states, so nothing is interpolated away
+    m_camera.lookAlong(pose.position, pose.front, pose.up);
+    m_previousCamera = cameraPose();
+
+    QElapsedTimer timer;
+    timer.start();
+    mp_gpuTimer->begin();
+    paintGL();
+    mp_gpuTimer->end();
+    // Stands in for the swap, which would hand the frame to the driver
+    glFlush();
+    return timer.nsecsElapsed();
+}
+
+std::vector<qint64> RenderWindow::finishOffscreen()
+{
+    mp_gpuTimer->finish();
+    std::vector<qint64> gpuFrameNs = mp_gpuTimer->frameNs();
+
+    delete mp_gpuTimer;
+    mp_gpuTimer = nullptr;
+    delete mp_offscreenTarget;
+    mp_offscreenTarget = nullptr;
+    cleanupGL();
+    mp_context->doneCurrent();
+    return gpuFrameNs;
+}
+
+void RenderWindow::pushInput(const InputEvent &event)
+{
+    // Only when the render thread stalls for a thousand events; a lost release
+    // leaves a key held, which the next press and release fix
+    if (!m_input.push(event) && (m_droppedInput++ % 100) == 0)
+        qDebug() << "Input queue full, dropped" << m_droppedInput << "events";
+    m_frameScheduler.wake();
+}
+
+void RenderWindow::exposeEvent(QExposeEvent *)
+{
+    if (isExposed() && mp_renderThread == nullptr)
+        startRendering();
+
+    InputEvent event;
+    event.type = InputEvent::Expose;
+    event.key = isExposed() ? 1 : 0;
+    pushInput(event);
+}
+
+void RenderWindow::resizeEvent(QResizeEvent *)
+{
+    m_lastMouseState.lastX = mapToGlobal(QPoint(width()/2, height()/2)).x();
+    m_lastMouseState.lastY = mapToGlobal(QPoint(width()/2, height()/2)).y();
+    QCursor::setPos(mapToGlobal(QPoint(width()/2, height()/2)));
 
+    InputEvent event;
+    event.type = InputEvent::Resize;
+    event.x = float(width() * devicePixelRatio());
+    event.y = float(height() * devicePixelRatio());
+    pushInput(event);
 }
 
 void RenderWindow::keyPressEvent(QKeyEvent *p_key)
 {
     if (p_key->key() == Qt::Key_Escape)
+    {
         QApplication::quit();
-    if (p_key->key() == Qt::Key_W)
+        return;
+    }
+
+    InputEvent event;
+    event.type = InputEvent::KeyPress;
+    event.key = p_key->key();
+    pushInput(event);
+}
+
+void RenderWindow::keyReleaseEvent(QKeyEvent *p_key)
+{
+    InputEvent event;
+    event.type = InputEvent::KeyRelease;
+    event.key = p_key->key();
+    pushInput(event);
+}
+
+void RenderWindow::mouseMoveEvent(QMouseEvent * p_mouse)
+{
+#ifdef QT_DEPRECATED_VERSION_5
+    float xOffset = p_mouse->globalPos().x() - m_lastMouseState.lastX;
+    float yOffset = m_lastMouseState.lastY - p_mouse->globalPos().y();
+#elif
+    float xOffset = p_mouse->globalPosition().x() - m_lastMouseState.lastX;
+    float yOffset = m_lastMouseState.lastY - p_mouse->globalPosition().y();
+#endif
+
+    m_lastMouseState.lastX = mapToGlobal(QPoint(width()/2, height()/2)).x();
+    m_lastMouseState.lastY = mapToGlobal(QPoint(width()/2, height()/2)).y();
+    QCursor::setPos(mapToGlobal(QPoint(width()/2, height()/2)));
+
+    InputEvent event;
+    event.type = InputEvent::MouseMove;
+    event.x = xOffset;
+    event.y = yOffset;
+    pushInput(event);
+}
+
+void RenderWindow::wheelEvent(QWheelEvent *p_wheel)
+{
+    InputEvent event;
+    event.type = InputEvent::Wheel;
+    event.x = p_wheel->angleDelta().y();
+    pushInput(event);
+}
+
+bool RenderWindow::drainInput()
+{
+    bool received = false;
+    InputEvent event;
+    while (m_input.pop(&event))
+    {
+        received = true;
+        switch (event.type)
+        {
+        case InputEvent::KeyPress:
+            pressKey(event.key);
+            break;
+        case InputEvent::KeyRelease:
+            releaseKey(event.key);
+            break;
+        case InputEvent::MouseMove:
+            turnCamera(event.x, event.y);
+            break;
+        case InputEvent::Wheel:
+            zoomCamera(event.x);
+            break;
+        case InputEvent::Resize:
+            resizeGL(int(event.x), int(event.y));
+            break;
+        case InputEvent::Expose:
+            m_exposed = event.key != 0;
+            break;
+        }
+    }
+    return received;
+}
+
+bool RenderWindow::animating() const
+{
+    const KeyboardState &keys = m_buttonsState;
+    bool moving = keys.W_keyPressed || keys.S_keyPressed || keys.A_keyPressed || keys.D_keyPressed ||
+                  keys.Q_keyPressed || keys.E_keyPressed;
+    // Streamed textures and reloaded shaders show up only in frames that poll them
+    return moving || keys.Swarm_key_activated || keys.Churn_key_activated || mp_textureLoader->pending() || mp_textureArrays->pending() ||
+           mp_shaderReloader->busy() || !m_cubeMeshResident;
+}
+
+void RenderWindow::pressKey(int key)
+{
+    if (key == Qt::Key_W)
         m_buttonsState.W_keyPressed = true;
-    if (p_key->key() == Qt::Key_S)
+    if (key == Qt::Key_S)
         m_buttonsState.S_keyPressed = true;
-    if (p_key->key() == Qt::Key_A)
+    if (key == Qt::Key_A)
         m_buttonsState.A_keyPressed = true;
-    if (p_key->key() == Qt::Key_D)
+    if (key == Qt::Key_D)
         m_buttonsState.D_keyPressed = true;
-    if (p_key->key() == Qt::Key_Q)
+    if (key == Qt::Key_Q)
         m_buttonsState.Q_keyPressed = true;
-    if (p_key->key() == Qt::Key_E)
+    if (key == Qt::Key_E)
         m_buttonsState.E_keyPressed = true;
-    if (p_key->key() == Qt::Key_L)
+    if (key == Qt::Key_L)
         m_buttonsState.Light_key_activated = !m_buttonsState.Light_key_activated;
+    if (key == Qt::Key_I)
+        m_buttonsState.Instancing_key_activated = !m_buttonsState.Instancing_key_activated;
+    if (key == Qt::Key_F)
+        m_buttonsState.Stats_key_activated = !m_buttonsState.Stats_key_activated;
+    if (key == Qt::Key_C)
+        m_buttonsState.Culling_key_activated = !m_buttonsState.Culling_key_activated;
+    if (key == Qt::Key_P)
+        m_buttonsState.Swarm_key_activated = !m_buttonsState.Swarm_key_activated;
+    if (key == Qt::Key_G)
+        m_buttonsState.Deferred_key_activated = !m_buttonsState.Deferred_key_activated;
+    if (key == Qt::Key_K)
+        m_buttonsState.Churn_key_activated = !m_buttonsState.Churn_key_activated;
 
 }
 
-void RenderWindow::keyReleaseEvent(QKeyEvent *p_key)
+void RenderWindow::releaseKey(int key)
 {
-    if (p_key->key() == Qt::Key_W)
+    if (key == Qt::Key_W)
         m_buttonsState.W_keyPressed = false;
-    if (p_key->key() == Qt::Key_S)
+    if (key == Qt::Key_S)
         m_buttonsState.S_keyPressed = false;
-    if (p_key->key() == Qt::Key_A)
+    if (key == Qt::Key_A)
         m_buttonsState.A_keyPressed = false;
-    if (p_key->key() == Qt::Key_D)
+    if (key == Qt::Key_D)
         m_buttonsState.D_keyPressed = false;
-    if (p_key->key() == Qt::Key_Q)
+    if (key == Qt::Key_Q)
         m_buttonsState.Q_keyPressed = false;
-    if (p_key->key() == Qt::Key_E)
+    if (key == Qt::Key_E)
         m_buttonsState.E_keyPressed = false;
 }
 
-void RenderWindow::mouseMoveEvent(QMouseEvent * p_mouse)
+void RenderWindow::turnCamera(float xOffset, float yOffset)
 {
 
-    float cameraSpeed = cm_mouseSensitivity * m_frameDelta;
-
-#ifdef QT_DEPRECATED_VERSION_5
-    float xOffset = p_mouse->globalPos().x() - m_lastMouseState.lastX;
-    float yOffset = m_lastMouseState.lastY - p_mouse->globalPos().y();
-#elif
-    float xOffset = p_mouse->globalPosition().x() - m_lastMouseState.lastX;
-    float yOffset = m_lastMouseState.lastY - p_mouse->globalPosition().y();
-#endif
-
-    m_lastMouseState.lastX = mapToGlobal(QPoint(width()/2, height()/2)).x();
-    m_lastMouseState.lastY = mapToGlobal(QPoint(width()/2, height()/2)).y();
-    QCursor::setPos(mapToGlobal(QPoint(width()/2, height()/2)));
+    float cameraSpeed = cm_mouseSensitivity * m_timestep.stepMs();
 
     xOffset *= cameraSpeed;
     yOffset *= cameraSpeed;
@@ -237,187 +992,179 @@ void RenderWindow::mouseMoveEvent(QMouseEvent * p_mouse)
         yOffset = 0.0f;
     }
 
+    QQuaternion before = m_camera.orientation();
 //Yaw rotation
     m_camera.pan(xOffset);
 //Pitch rotation
     m_camera.tilt(yOffset);
 
+    // Mouse look is not simulated: the previous state turns along, so the
+    // interpolated camera shows the turn in this frame already
+    QQuaternion turn = m_camera.orientation() * before.conjugated();
+    m_previousCamera.front = turn.rotatedVector(m_previousCamera.front);
+    m_previousCamera.up = turn.rotatedVector(m_previousCamera.up);
+
 }
 
-void RenderWindow::wheelEvent(QWheelEvent *p_wheel)
+void RenderWindow::zoomCamera(float delta)
 {
-    float cameraSpeed = cm_wheelSensitivity * m_frameDelta;
+    float cameraSpeed = cm_wheelSensitivity * m_timestep.stepMs();
 
-        m_lastMouseState.fov -= p_wheel->angleDelta().y() * cameraSpeed;
+        m_lastMouseState.fov -= delta * cameraSpeed;
     if(m_lastMouseState.fov < 5.0f)
         m_lastMouseState.fov = 5.0f;
     if(m_lastMouseState.fov > 45.0f)
         m_lastMouseState.fov = 45.0f;
 }
 
-
-
-void RenderWindow::paintGL()
+void RenderWindow::renderLoop()
 {
-    defineFrameDelta();
-    processInput();
+    mp_context->makeCurrent(this);
+    initializeGL();
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    while (!m_stopping.load(std::memory_order_acquire))
+    {
+        // Delivers the shader watcher signals, which live on this thread
+        QCoreApplication::processEvents();
+        if (drainInput())
+            m_frameScheduler.requestFrame();
+        if (!m_exposed)
+        {
+            QThread::msleep(cm_hiddenSleep);
+            continue;
+        }
 
-    m_viewMatrix.setToIdentity();
-    m_viewMatrix.lookAt(m_camera.position(),
-                        m_camera.position() + m_camera.viewVector(),
-                        m_camera.upVector());
+        if (animating())
+            m_frameScheduler.requestFrame();
+        if (!m_frameScheduler.waitForFrame())
+            continue;
+        // Nothing moved while the loop slept, the simulation picks up from now
+        if (m_frameScheduler.resumed())
+            m_timestep.resync(m_frameTimer.nsecsElapsed());
+
+        paintGL();
+        mp_context->swapBuffers(this);
+        m_frameScheduler.frameDone();
+    }
 
-//--------------------------------------------------------------------------------------------------------------
-    mp_shaderProgLight->bind();
+    cleanupGL();
+    mp_context->doneCurrent();
+    // Back to the GUI thread, which deletes it
+    mp_context->moveToThread(QCoreApplication::instance()->thread());
+}
 
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("view"), m_viewMatrix);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("projection"), m_projectionMatrix);
+void RenderWindow::paintGL()
+{
+    // CPU side of the frame first, it overlaps with the GPU finishing the previous one
+    simulate();
+    // Textures written on the upload thread have to be bound again to show up here
+    mp_uploadThread->poll();
+    bool texturesUploaded = mp_textureLoader->poll();
+    // Layers and arrays moved, so the instance data and the batches are stale
+    if (mp_textureArrays->poll())
+    {
+        m_cubeInstancesDirty = true;
+        texturesUploaded = true;
+    }
+    // A reloaded shader replaced programs and pipelines the cache may still hold
+    bool shadersReloaded = mp_shaderReloader->poll();
+    if (texturesUploaded || shadersReloaded)
+        mp_stateCache->invalidate();
+
+    // Both only mark the matrices stale when something changed
+    m_frameCamera.lookAlong(m_renderCamera.position, m_renderCamera.front, m_renderCamera.up);
+    m_frameCamera.setPerspective(m_lastMouseState.fov, (float)m_viewportWidth/(float)m_viewportHeight,
+                                 cm_nearPlane, cm_farPlane);
+
+    // The jobs read the camera from several threads, its lazy matrices must be built by then
+    m_frameCamera.viewProjectionMatrix();
+
+    // CPU side of the frame on the job system, while this thread waits for the GPU
+    std::vector<JobHandle> drawInputs = {cullScene()};
+    if (m_cubeInstancesDirty)
+        drawInputs.push_back(updateCubeInstances());
+    JobHandle lights = updateLights();
+    // Every draw goes through the queue; sorted keys group them by pipeline and
+    // texture set, and run each group front to back
+    JobHandle draws = mp_jobs->run([this]()
+    {
+        submitDraws();
+        m_renderQueue.sort();
+        // Lamps sort last; the deferred path runs its light passes before them
+        const std::vector<RenderQueue::Draw> &queued = m_renderQueue.draws();
+        m_lampDraws = std::partition_point(queued.begin(), queued.end(), [](const RenderQueue::Draw &draw)
+        {
+            return RenderQueue::pipeline(draw.key) != LampPipeline;
+        }) - queued.begin();
+    }, drawInputs);
+    JobHandle recorded = recordDraws(draws);
 
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("material.diffuse"), 0);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("material.specular"), 1);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("material.shininess"), 64.0f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("viewPos"), m_camera.position());
+    // Per-frame buffers are rewritten from here on
+    mp_frameFences->wait();
 
+    // The last pipeline of the previous frame may have left depth writes off
+    mp_stateCache->depthMask(true);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Direct light
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("dirLight.direction"),
-                                                                            QVector3D(-0.2f, -1.0f, -0.3f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("dirLight.ambient"),
-                                                                            QVector3D(0.05f, 0.05f, 0.05f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("dirLight.diffuse"),
-                                                                            QVector3D(0.4f, 0.4f, 0.4f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("dirLight.specular"),
-                                                                            QVector3D(0.5f, 0.5f, 0.5f));
-
-    // Point light №1
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[0].position"),
-                                                                            m_pointLightPositions[0]);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[0].ambient"),
-                                                                            QVector3D(0.05f, 0.05f, 0.05f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[0].diffuse"),
-                                                                            QVector3D(0.8f, 0.8f, 0.8f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[0].specular"),
-                                                                            QVector3D(1.0f, 1.0f, 1.0f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[0].constant"), 1.0f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[0].linear"), 0.09f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[0].quadratic"), 0.032f);
-
-    // Point light №2
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[1].position"),
-                                                                            m_pointLightPositions[1]);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[1].ambient"),
-                                                                            QVector3D(0.05f, 0.05f, 0.05f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[1].diffuse"),
-                                                                            QVector3D(0.8f, 0.8f, 0.8f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[1].specular"),
-                                                                            QVector3D(1.0f, 1.0f, 1.0f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[1].constant"), 1.0f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[1].linear"), 0.09f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[1].quadratic"), 0.032f);
-
-    // Point light №3
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[2].position"),
-                                                                            m_pointLightPositions[2]);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[2].ambient"),
-                                                                            QVector3D(0.05f, 0.05f, 0.05f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[2].diffuse"),
-                                                                            QVector3D(0.8f, 0.8f, 0.8f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[2].specular"),
-                                                                            QVector3D(1.0f, 1.0f, 1.0f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[2].constant"), 1.0f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[2].linear"), 0.09f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[2].quadratic"), 0.032f);
-
-    // Point light №4
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[3].position"),
-                                                                            m_pointLightPositions[3]);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[3].ambient"),
-                                                                            QVector3D(0.05f, 0.05f, 0.05f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[3].diffuse"),
-                                                                            QVector3D(0.8f, 0.8f, 0.8f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[3].specular"),
-                                                                            QVector3D(1.0f, 1.0f, 1.0f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[3].constant"), 1.0f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[3].linear"), 0.09f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("pointLights[3].quadratic"), 0.032f);
+    // GL calls stay on this thread; waiting runs queued jobs here too
+    mp_jobs->wait(lights);
+    mp_clusteredLighting->upload();
+    updateUniformBlocks();
 
-    // Torch
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.position"), m_camera.position());
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.direction"), m_camera.viewVector());
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.cutOff"), cos(12.5f * PI/180.0f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.outerCutOff"), cos(17.5f * PI/180.0f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.activated"), m_buttonsState.Light_key_activated);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.ambient"),
-                                                                            QVector3D(0.05f, 0.05f, 0.05f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.diffuse"),
-                                                                            QVector3D(0.8f, 0.8f, 0.8f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.specular"),
-                                                                            QVector3D(1.0f, 1.0f, 1.0f));
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.constant"), 1.0f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.linear"), 0.09f);
-    mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("spotLight.quadratic"), 0.032f);
-//--------------------------------------------------------------------------------------------------------------
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_diffuseMap);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, m_specularMap);
-
-    glBindVertexArray(m_cubeVAO);
-    for (unsigned int i = 0; i < m_cubePositions.size(); i++)
+    mp_jobs->wait(recorded);
+    uploadVisibleCubeInstances();
+
+    // Recorded in order, so replaying the buffers one after another keeps the sorted sequence
+    const size_t cubeBuffers = m_commandBuffers.size() - 1;
+    if (m_buttonsState.Deferred_key_activated == true)
     {
-        QMatrix4x4 model;
-        model.translate(m_cubePositions[i]);
-        model.rotate(20.0f * (float)i, QVector3D(1.0f, 0.3f, 0.5f));
-        mp_shaderProgLight->setUniformValue(mp_shaderProgLight->uniformLocation("model"), model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        // Cubes fill the G-buffer, the light passes shade only the visible pixels,
+        // then the lamps are drawn forward on top
+        mp_deferredShading->beginGeometry();
+        for (size_t i = 0; i < cubeBuffers; i++)
+            replayDraws(m_commandBuffers[i]);
+        mp_clusteredLighting->bind(cm_clusterTextureUnit);
+        mp_deferredShading->shade(m_pointLights, m_frameCamera.viewMatrix(), m_frameCamera.projectionMatrix(),
+                                  cm_nearPlane,
+                                  mp_offscreenTarget != nullptr ? mp_offscreenTarget->handle()
+                                                                : mp_context->defaultFramebufferObject(),
+                                  cm_gBufferTextureUnit,
+                                  cm_clusterTextureUnit + ClusteredLighting::LightsBuffer);
+        replayDraws(m_commandBuffers.back());
     }
-    mp_shaderProgLight->release();
-
-    mp_shaderProgLamp->bind();
-    mp_shaderProgLamp->setUniformValue(mp_shaderProgLamp->uniformLocation("view"), m_viewMatrix);
-    mp_shaderProgLamp->setUniformValue(mp_shaderProgLamp->uniformLocation("projection"), m_projectionMatrix);
-
-    glBindVertexArray(m_lightVAO);
-    for (unsigned int i = 0; i < m_pointLightPositions.size(); i++)
+    else
     {
-        QMatrix4x4 model;
-        model.translate(m_pointLightPositions[i]);
-        model.scale(0.1f);
-        mp_shaderProgLamp->setUniformValue(mp_shaderProgLamp->uniformLocation("model"), model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        for (const CommandBuffer &commands: m_commandBuffers)
+            replayDraws(commands);
     }
 
+    for (const CommandBuffer &commands: m_commandBuffers)
+    {
+        m_statsPackets += commands.packets();
+        m_statsPacketBytes += commands.bytes();
+    }
 
-    mp_shaderProgLamp->release();
-    mp_shaderProgLight->release();
-
-    this->update();
+    // No release: the next frame's pipelines replace the program through the cache
+    mp_frameFences->insert();
+    reportFrameStats();
 }
 
 void RenderWindow::processInput()
 {
 
-    float cameraSpeed = cm_cameraSpeedFactor * m_frameDelta;
-
-    m_projectionMatrix.setToIdentity();
-    m_projectionMatrix.perspective(m_lastMouseState.fov, (float)width()/(float)height(), 0.1f, 100.0f);
-
-    m_camera.setProjectionMatrix(m_projectionMatrix);
+    float cameraSpeed = cm_cameraSpeedFactor * m_timestep.stepMs();
 
     if (m_buttonsState.W_keyPressed == true)
-        m_camera.translateWorld(cameraSpeed * m_camera.viewVector());
+        m_camera.translateWorld(cm_forwardSpeedScale * cameraSpeed * m_camera.viewVector());
 
     if (m_buttonsState.S_keyPressed == true)
-        m_camera.translateWorld(-cameraSpeed * m_camera.viewVector());
+        m_camera.translateWorld(-cm_forwardSpeedScale * cameraSpeed * m_camera.viewVector());
 
     if (m_buttonsState.A_keyPressed == true)
-        m_camera.translateWorld(-QVector3D::normal(m_camera.viewVector(), m_camera.upVector()) * cameraSpeed);
+        m_camera.translateWorld(-m_camera.rightVector() * cameraSpeed);
 
     if (m_buttonsState.D_keyPressed == true)
-        m_camera.translateWorld(QVector3D::normal(m_camera.viewVector(), m_camera.upVector()) * cameraSpeed);
+        m_camera.translateWorld(m_camera.rightVector() * cameraSpeed);
 
     if (m_buttonsState.Q_keyPressed == true)
     {
@@ -438,10 +1185,31 @@ void RenderWindow::processInput()
     }
 }
 
-void RenderWindow::defineFrameDelta()
+void RenderWindow::simulate()
 {
-    float currentFrameTime = m_frameTimer.elapsed();
-    m_frameDelta = currentFrameTime - m_lastFrameTime;
-    m_lastFrameTime = currentFrameTime;
+    // Fixed-rate steps, however long the last frame took
+    int steps = m_timestep.advance(m_frameTimer.nsecsElapsed());
+    for (int step = 0; step < steps; step++)
+    {
+        m_previousCamera = cameraPose();
+        m_previousSimulationTime = m_simulationTime;
+
+        processInput();
+        churnCubes();
+        m_simulationTime += m_timestep.stepSeconds();
+    }
 
+    // The frame lies between the last two simulation states
+    float alpha = m_timestep.alpha();
+    m_renderCamera = CameraPose::interpolate(m_previousCamera, cameraPose(), alpha);
+    m_renderTime = m_previousSimulationTime + (m_simulationTime - m_previousSimulationTime) * alpha;
+}
+
+CameraPose RenderWindow::cameraPose() const
+{
+    CameraPose pose;
+    pose.position = m_camera.position();
+    pose.front = m_camera.viewVector();
+    pose.up = m_camera.upVector();
+    return pose;
 }
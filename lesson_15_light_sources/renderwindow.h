@@ -1,4 +1,7 @@
-#include <QOpenGLWindow>
+#include <QWindow>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QThread>
 
 #include <QKeyEvent>
 #include <QMouseEvent>
@@ -7,49 +10,191 @@
 #include <QOpenGLShader>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLFramebufferObject>
 #include <QMatrix4x4>
 #include <QVector3D>
-#include <Qt3DRender/QCamera>
 
 #include <QElapsedTimer>
 
+#include <atomic>
+#include <deque>
+#include <random>
+
+#include <camera.h>
+#include <command_buffer.h>
 #include <keyboard_state.h>
 #include <mouse_state.h>
+#include <clustered_lighting.h>
+#include <deferred_shading.h>
 #include <direction.h>
+#include <fixed_timestep.h>
+#include <frame_fences.h>
+#include <frame_scheduler.h>
+#include <frustum_culling.h>
+#include <gl_state_cache.h>
+#include <gpu_timer.h>
+#include <input_event.h>
+#include <job_system.h>
+#include <normal_matrix.h>
+#include <render_queue.h>
+#include <scene_store.h>
+#include <shader_cache.h>
+#include <shader_reloader.h>
+#include <shader_variants.h>
+#include <spsc_queue.h>
+#include <texture_array_manager.h>
+#include <texture_loader.h>
+#include <transform_kernel.h>
+#include <upload_thread.h>
+#include <shader_uniforms.h>
+#include <uniform_binding.h>
+#include <uniform_blocks.h>
+#include <uniform_buffer.h>
 
 
 #ifndef RENDERWINDOW_H
 #define RENDERWINDOW_H
 
-using namespace Qt3DRender;
-
-class RenderWindow : public QOpenGLWindow, protected QOpenGLFunctions_3_3_Core
+// Rendering runs on its own thread, which owns the OpenGL context and draws
+// frames back to back. The GUI thread only turns Qt events into InputEvents and
+// pushes them through a lock-free queue, so neither side waits on the other.
+// The FrameScheduler paces the loop; in idle mode it sleeps until input arrives.
+// Culling, transforms, light binning and the draw list of a frame run as jobs
+// on a JobSystem while this thread issues the GL calls. Jobs also record the
+// sorted draws into CommandBuffers, which this thread only has to replay.
+// Headless runs skip the window and the render thread: the caller's thread
+// draws scripted frames into an FBO, see startOffscreen().
+class RenderWindow : public QWindow, protected QOpenGLFunctions_3_3_Core
 {
     Q_OBJECT
 private:
     const float                         cm_cameraSpeedFactor = 0.003f;
+    // QCamera kept the initial 4 unit eye-to-center distance in its view vector,
+    // which made walking that much faster than strafing
+    const float                         cm_forwardSpeedScale = 4.0f;
     const float                         cm_mouseSensitivity = 0.008f;
     const float                         cm_wheelSensitivity = 0.001f;
     const QVector4D                     cm_clearColor = QVector4D(0.0f, 0.0f, 0.0f, 1.0f);
+    // mat4 model + mat3 normal matrix + diffuse/specular array layers per cube instance
+    const int                           cm_cubeInstanceStride = 16 + 9 + 2;
+    const qint64                        cm_statsInterval = 1000;
+    const float                         cm_nearPlane = 0.1f;
+    const float                         cm_farPlane = 100.0f;
+    // Small dynamic point lights toggled with P, on top of the four lamps
+    const unsigned int                  cm_swarmLightsCount = 2048;
+    // Extra cubes toggled with K; one is replaced every simulation step
+    const unsigned int                  cm_churnCubesCount = 64;
+    const float                         cm_lampScale = 0.1f;
+    // Texture units 0 and 1 hold the material arrays
+    const unsigned int                  cm_clusterTextureUnit = 2;
+    // Units 2-4 hold the cluster buffers, the deferred light passes read the G-buffer from 5-7
+    const unsigned int                  cm_gBufferTextureUnit = 5;
+    // The CPU prepares the next frame while the GPU still draws the previous one
+    const unsigned int                  cm_framesInFlight = 2;
+    const unsigned long                 cm_hiddenSleep = 16;
+    // 60 steps a second, the frame rate the speed factors above were tuned at
+    const qint64                        cm_simulationStepNs = 1000000000 / 60;
+    // Headless runs wait this long at most for the textures before the first timed frame
+    const qint64                        cm_offscreenLoadTimeout = 10000;
+    // Items per job; transform ranges stay multiples of 8 to keep the SIMD groups whole
+    const unsigned int                  cm_transformGrain = 1024;
+    const unsigned int                  cm_cullGrain = 4096;
+    const unsigned int                  cm_swarmGrain = 256;
+
+    // Pipeline field of the render queue sort key, in draw order. Lamps come last,
+    // so the deferred path can run its light passes before them.
+    enum PipelineId
+    {
+        CubePipeline = 0,
+        GBufferPipeline = 1,
+        LampPipeline = 2
+    };
 
     unsigned int                        m_VBO, m_cubeVAO, m_lightVAO, m_EBO;
-    unsigned int                        m_diffuseMap, m_specularMap, m_emissionMap;
+    unsigned int                        m_cubeInstanceVBO;
+    unsigned int                        m_emissionMap;
     KeyboardState                       m_buttonsState;
-    MouseState                          m_lastMouseState;
+    MouseState                          m_lastMouseState;   // lastX/lastY on the GUI thread, fov on the render thread
+
+    // GUI thread -> render thread
+    QOpenGLContext*                     mp_context;
+    QOffscreenSurface*                  mp_uploadSurface;
+    QThread*                            mp_renderThread;
+    SpscQueue<InputEvent, 1024>         m_input;
+    std::atomic<bool>                   m_stopping;
+    unsigned int                        m_droppedInput = 0;
+    bool                                m_exposed = false;
+    FrameScheduler                      m_frameScheduler;
+    FrameFences*                        mp_frameFences;
+    // Headless runs only
+    QOffscreenSurface*                  mp_offscreenSurface;
+    QOpenGLFramebufferObject*           mp_offscreenTarget;
+    GpuTimer*                           mp_gpuTimer;
+    JobSystem*                          mp_jobs;
+    int                                 m_jobWorkers = -1;  // -1: one less than the hardware threads
 
-    float                               m_frameDelta = 0.0f;
-    float                               m_lastFrameTime = 0.0f;
+    // m_camera and m_simulationTime hold the current simulation state, the
+    // previous ones the state before the last step; frames render in between
+    FixedTimestep                       m_timestep{cm_simulationStepNs};
+    CameraPose                          m_previousCamera;
+    CameraPose                          m_renderCamera;
+    float                               m_previousSimulationTime = 0.0f;
+    float                               m_simulationTime = 0.0f;
+    float                               m_renderTime = 0.0f;
 
     std::vector<QOpenGLShader*>          mp_shadersList;
 
-    QOpenGLShaderProgram*               mp_shaderProgLight;
-    QOpenGLShaderProgram*               mp_shaderProgLamp;
+    QString                             m_shaderDirectory;
+    ShaderVariants*                     mp_lightVariants;
+    ShaderVariants*                     mp_gBufferVariants;
+    ShaderVariants*                     mp_lampVariants;
+    ShaderReloader*                     mp_shaderReloader;
 
-    QMatrix4x4                          m_modelMatrix;
-    QMatrix4x4                          m_viewMatrix;
-    QMatrix4x4                          m_projectionMatrix;
+    LightCasterUniforms                 m_lightCasterUniforms;
+    LampUniforms                        m_lampUniforms;
+
+    UniformBuffer*                      mp_cameraBlock;
+    UniformBuffer*                      mp_lightsBlock;
+    UniformBuffer*                      mp_clusterBlock;
+    CameraBlock                         m_cameraBlockData;
+    LightsBlock                         m_lightsBlockData;
+    ClusterBlock                        m_clusterBlockData;
+
+    ClusteredLighting*                  mp_clusteredLighting;
+    DeferredShading*                    mp_deferredShading;
+    std::vector<PointLight>             m_pointLights;
+    std::vector<PointLight>             m_swarmLights;
+    int                                 m_viewportWidth = 1;
+    int                                 m_viewportHeight = 1;
+
+    ShaderCache*                        mp_shaderCache;
+    UploadThread*                       mp_uploadThread;
+    TextureLoader*                      mp_textureLoader;
+    TextureArrayManager*                mp_textureArrays;
 
-    QCamera                             m_camera;
+    GLStateCache*                       mp_stateCache;
+
+    // Cubes whose materials live in the same pair of arrays form one instanced draw
+    struct CubeBatch
+    {
+        unsigned int                    diffuseArray;
+        unsigned int                    specularArray;
+        unsigned int                    first;
+        unsigned int                    count;
+    };
+    std::vector<TextureMaterial>        m_textureMaterials;
+    std::vector<unsigned int>           m_materialBatch;
+    std::vector<CubeBatch>              m_cubeBatches;
+    std::vector<float>                  m_batchDepths;
+    RenderQueue                         m_renderQueue;
+    // One buffer per recording job over the cube draws, the last one holds the lamps
+    std::vector<CommandBuffer>          m_commandBuffers;
+    size_t                              m_lampDraws = 0;    // first lamp in the sorted queue
+
+    QMatrix4x4                          m_modelMatrix;
+    Camera                              m_camera;
+    // m_renderCamera with the lens, the matrices of the frame being drawn
+    Camera                              m_frameCamera;
 
     Direction                           m_cameraDirection;
     QVector3D                           m_cameraPosition;
@@ -58,24 +203,98 @@ private:
 
     QVector3D                           m_lightPos = QVector3D(1.2f, 1.0f, 2.0f);
     QVector3D                           m_lightDir = QVector3D(-0.2f, -1.0f, -0.3f);
-    std::vector<QVector3D>              m_cubePositions;
-    std::vector<QVector3D>              m_pointLightPositions;
+    SceneStore                          m_scene;
+    std::vector<float>                  m_cubeInstanceData;
+    std::vector<float>                  m_visibleInstanceData;
+    std::deque<EntityHandle>            m_churnCubes;    // oldest first
+    std::mt19937                        m_churnRandom;
+    bool                                m_cubeInstancesDirty = true;
+    bool                                m_cubeMeshResident = false;    // cube vertices written by the upload thread
+    bool                                m_cubeInstancesUploaded = false;
+    bool                                m_cubeInstancesPacked = false;
+
+    std::vector<unsigned int>           m_visibleCubes;
+    std::vector<std::vector<unsigned int>> m_visibleCubeRanges;    // one list per culling job
+    std::vector<unsigned int>           m_visibleLamps;
+    std::vector<unsigned int>           m_uploadedCubes;
 
     QElapsedTimer                       m_frameTimer;
+    QElapsedTimer                       m_statsTimer;
+    unsigned int                        m_statsFrames = 0;
+    unsigned int                        m_statsCulledCubes = 0;
+    unsigned int                        m_statsCulledLamps = 0;
+    unsigned int                        m_statsPackets = 0;
+    size_t                              m_statsPacketBytes = 0;
 public:
     RenderWindow(/*QOpenGLContext *shareContext*/);
     virtual ~RenderWindow() override;
+
+    // Before the window is shown
+    void setFrameSchedule(const FrameScheduler::Settings &settings);
+    void setJobWorkers(int workersCount);
+
+    // Headless runs, e.g. the benchmark target: no window is shown and frames
+    // go into an FBO on an offscreen surface, drawn on the calling thread
+    struct OffscreenSettings
+    {
+        int                             width = 1280;
+        int                             height = 720;
+        QString                         toggles;    // keys toggled before the first frame, e.g. "GP"
+    };
+    // Leaves the context current on the calling thread; false when it cannot be created
+    bool startOffscreen(const OffscreenSettings &settings);
+    // One frame seen from the pose; returns the CPU time it took in ns
+    qint64 renderOffscreen(const CameraPose &pose);
+    // Waits for the GPU and releases the GL resources; GPU time of every frame in ns
+    std::vector<qint64> finishOffscreen();
 protected:
-    QOpenGLShaderProgram* loadShaders(const QString &vertexShaderFileName, const QString &fragmentShaderFileName);
+    QOpenGLShaderProgram* loadShaders(const QString &vertexShaderFileName, const QString &fragmentShaderFileName,
+                                      const QByteArray &defines = QByteArray());
     void loadTexture(unsigned int * p_texture, const QString &texture_FileName);
+    void addTextureMaterial(const QString &diffuse_FileName, const QString &specular_FileName);
+    void resolveLightCasterUniforms(QOpenGLShaderProgram *p_program, UniformBinding *p_uniforms);
+    void resolveUniforms();
+    void createPipelines();
+    void updateUniformBlocks();
+    JobHandle updateLights();
+    void reportFrameStats();
     void processInput();
-    void defineFrameDelta();
+    void simulate();
+    CameraPose cameraPose() const;
     void processModels();
+    void churnCubes();
+    QMatrix4x4 cubeModelMatrix(unsigned int index) const;
+    JobHandle updateCubeInstances();
+    void bindCubeInstanceAttributes(unsigned int firstInstance);
+    void packVisibleCubeInstances();
+    void uploadVisibleCubeInstances();
+    JobHandle cullScene();
+    float viewDepth(const QVector3D &position) const;
+    void submitDraws();
+    JobHandle recordDraws(const JobHandle &sorted);
+    void recordDraws(size_t first, size_t last, CommandBuffer *p_commands) const;
+    void replayDraws(const CommandBuffer &commands);
+
+
+    // Render thread
+    void renderLoop();
+    bool drainInput();
+    bool animating() const;
+    void pressKey(int key);
+    void releaseKey(int key);
+    void turnCamera(float xOffset, float yOffset);
+    void zoomCamera(float delta);
+    void initializeGL();
+    void resizeGL(int width, int height);
+    void paintGL();
+    void cleanupGL();
 
-    void initializeGL()                         override;
-    void resizeGL(int width, int height)        override;
-    void paintGL()                              override;
+    // GUI thread
+    void startRendering();
+    void pushInput(const InputEvent &event);
 
+    void exposeEvent(QExposeEvent *p_expose)    override;
+    void resizeEvent(QResizeEvent *p_resize)    override;
     void keyPressEvent(QKeyEvent *p_key)        override;
     void keyReleaseEvent(QKeyEvent *p_key)      override;
     void mouseMoveEvent(QMouseEvent *p_mouse)   override;
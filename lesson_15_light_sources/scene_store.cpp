@@ -0,0 +1,190 @@
+#include "scene_store.h"
+
+#include <cmath>
+
+namespace
+{
+    // Last element into the hole, as EntityTable::destroy() moved the rows
+    template <typename Array>
+    void removeRow(Array *p_array, unsigned int row)
+    {
+        (*p_array)[row] = p_array->back();
+        p_array->pop_back();
+    }
+
+    void removeRow(BoundsSoA *p_bounds, unsigned int row)
+    {
+        for (AlignedArray<float> *p_array: {&p_bounds->centerX, &p_bounds->centerY, &p_bounds->centerZ,
+                                            &p_bounds->radius, &p_bounds->extentX, &p_bounds->extentY,
+                                            &p_bounds->extentZ})
+            removeRow(p_array, row);
+    }
+
+    void removeRow(TransformsSoA *p_transforms, unsigned int row)
+    {
+        for (AlignedArray<float> *p_array: {&p_transforms->positionX, &p_transforms->positionY,
+                                            &p_transforms->positionZ, &p_transforms->rotationX,
+                                            &p_transforms->rotationY, &p_transforms->rotationZ,
+                                            &p_transforms->rotationW, &p_transforms->scaleX,
+                                            &p_transforms->scaleY, &p_transforms->scaleZ})
+            removeRow(p_array, row);
+        removeRow(&p_transforms->dirty, row);
+        // The moved object's matrices belong to its new row now
+        if (row < p_transforms->size())
+            p_transforms->dirty[row] = 1;
+    }
+}
+
+EntityHandle EntityTable::create()
+{
+    EntityHandle handle;
+    if (m_freeSlots.empty())
+    {
+        handle.slot = static_cast<quint32>(m_slotRows.size());
+        m_slotRows.push_back(0);
+        m_slotGenerations.push_back(0);
+    }
+    else
+    {
+        handle.slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+    handle.generation = m_slotGenerations[handle.slot];
+    m_slotRows[handle.slot] = size();
+    m_rowSlots.push_back(handle.slot);
+    return handle;
+}
+
+int EntityTable::destroy(const EntityHandle &handle)
+{
+    int freed = row(handle);
+    if (freed < 0)
+        return -1;
+
+    quint32 movedSlot = m_rowSlots.back();
+    m_rowSlots[freed] = movedSlot;
+    m_slotRows[movedSlot] = quint32(freed);
+    m_rowSlots.pop_back();
+
+    // Outstanding copies of the handle no longer match
+    m_slotGenerations[handle.slot]++;
+    m_freeSlots.push_back(handle.slot);
+    return freed;
+}
+
+int EntityTable::row(const EntityHandle &handle) const
+{
+    if (handle.slot >= m_slotRows.size() || m_slotGenerations[handle.slot] != handle.generation)
+        return -1;
+    return int(m_slotRows[handle.slot]);
+}
+
+void EntityTable::clear()
+{
+    // Generations survive, so handles from before stay stale
+    m_freeSlots.clear();
+    for (quint32 slot = 0; slot < m_slotRows.size(); slot++)
+    {
+        m_slotGenerations[slot]++;
+        m_freeSlots.push_back(slot);
+    }
+    m_rowSlots.clear();
+}
+
+EntityHandle SceneStore::addCube(const QVector3D &position, const QQuaternion &rotation, unsigned int material,
+                                 const QVector3D &scale)
+{
+    EntityHandle handle = m_cubeEntities.create();
+    cubes.transforms.add(position, rotation, scale);
+    cubes.materials.push_back(material);
+
+    // World AABB of the rotated unit cube: |R| * scale * 0.5
+    const QMatrix3x3 matrix = rotation.toRotationMatrix();
+    QVector3D halfExtents;
+    for (int row = 0; row < 3; row++)
+        halfExtents[row] = 0.5f * (std::fabs(matrix(row, 0)) * scale.x() + std::fabs(matrix(row, 1)) * scale.y() +
+                                   std::fabs(matrix(row, 2)) * scale.z());
+    cubes.bounds.add(position, 0.5f * scale.length(), halfExtents);
+    return handle;
+}
+
+bool SceneStore::removeCube(const EntityHandle &handle)
+{
+    int row = m_cubeEntities.destroy(handle);
+    if (row < 0)
+        return false;
+    removeRow(&cubes.transforms, row);
+    removeRow(&cubes.materials, row);
+    removeRow(&cubes.bounds, row);
+    return true;
+}
+
+QVector3D SceneStore::cubePosition(unsigned int row) const
+{
+    const TransformsSoA &transforms = cubes.transforms;
+    return QVector3D(transforms.positionX[row], transforms.positionY[row], transforms.positionZ[row]);
+}
+
+EntityHandle SceneStore::addLamp(const PointLight &light, float lampHalfSize)
+{
+    EntityHandle handle = m_lampEntities.create();
+    lamps.positionX.push_back(light.position.x());
+    lamps.positionY.push_back(light.position.y());
+    lamps.positionZ.push_back(light.position.z());
+    lamps.ambient.push_back(light.ambient);
+    lamps.diffuse.push_back(light.diffuse);
+    lamps.specular.push_back(light.specular);
+    lamps.constant.push_back(light.constant);
+    lamps.linear.push_back(light.linear);
+    lamps.quadratic.push_back(light.quadratic);
+    lamps.radius.push_back(light.radius);
+    lamps.bounds.add(light.position, lampHalfSize * std::sqrt(3.0f),
+                     QVector3D(lampHalfSize, lampHalfSize, lampHalfSize));
+    return handle;
+}
+
+bool SceneStore::removeLamp(const EntityHandle &handle)
+{
+    int row = m_lampEntities.destroy(handle);
+    if (row < 0)
+        return false;
+    for (AlignedArray<float> *p_array: {&lamps.positionX, &lamps.positionY, &lamps.positionZ, &lamps.constant,
+                                        &lamps.linear, &lamps.quadratic, &lamps.radius})
+        removeRow(p_array, row);
+    for (AlignedArray<QVector3D> *p_array: {&lamps.ambient, &lamps.diffuse, &lamps.specular})
+        removeRow(p_array, row);
+    removeRow(&lamps.bounds, row);
+    return true;
+}
+
+QVector3D SceneStore::lampPosition(unsigned int row) const
+{
+    return QVector3D(lamps.positionX[row], lamps.positionY[row], lamps.positionZ[row]);
+}
+
+void SceneStore::gatherLights(std::vector<PointLight> *p_lights) const
+{
+    const unsigned int count = lampCount();
+    p_lights->reserve(p_lights->size() + count);
+    for (unsigned int row = 0; row < count; row++)
+    {
+        PointLight light;
+        light.position = lampPosition(row);
+        light.ambient = lamps.ambient[row];
+        light.diffuse = lamps.diffuse[row];
+        light.specular = lamps.specular[row];
+        light.constant = lamps.constant[row];
+        light.linear = lamps.linear[row];
+        light.quadratic = lamps.quadratic[row];
+        light.radius = lamps.radius[row];
+        p_lights->push_back(light);
+    }
+}
+
+void SceneStore::clear()
+{
+    m_cubeEntities.clear();
+    m_lampEntities.clear();
+    cubes = CubeComponents();
+    lamps = LampComponents();
+}
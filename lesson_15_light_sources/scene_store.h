@@ -0,0 +1,99 @@
+#ifndef SCENE_STORE_H
+#define SCENE_STORE_H
+
+#include <QQuaternion>
+#include <QVector3D>
+#include <QtGlobal>
+
+#include <aligned_allocator.h>
+#include <clustered_lighting.h>
+#include <frustum_culling.h>
+#include <transform_kernel.h>
+
+#include <vector>
+
+// Stable name of a scene object. Rows move when other objects are removed;
+// a handle keeps pointing at its object, and turns stale once it is removed.
+struct EntityHandle
+{
+    quint32                             slot = ~0u;
+    quint32                             generation = 0;
+};
+
+// Maps handles to dense rows. Removal moves the last row into the hole, so the
+// component arrays stay packed and passes over them never meet a gap.
+class EntityTable
+{
+private:
+    std::vector<quint32>                m_slotRows;
+    std::vector<quint32>                m_slotGenerations;
+    std::vector<quint32>                m_rowSlots;
+    std::vector<quint32>                m_freeSlots;
+public:
+    // The new object takes row size()
+    EntityHandle create();
+    // Returns the row that was freed, or -1 for a stale handle; the caller moves
+    // the last row of every component array into it
+    int destroy(const EntityHandle &handle);
+
+    int row(const EntityHandle &handle) const;
+    unsigned int size() const { return static_cast<unsigned int>(m_rowSlots.size()); }
+    void clear();
+};
+
+// Textured cubes, one row per cube in every array
+struct CubeComponents
+{
+    TransformsSoA                       transforms;
+    AlignedArray<unsigned int>          materials;
+    BoundsSoA                           bounds;         // world space, kept in step with the transform
+};
+
+// Point lights drawn as lamps
+struct LampComponents
+{
+    AlignedArray<float>                 positionX;
+    AlignedArray<float>                 positionY;
+    AlignedArray<float>                 positionZ;
+    AlignedArray<QVector3D>             ambient;
+    AlignedArray<QVector3D>             diffuse;
+    AlignedArray<QVector3D>             specular;
+    AlignedArray<float>                 constant;
+    AlignedArray<float>                 linear;
+    AlignedArray<float>                 quadratic;
+    AlignedArray<float>                 radius;
+    BoundsSoA                           bounds;         // of the lamp model
+};
+
+// Scene objects as structure of arrays: each component of all cubes (or all
+// lamps) is one dense, cache-aligned array indexed by row, so culling, the
+// transform kernel and light gathering stream through memory in order.
+class SceneStore
+{
+private:
+    EntityTable                         m_cubeEntities;
+    EntityTable                         m_lampEntities;
+public:
+    CubeComponents                      cubes;
+    LampComponents                      lamps;
+
+    // Unit cube, scaled per axis
+    EntityHandle addCube(const QVector3D &position, const QQuaternion &rotation, unsigned int material,
+                         const QVector3D &scale = QVector3D(1.0f, 1.0f, 1.0f));
+    bool removeCube(const EntityHandle &handle);
+    int cubeRow(const EntityHandle &handle) const { return m_cubeEntities.row(handle); }
+    unsigned int cubeCount() const { return m_cubeEntities.size(); }
+    QVector3D cubePosition(unsigned int row) const;
+
+    EntityHandle addLamp(const PointLight &light, float lampHalfSize);
+    bool removeLamp(const EntityHandle &handle);
+    int lampRow(const EntityHandle &handle) const { return m_lampEntities.row(handle); }
+    unsigned int lampCount() const { return m_lampEntities.size(); }
+    QVector3D lampPosition(unsigned int row) const;
+    // Appends every lamp's light to p_lights, in row order
+    void gatherLights(std::vector<PointLight> *p_lights) const;
+
+    void clear();
+};
+
+#endif // SCENE_STORE_H
@@ -0,0 +1,126 @@
+#include "shader_cache.h"
+
+#include <QOpenGLContext>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QFile>
+#include <QDir>
+#include <QtDebug>
+
+#include <cstring>
+
+namespace
+{
+    // Bump when the file layout changes
+    const char          cm_cacheVersion[] = "ShaderCache v1";
+}
+
+ShaderCache::ShaderCache()
+    : mp_functions(QOpenGLContext::currentContext()->extraFunctions()),
+      m_directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QString("/shaders"))
+{
+    QOpenGLContext *p_context = QOpenGLContext::currentContext();
+    QSurfaceFormat format = p_context->format();
+    bool binariesInCore = format.majorVersion() > 4 || (format.majorVersion() == 4 && format.minorVersion() >= 1);
+
+    GLint formatsCount = 0;
+    if (binariesInCore || p_context->hasExtension(QByteArrayLiteral("GL_ARB_get_program_binary")))
+        mp_functions->glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatsCount);
+    m_supported = formatsCount > 0 && QDir().mkpath(m_directory);
+
+    m_driverString = QByteArray(reinterpret_cast<const char*>(mp_functions->glGetString(GL_VENDOR))) + '\n' +
+                     QByteArray(reinterpret_cast<const char*>(mp_functions->glGetString(GL_RENDERER))) + '\n' +
+                     QByteArray(reinterpret_cast<const char*>(mp_functions->glGetString(GL_VERSION)));
+
+    if (!m_supported)
+        qDebug() << "Program binaries are not supported, shaders will be compiled on every start";
+}
+
+QByteArray ShaderCache::key(const QByteArray &vertexSource, const QByteArray &fragmentSource,
+                            const QByteArray &defines) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (const QByteArray &part: {QByteArray(cm_cacheVersion), m_driverString, defines, vertexSource, fragmentSource})
+    {
+        hash.addData(part);
+        hash.addData("\0", 1);
+    }
+    return hash.result().toHex();
+}
+
+QString ShaderCache::fileName(const QByteArray &key) const
+{
+    return m_directory + QString("/") + QString(key) + QString(".bin");
+}
+
+bool ShaderCache::load(QOpenGLShaderProgram *p_program, const QByteArray &key)
+{
+    if (!m_supported)
+        return false;
+
+    QFile file(fileName(key));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        m_misses++;
+        return false;
+    }
+    QByteArray data = file.readAll();
+    file.close();
+
+    // [GLenum binary format][binary]
+    if (data.size() <= static_cast<int>(sizeof(GLenum)))
+    {
+        m_misses++;
+        return false;
+    }
+    GLenum binaryFormat;
+    std::memcpy(&binaryFormat, data.constData(), sizeof(GLenum));
+
+    p_program->create();
+    mp_functions->glProgramBinary(p_program->programId(), binaryFormat,
+                                  data.constData() + sizeof(GLenum), data.size() - sizeof(GLenum));
+
+    // With no shaders attached link() only checks GL_LINK_STATUS of the loaded binary
+    if (!p_program->link())
+    {
+        // The driver rejected it, e.g. after an update it did not announce in its strings
+        QFile::remove(fileName(key));
+        m_misses++;
+        return false;
+    }
+
+    m_hits++;
+    return true;
+}
+
+void ShaderCache::prepareLink(QOpenGLShaderProgram *p_program)
+{
+    if (!m_supported)
+        return;
+
+    p_program->create();
+    mp_functions->glProgramParameteri(p_program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void ShaderCache::store(QOpenGLShaderProgram *p_program, const QByteArray &key)
+{
+    if (!m_supported || !p_program->isLinked())
+        return;
+
+    GLint length = 0;
+    mp_functions->glGetProgramiv(p_program->programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    QByteArray data(static_cast<int>(sizeof(GLenum)) + length, Qt::Uninitialized);
+    GLenum binaryFormat = 0;
+    mp_functions->glGetProgramBinary(p_program->programId(), length, nullptr, &binaryFormat,
+                                     data.data() + sizeof(GLenum));
+    std::memcpy(data.data(), &binaryFormat, sizeof(GLenum));
+
+    // QSaveFile never leaves a half-written binary behind
+    QSaveFile file(fileName(key));
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+        qDebug() << "Failed to store program binary" << fileName(key);
+}
@@ -0,0 +1,40 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <QOpenGLShaderProgram>
+#include <QOpenGLExtraFunctions>
+#include <QByteArray>
+#include <QString>
+
+// On-disk cache of linked program binaries (glGetProgramBinary / glProgramBinary).
+// Entries are keyed by a hash of the shader sources, the defines and the driver
+// strings, so a driver update or an edited shader simply misses the cache.
+class ShaderCache
+{
+private:
+    QOpenGLExtraFunctions*              mp_functions;
+    QString                             m_directory;
+    QByteArray                          m_driverString;
+    bool                                m_supported = false;
+
+    unsigned int                        m_hits = 0;
+    unsigned int                        m_misses = 0;
+public:
+    ShaderCache();
+
+    QByteArray key(const QByteArray &vertexSource, const QByteArray &fragmentSource,
+                   const QByteArray &defines) const;
+
+    bool load(QOpenGLShaderProgram *p_program, const QByteArray &key);
+    void prepareLink(QOpenGLShaderProgram *p_program);
+    void store(QOpenGLShaderProgram *p_program, const QByteArray &key);
+
+    // False without program binary support; nothing is then counted
+    bool supported() const { return m_supported; }
+    unsigned int hits() const { return m_hits; }
+    unsigned int misses() const { return m_misses; }
+private:
+    QString fileName(const QByteArray &key) const;
+};
+
+#endif // SHADER_CACHE_H
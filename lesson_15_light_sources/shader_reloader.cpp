@@ -0,0 +1,281 @@
+#include "shader_reloader.h"
+
+#include <QOpenGLContext>
+#include <QFileInfo>
+#include <QFile>
+#include <QtDebug>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+ShaderReloader::ShaderReloader(ShaderCache *p_shaderCache)
+    : mp_shaderCache(p_shaderCache)
+{
+    initializeOpenGLFunctions();
+    m_lastChange.start();
+
+    // Let the driver use as many compiler threads as it likes (ARB is the same extension)
+    QOpenGLContext *p_context = QOpenGLContext::currentContext();
+    const char *p_entryPoint = nullptr;
+    if (p_context->hasExtension(QByteArrayLiteral("GL_KHR_parallel_shader_compile")))
+        p_entryPoint = "glMaxShaderCompilerThreadsKHR";
+    else if (p_context->hasExtension(QByteArrayLiteral("GL_ARB_parallel_shader_compile")))
+        p_entryPoint = "glMaxShaderCompilerThreadsARB";
+    if (p_entryPoint)
+    {
+        MaxShaderCompilerThreads p_maxThreads =
+            reinterpret_cast<MaxShaderCompilerThreads>(p_context->getProcAddress(p_entryPoint));
+        if (p_maxThreads)
+        {
+            p_maxThreads(0xFFFFFFFFu);
+            m_parallel = true;
+        }
+    }
+
+    QObject::connect(&m_watcher, &QFileSystemWatcher::fileChanged, [this](const QString &path)
+    {
+        fileChanged(path);
+    });
+    QObject::connect(&m_watcher, &QFileSystemWatcher::directoryChanged, [this](const QString &path)
+    {
+        directoryChanged(path);
+    });
+
+    qDebug() << "Shader hot reload on, parallel compile:" << (m_parallel ? "yes" : "no");
+}
+
+ShaderReloader::~ShaderReloader()
+{
+    for (Job &job: m_jobs)
+        discard(&job);
+}
+
+void ShaderReloader::watch(ShaderVariants *p_variants)
+{
+    m_targets.push_back(p_variants);
+    watchFiles(p_variants->sourceFiles());
+}
+
+void ShaderReloader::watchFiles(const QStringList &files)
+{
+    const QStringList watchedFiles = m_watcher.files();
+    const QStringList watchedDirectories = m_watcher.directories();
+    for (const QString &file: files)
+    {
+        if (!watchedFiles.contains(file) && QFile::exists(file))
+            m_watcher.addPath(file);
+        QString directory = QFileInfo(file).path();
+        if (!watchedDirectories.contains(directory) && !m_watcher.directories().contains(directory))
+            m_watcher.addPath(directory);
+    }
+}
+
+void ShaderReloader::fileChanged(const QString &path)
+{
+    m_changedFiles.insert(path);
+    m_lastChange.restart();
+}
+
+void ShaderReloader::directoryChanged(const QString &path)
+{
+    // A save by rename removes the file from the watcher and creates it again
+    const QStringList watchedFiles = m_watcher.files();
+    for (ShaderVariants *p_variants: m_targets)
+        for (const QString &file: p_variants->sourceFiles())
+            if (QFileInfo(file).path() == path && !watchedFiles.contains(file) && QFile::exists(file))
+            {
+                m_changedFiles.insert(file);
+                m_lastChange.restart();
+            }
+}
+
+bool ShaderReloader::poll()
+{
+    bool replaced = false;
+    if (!m_changedFiles.isEmpty() && m_lastChange.hasExpired(cm_settleTime))
+    {
+        for (ShaderVariants *p_variants: m_targets)
+        {
+            // Re-read the include list, an edit may have added one
+            QStringList files = p_variants->sourceFiles();
+            watchFiles(files);
+
+            bool affected = false;
+            for (const QString &file: files)
+                affected = affected || m_changedFiles.contains(file);
+            if (affected)
+                for (unsigned int features: p_variants->compiledFeatures())
+                    replaced = start(p_variants, features) || replaced;
+        }
+        m_changedFiles.clear();
+    }
+
+    for (size_t i = 0; i < m_jobs.size(); )
+    {
+        JobState state = advance(&m_jobs[i]);
+        if (state == JobRunning)
+        {
+            i++;
+            continue;
+        }
+        replaced = replaced || state == JobReplaced;
+        m_jobs.erase(m_jobs.begin() + i);
+    }
+    return replaced;
+}
+
+bool ShaderReloader::start(ShaderVariants *p_variants, unsigned int features)
+{
+    // A newer edit supersedes a build still in flight
+    for (size_t i = 0; i < m_jobs.size(); i++)
+        if (m_jobs[i].p_variants == p_variants && m_jobs[i].features == features)
+        {
+            discard(&m_jobs[i]);
+            m_jobs.erase(m_jobs.begin() + i);
+            break;
+        }
+
+    const QByteArray defines = ShaderVariants::defines(features);
+    QByteArray sources[2];
+    if (!ShaderSource::load(p_variants->vertexFileName(), defines, &sources[0]) ||
+        !ShaderSource::load(p_variants->fragmentFileName(), defines, &sources[1]))
+    {
+        qDebug().nospace() << "shader reload " << p_variants->label(features) << " skipped, sources unreadable";
+        return false;
+    }
+
+    Job job;
+    job.p_variants = p_variants;
+    job.features = features;
+    job.timer.start();
+    job.compileNs = -1;
+    job.cacheKey = mp_shaderCache->key(sources[0], sources[1], defines);
+    job.p_program = new QOpenGLShaderProgram;
+
+    // An edit that was undone is still in the program cache
+    if (mp_shaderCache->load(job.p_program, job.cacheKey))
+    {
+        p_variants->replace(features, job.p_program);
+        qDebug().nospace() << "shader reload " << p_variants->label(features) << ": restored from the program cache in "
+                           << job.timer.nsecsElapsed() / 1e6 << " ms";
+        return true;
+    }
+
+    job.p_program->create();
+    mp_shaderCache->prepareLink(job.p_program);
+    const GLenum types[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    for (int i = 0; i < 2; i++)
+    {
+        const char *p_text = sources[i].constData();
+        GLint length = sources[i].size();
+        job.shaders[i] = glCreateShader(types[i]);
+        glShaderSource(job.shaders[i], 1, &p_text, &length);
+        glCompileShader(job.shaders[i]);
+        glAttachShader(job.p_program->programId(), job.shaders[i]);
+    }
+    // Returns at once with the parallel extension, the status queries are what would block
+    glLinkProgram(job.p_program->programId());
+    m_jobs.push_back(job);
+    return false;
+}
+
+bool ShaderReloader::completed(GLuint object, bool program)
+{
+    if (!m_parallel)
+        return true;
+    GLint done = GL_FALSE;
+    if (program)
+        glGetProgramiv(object, GL_COMPLETION_STATUS_KHR, &done);
+    else
+        glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &done);
+    return done != GL_FALSE;
+}
+
+QByteArray ShaderReloader::infoLog(GLuint object, bool program)
+{
+    GLint length = 0;
+    if (program)
+        glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+    else
+        glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+    QByteArray log(qMax(length, 1), '\0');
+    if (program)
+        glGetProgramInfoLog(object, length, nullptr, log.data());
+    else
+        glGetShaderInfoLog(object, length, nullptr, log.data());
+    return log;
+}
+
+ShaderReloader::JobState ShaderReloader::advance(Job *p_job)
+{
+    const GLuint program = p_job->p_program->programId();
+    const QString label = p_job->p_variants->label(p_job->features);
+
+    if (p_job->compileNs < 0)
+    {
+        if (!completed(p_job->shaders[0], false) || !completed(p_job->shaders[1], false))
+            return JobRunning;
+
+        bool compiled = true;
+        for (GLuint shader: p_job->shaders)
+        {
+            GLint status = GL_FALSE;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+            if (status == GL_FALSE)
+            {
+                qDebug().nospace() << "shader reload " << label << ": compilation failed, keeping the old program\n"
+                                   << infoLog(shader, false).constData();
+                compiled = false;
+            }
+        }
+        p_job->compileNs = p_job->timer.nsecsElapsed();
+        if (!compiled)
+        {
+            discard(p_job);
+            return JobFailed;
+        }
+    }
+
+    if (!completed(program, true))
+        return JobRunning;
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    const qint64 linkNs = p_job->timer.nsecsElapsed() - p_job->compileNs;
+    if (status == GL_FALSE)
+    {
+        qDebug().nospace() << "shader reload " << label << ": linking failed, keeping the old program\n"
+                           << infoLog(program, true).constData();
+        discard(p_job);
+        return JobFailed;
+    }
+
+    for (GLuint &shader: p_job->shaders)
+    {
+        glDetachShader(program, shader);
+        glDeleteShader(shader);
+        shader = 0;
+    }
+
+    // No shaders added through Qt, so link() only picks up GL_LINK_STATUS
+    p_job->p_program->link();
+    mp_shaderCache->store(p_job->p_program, p_job->cacheKey);
+    p_job->p_variants->replace(p_job->features, p_job->p_program);
+    p_job->p_program = nullptr;
+
+    // With the parallel extension both times are rounded up to the frame that noticed them
+    qDebug().nospace() << "shader reload " << label << ": compile " << p_job->compileNs / 1e6
+                       << " ms, link " << linkNs / 1e6 << " ms"
+                       << (m_parallel ? " (parallel, measured at frame granularity)" : "");
+    return JobReplaced;
+}
+
+void ShaderReloader::discard(Job *p_job)
+{
+    for (GLuint shader: p_job->shaders)
+        if (shader != 0)
+            glDeleteShader(shader);
+    delete p_job->p_program;
+    p_job->p_program = nullptr;
+}
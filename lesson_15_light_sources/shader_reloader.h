@@ -0,0 +1,82 @@
+#ifndef SHADER_RELOADER_H
+#define SHADER_RELOADER_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLShaderProgram>
+#include <QFileSystemWatcher>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QString>
+
+#include <vector>
+
+#include <shader_cache.h>
+#include <shader_variants.h>
+
+// Live reload of edited shaders. The sources and includes of every watched
+// ShaderVariants are tracked with a QFileSystemWatcher; once an edit settles,
+// each compiled variant that reads the file is rebuilt as a new program while
+// the old one keeps drawing. With KHR_parallel_shader_compile the driver
+// compiles on its own threads and poll() only checks the completion status;
+// without it the build finishes inside one poll(). A program replaces the old
+// one only after it linked, so a broken edit just logs the errors.
+class ShaderReloader : protected QOpenGLFunctions_3_3_Core
+{
+private:
+    enum JobState
+    {
+        JobRunning,
+        JobReplaced,
+        JobFailed
+    };
+
+    struct Job
+    {
+        ShaderVariants*                 p_variants;
+        unsigned int                    features;
+        QOpenGLShaderProgram*           p_program;
+        GLuint                          shaders[2];
+        QByteArray                      cacheKey;
+        QElapsedTimer                   timer;
+        qint64                          compileNs;      // -1 until both shaders are compiled
+    };
+
+    typedef void (QOPENGLF_APIENTRYP MaxShaderCompilerThreads)(GLuint count);
+
+    // Editors save in several steps; wait for the last one
+    static const qint64                 cm_settleTime = 100;
+
+    ShaderCache*                        mp_shaderCache;
+    QFileSystemWatcher                  m_watcher;
+    std::vector<ShaderVariants*>        m_targets;
+    QSet<QString>                       m_changedFiles;
+    QElapsedTimer                       m_lastChange;
+    std::vector<Job>                    m_jobs;
+    bool                                m_parallel = false;
+public:
+    explicit ShaderReloader(ShaderCache *p_shaderCache);
+    ~ShaderReloader();
+
+    void watch(ShaderVariants *p_variants);
+
+    // Once per frame with the context current. Starts builds for settled edits and
+    // swaps in the programs that linked; true when a program was replaced, which
+    // leaves the GLStateCache stale.
+    bool poll();
+
+    bool parallel() const { return m_parallel; }
+    size_t pending() const { return m_jobs.size(); }
+    // An edit is settling or a build is running, poll() has work to do
+    bool busy() const { return !m_changedFiles.isEmpty() || !m_jobs.empty(); }
+private:
+    void fileChanged(const QString &path);
+    void directoryChanged(const QString &path);
+    void watchFiles(const QStringList &files);
+    bool start(ShaderVariants *p_variants, unsigned int features);
+    JobState advance(Job *p_job);
+    void discard(Job *p_job);
+    bool completed(GLuint object, bool program);
+    QByteArray infoLog(GLuint object, bool program);
+};
+
+#endif // SHADER_RELOADER_H
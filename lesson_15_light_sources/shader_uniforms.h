@@ -0,0 +1,39 @@
+#ifndef SHADER_UNIFORMS_H
+#define SHADER_UNIFORMS_H
+
+// Handles into the UniformBinding of each program, resolved once after linking.
+// Camera and light parameters live in the shared uniform blocks instead.
+
+struct LightCasterUniforms
+{
+    int     model = -1;
+    int     normalMatrix = -1;
+    int     layers = -1;
+
+    int     materialDiffuse = -1;
+    int     materialSpecular = -1;
+    int     materialShininess = -1;
+
+    int     pointLightData = -1;
+    int     clusterData = -1;
+    int     clusterLightIndices = -1;
+};
+
+// Either deferred light program; pointLightData is only active in the point light one
+struct DeferredLightUniforms
+{
+    int     gAlbedoSpecular = -1;
+    int     gNormal = -1;
+    int     gDepth = -1;
+    int     inverseViewProjection = -1;
+    int     shininess = -1;
+
+    int     pointLightData = -1;
+};
+
+struct LampUniforms
+{
+    int     model = -1;
+};
+
+#endif // SHADER_UNIFORMS_H
@@ -0,0 +1,206 @@
+#include "shader_variants.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QtDebug>
+
+namespace
+{
+    const char* const   cm_featureNames[ShaderFeaturesCount] = {"INSTANCED", "SPOT_LIGHT"};
+
+    bool expand(const QString &fileName, QByteArray *p_output, QStringList *p_files)
+    {
+        if (p_files->contains(fileName))
+            return true;
+
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            qDebug() << "Shader source opening failed:" << fileName;
+            return false;
+        }
+        p_files->append(fileName);
+
+        const QString directory = QFileInfo(fileName).path();
+        for (const QByteArray &line: file.readAll().split('\n'))
+        {
+            const QByteArray directive = line.trimmed();
+            if (!directive.startsWith("#include"))
+            {
+                p_output->append(line);
+                p_output->append('\n');
+                continue;
+            }
+
+            int open = directive.indexOf('"');
+            int close = directive.lastIndexOf('"');
+            if (open < 0 || close <= open)
+            {
+                qDebug() << "Malformed #include in" << fileName << ":" << directive;
+                return false;
+            }
+            QString included = directory + QString("/") + QString::fromUtf8(directive.mid(open + 1, close - open - 1));
+            if (!expand(QDir::cleanPath(included), p_output, p_files))
+                return false;
+        }
+        return true;
+    }
+}
+
+bool ShaderSource::load(const QString &fileName, const QByteArray &defines, QByteArray *p_source,
+                        QStringList *p_files)
+{
+    QStringList files;
+    QByteArray source;
+    if (!expand(QDir::cleanPath(fileName), &source, &files))
+        return false;
+
+    // #version has to stay the first directive
+    int version = source.indexOf("#version");
+    int position = 0;
+    if (version >= 0)
+    {
+        position = source.indexOf('\n', version);
+        position = position < 0 ? source.size() : position + 1;
+    }
+    source.insert(position, defines);
+
+    *p_source = source;
+    if (p_files)
+        *p_files = files;
+    return true;
+}
+
+ShaderVariants::ShaderVariants(const QString &vertexFileName, const QString &fragmentFileName,
+                               unsigned int featureMask, const PipelineState::Description &pipeline,
+                               const LoadFunction &load, const SetupFunction &setup)
+    : m_vertexFileName(vertexFileName),
+      m_fragmentFileName(fragmentFileName),
+      m_featureMask(featureMask),
+      m_pipeline(pipeline),
+      m_load(load),
+      m_setup(setup)
+{
+}
+
+ShaderVariants::~ShaderVariants()
+{
+    for (auto &entry: m_variants)
+    {
+        delete entry.second.p_pipeline;
+        delete entry.second.p_uniforms;
+        delete entry.second.p_program;
+    }
+}
+
+QByteArray ShaderVariants::defines(unsigned int features)
+{
+    QByteArray text;
+    for (int bit = 0; bit < ShaderFeaturesCount; bit++)
+        if (features & (1u << bit))
+            text += QByteArray("#define ") + cm_featureNames[bit] + QByteArray(" 1\n");
+    return text;
+}
+
+QString ShaderVariants::label(unsigned int features) const
+{
+    QString names;
+    for (int bit = 0; bit < ShaderFeaturesCount; bit++)
+        if (features & m_featureMask & (1u << bit))
+            names += (names.isEmpty() ? QString() : QString(" ")) + QString(cm_featureNames[bit]);
+    return QFileInfo(m_vertexFileName).fileName() + QString(" + ") + QFileInfo(m_fragmentFileName).fileName() +
+           QString(" [") + names + QString("]");
+}
+
+void ShaderVariants::setUp(QOpenGLShaderProgram *p_program, Variant *p_variant)
+{
+    p_variant->p_program = p_program;
+    p_variant->p_uniforms = new UniformBinding(p_program);
+    m_setup(p_program, p_variant->p_uniforms);
+
+    PipelineState::Description pipeline = m_pipeline;
+    pipeline.program = p_program->programId();
+    p_variant->p_pipeline = new PipelineState(pipeline);
+}
+
+const ShaderVariants::Variant& ShaderVariants::variant(unsigned int features)
+{
+    features &= m_featureMask;
+    auto found = m_variants.find(features);
+    if (found != m_variants.end())
+        return found->second;
+
+    // Either a cache hit or a full compile and link, the load function decides
+    QElapsedTimer timer;
+    timer.start();
+    Variant created;
+    setUp(m_load(m_vertexFileName, m_fragmentFileName, defines(features)), &created);
+    qDebug().nospace() << "shader variant " << label(features) << " ready in " << timer.nsecsElapsed() / 1e6 << " ms";
+
+    return m_variants.emplace(features, created).first->second;
+}
+
+void ShaderVariants::replace(unsigned int features, QOpenGLShaderProgram *p_program)
+{
+    features &= m_featureMask;
+    Variant &variant = m_variants[features];
+    delete variant.p_pipeline;
+    delete variant.p_uniforms;
+    delete variant.p_program;
+    setUp(p_program, &variant);
+}
+
+QStringList ShaderVariants::sourceFiles() const
+{
+    // Includes are expanded regardless of #ifdef, so the file set is the same for every variant
+    QStringList files;
+    for (const QString &fileName: {m_vertexFileName, m_fragmentFileName})
+    {
+        QByteArray source;
+        QStringList read;
+        ShaderSource::load(fileName, QByteArray(), &source, &read);
+        for (const QString &file: read)
+            if (!files.contains(file))
+                files.append(file);
+    }
+    return files;
+}
+
+std::vector<unsigned int> ShaderVariants::compiledFeatures() const
+{
+    std::vector<unsigned int> features;
+    for (const auto &entry: m_variants)
+        features.push_back(entry.first);
+    return features;
+}
+
+void ShaderVariants::compileAll()
+{
+    // Every subset of the mask
+    for (unsigned int features = m_featureMask; ; features = (features - 1) & m_featureMask)
+    {
+        variant(features);
+        if (features == 0)
+            break;
+    }
+}
+
+UniformStats ShaderVariants::uniformStats() const
+{
+    UniformStats stats;
+    for (const auto &entry: m_variants)
+    {
+        stats.lookups += entry.second.p_uniforms->stats().lookups;
+        stats.uploads += entry.second.p_uniforms->stats().uploads;
+        stats.skipped += entry.second.p_uniforms->stats().skipped;
+    }
+    return stats;
+}
+
+void ShaderVariants::resetStats()
+{
+    for (auto &entry: m_variants)
+        entry.second.p_uniforms->resetStats();
+}
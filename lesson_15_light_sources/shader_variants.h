@@ -0,0 +1,91 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <QOpenGLShaderProgram>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+#include <map>
+#include <vector>
+
+#include <gl_state_cache.h>
+#include <uniform_binding.h>
+
+namespace ShaderSource
+{
+    // Reads a GLSL file and expands #include "file" lines, relative to the including
+    // file; every file is pasted once, like #pragma once. The defines are inserted
+    // right after #version. The files read go to p_files when it is given.
+    bool load(const QString &fileName, const QByteArray &defines, QByteArray *p_source,
+              QStringList *p_files = nullptr);
+}
+
+// Compile-time switches of the light programs. Each combination is its own program,
+// so a disabled feature costs the fragment shader nothing, not even a branch.
+enum ShaderFeature
+{
+    InstancedFeature = 1 << 0,      // INSTANCED: model matrices and layers come per instance
+    SpotLightFeature = 1 << 1,      // SPOT_LIGHT: the torch is evaluated
+    ShaderFeaturesCount = 2
+};
+
+// Every permutation of one vertex/fragment pair. A variant is compiled on first use
+// (or by compileAll()) through the given load function, which is expected to go
+// through the ShaderCache, and keeps its own UniformBinding and PipelineState.
+// The setup function resolves the uniforms of a new variant; as long as it resolves
+// them in a fixed order the handles are the same for every variant.
+class ShaderVariants
+{
+public:
+    struct Variant
+    {
+        QOpenGLShaderProgram*           p_program = nullptr;
+        UniformBinding*                 p_uniforms = nullptr;
+        PipelineState*                  p_pipeline = nullptr;
+    };
+
+    typedef std::function<QOpenGLShaderProgram*(const QString &vertexFileName, const QString &fragmentFileName,
+                                                const QByteArray &defines)> LoadFunction;
+    typedef std::function<void(QOpenGLShaderProgram *p_program, UniformBinding *p_uniforms)> SetupFunction;
+private:
+    QString                             m_vertexFileName;
+    QString                             m_fragmentFileName;
+    unsigned int                        m_featureMask;
+    PipelineState::Description          m_pipeline;
+    LoadFunction                        m_load;
+    SetupFunction                       m_setup;
+    std::map<unsigned int, Variant>     m_variants;     // by feature bits
+public:
+    ShaderVariants(const QString &vertexFileName, const QString &fragmentFileName, unsigned int featureMask,
+                   const PipelineState::Description &pipeline, const LoadFunction &load, const SetupFunction &setup);
+    ~ShaderVariants();
+
+    // Features outside the mask of this pair are ignored
+    const Variant& variant(unsigned int features);
+    // Compiles every permutation up front, so toggling a feature never stalls a frame
+    void compileAll();
+    // Swaps in a program built elsewhere (see ShaderReloader); the old program, its
+    // binding and its pipeline are deleted, so GLStateCache::invalidate() has to follow
+    void replace(unsigned int features, QOpenGLShaderProgram *p_program);
+
+    const QString& vertexFileName() const { return m_vertexFileName; }
+    const QString& fragmentFileName() const { return m_fragmentFileName; }
+    // Both sources and everything they include
+    QStringList sourceFiles() const;
+    std::vector<unsigned int> compiledFeatures() const;
+
+    // "#define INSTANCED 1\n..." for the given bits; also the variant part of the cache key
+    static QByteArray defines(unsigned int features);
+    // "light_casters.vs + light_casters.fs [INSTANCED SPOT_LIGHT]", for the log
+    QString label(unsigned int features) const;
+
+    size_t compiled() const { return m_variants.size(); }
+    UniformStats uniformStats() const;
+    void resetStats();
+private:
+    void setUp(QOpenGLShaderProgram *p_program, Variant *p_variant);
+};
+
+#endif // SHADER_VARIANTS_H
@@ -0,0 +1,7 @@
+// Блок камеры, общий для всех программ (см. CameraBlock в uniform_blocks.h)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
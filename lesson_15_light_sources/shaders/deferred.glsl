@@ -0,0 +1,16 @@
+// Входы световых проходов: текстуры G-буфера и обратная матрица для восстановления координат
+#include "gbuffer.glsl"
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform float shininess;
+
+// Мировые координаты фрагмента восстанавливаются по глубине
+vec3 WorldPosition(float depth)
+{
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec4 position = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
@@ -0,0 +1,78 @@
+#version 330 core
+// Полноэкранный проход: направленный свет и фонарик для каждого видимого пикселя
+out vec4 FragColor;
+
+#include "camera.glsl"
+#include "lights.glsl"
+#include "deferred.glsl"
+
+// Прототипы функций
+vec3 CalcDirLight(DirLight light, vec3 albedo, float specularity, vec3 normal, vec3 viewDir);
+vec3 CalcSpotLight(SpotLight light, vec3 albedo, float specularity, vec3 normal, vec3 fragPos, vec3 viewDir);
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // Фон остаётся цветом очистки
+    if (depth == 1.0)
+        discard;
+
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, pixel, 0);
+    vec3 norm = DecodeNormal(texelFetch(gNormal, pixel, 0).rg);
+    vec3 fragPos = WorldPosition(depth);
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    vec3 result = CalcDirLight(dirLight, albedoSpecular.rgb, albedoSpecular.a, norm, viewDir);
+    if (spotLight.activated == true)
+        result += CalcSpotLight(spotLight, albedoSpecular.rgb, albedoSpecular.a, norm, fragPos, viewDir);
+
+    FragColor = vec4(result, 1.0);
+}
+
+// Вычисляем цвет при использовании направленного света
+vec3 CalcDirLight(DirLight light, vec3 albedo, float specularity, vec3 normal, vec3 viewDir)
+{
+    vec3 lightDir = normalize(-light.direction);
+
+    // Диффузное затенение
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // Отраженное затенение
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    // Совмещаем результаты
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularity;
+    return (ambient + diffuse + specular);
+}
+
+// Вычисляем цвет при использовании прожектора
+vec3 CalcSpotLight(SpotLight light, vec3 albedo, float specularity, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+
+    // Диффузное затенение
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // Отраженное затенение
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    // Затухание
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+    // Интенсивность прожектора
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+
+    // Совмещаем результаты
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularity;
+    return (ambient + diffuse + specular) * attenuation * intensity;
+}
@@ -0,0 +1,47 @@
+#version 330 core
+// Точечный источник: затеняются только пиксели его прямоугольника, результаты складываются смешиванием
+out vec4 FragColor;
+
+flat in int LightIndex;
+
+#include "camera.glsl"
+#include "lights.glsl"
+#include "deferred.glsl"
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0)
+        discard;
+
+    vec3 fragPos = WorldPosition(depth);
+    PointLight light = FetchPointLight(LightIndex);
+    float distance = length(light.position - fragPos);
+    // Прямоугольник шире сферы: углы отсекаем здесь
+    if (distance >= light.radius)
+        discard;
+
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, pixel, 0);
+    vec3 normal = DecodeNormal(texelFetch(gNormal, pixel, 0).rg);
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 lightDir = (light.position - fragPos) / distance;
+
+    // Диффузное затенение
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // Отраженное затенение
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    // Затухание, как в light_casters.fs сведённое к нулю на радиусе
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    float fade = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+    attenuation *= fade * fade;
+
+    // Совмещаем результаты
+    vec3 ambient = light.ambient * albedoSpecular.rgb;
+    vec3 diffuse = light.diffuse * diff * albedoSpecular.rgb;
+    vec3 specular = light.specular * spec * albedoSpecular.a;
+    FragColor = vec4((ambient + diffuse + specular) * attenuation, 1.0);
+}
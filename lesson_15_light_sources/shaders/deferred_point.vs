@@ -0,0 +1,13 @@
+#version 330 core
+// Прямоугольник источника на экране: проекция его сферы, как у ножниц, но одним вызовом на все источники
+layout (location = 0) in vec4 aRect;          // xmin, ymin, xmax, ymax в NDC
+layout (location = 1) in float aLightIndex;
+
+flat out int LightIndex;
+
+void main()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    LightIndex = int(aLightIndex);
+    gl_Position = vec4(mix(aRect.xy, aRect.zw, corner), 0.0, 1.0);
+}
@@ -0,0 +1,26 @@
+#version 330 core
+// Проход G-буфера: вместо освещения сохраняем всё, что нужно световым проходам
+layout (location = 0) out vec4 AlbedoSpecular;  // RGBA8: диффузный цвет и яркость зеркальной карты
+layout (location = 1) out vec2 EncodedNormal;   // RG16F: нормаль в октаэдрической развёртке
+
+struct Material {
+    sampler2DArray diffuse;
+    sampler2DArray specular;
+};
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+flat in vec2 Layers;
+
+#include "gbuffer.glsl"
+
+uniform Material material;
+
+void main()
+{
+    vec3 specular = texture(material.specular, vec3(TexCoords, Layers.y)).rgb;
+    AlbedoSpecular.rgb = texture(material.diffuse, vec3(TexCoords, Layers.x)).rgb;
+    AlbedoSpecular.a = dot(specular, vec3(0.2126, 0.7152, 0.0722));
+    EncodedNormal = EncodeNormal(normalize(Normal));
+}
@@ -2,64 +2,36 @@
 out vec4 FragColor;
 
 struct Material {
-    sampler2D diffuse;
-    sampler2D specular;
+    sampler2DArray diffuse;
+    sampler2DArray specular;
     float shininess;
 };
 
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight {
-    vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    bool activated;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-#define NR_POINT_LIGHTS 4
+#include "camera.glsl"
+#include "lights.glsl"
 
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+flat in vec2 Layers;    // слои диффузной и зеркальной карт в массивах текстур
+
+// Кластерная сетка: экран разбит на тайлы, глубина - на экспоненциальные срезы
+layout (std140) uniform Clusters
+{
+    uvec4 clusterGrid;      // тайлы по X, тайлы по Y, срезы, число источников
+    vec4 clusterParams;     // масштаб и смещение среза, ширина и высота тайла в пикселях
+};
+
+uniform usamplerBuffer clusterData;         // смещение и число источников кластера
+uniform usamplerBuffer clusterLightIndices;
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-uniform SpotLight spotLight;
 uniform Material material;
 
 // Прототипы функций
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+uvec2 FragmentCluster();
 
 void main()
 {
@@ -76,17 +48,32 @@ void main()
     // Этап №1: Направленное освещение
     vec3 result = CalcDirLight(dirLight, norm, viewDir);
 
-    // Этап №2: Точечные источники света
-    for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+    // Этап №2: Точечные источники света, только те, что задевают кластер фрагмента
+    uvec2 cluster = FragmentCluster();
+    for(uint i = 0u; i < cluster.y; i++)
+    {
+        int index = int(texelFetch(clusterLightIndices, int(cluster.x + i)).r);
+        result += CalcPointLight(FetchPointLight(index), norm, FragPos, viewDir);
+    }
 
-    // Этап №3: Прожектор
-    if (spotLight.activated == true)
-        result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
+    // Этап №3: Прожектор, есть только в варианте программы с SPOT_LIGHT
+#ifdef SPOT_LIGHT
+    result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
+#endif
 
     FragColor = vec4(result, 1.0);
 }
 
+// Смещение и длина списка источников кластера, в котором лежит фрагмент
+uvec2 FragmentCluster()
+{
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+    uint slice = uint(max(log(depth) * clusterParams.x + clusterParams.y, 0.0));
+    uvec3 cell = min(uvec3(uvec2(gl_FragCoord.xy / clusterParams.zw), slice), clusterGrid.xyz - 1u);
+    int index = int(cell.x + clusterGrid.x * (cell.y + clusterGrid.y * cell.z));
+    return texelFetch(clusterData, index).rg;
+}
+
 // Вычисляем цвет при использовании направленного света
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 {
@@ -100,9 +87,9 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 
     // Совмещаем результаты
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * vec3(texture(material.diffuse, vec3(TexCoords, Layers.x)));
+    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vec3(TexCoords, Layers.x)));
+    vec3 specular = light.specular * spec * vec3(texture(material.specular, vec3(TexCoords, Layers.y)));
     return (ambient + diffuse + specular);
 }
 
@@ -118,14 +105,16 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 
-    // Затухание
+    // Затухание, плавно сведённое к нулю на радиусе, по которому источник попал в кластеры
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    float fade = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+    attenuation *= fade * fade;
 
     // Совмещаем результаты
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * vec3(texture(material.diffuse, vec3(TexCoords, Layers.x)));
+    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vec3(TexCoords, Layers.x)));
+    vec3 specular = light.specular * spec * vec3(texture(material.specular, vec3(TexCoords, Layers.y)));
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -154,9 +143,9 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
 
     // Совмещаем результаты
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * vec3(texture(material.diffuse, vec3(TexCoords, Layers.x)));
+    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, vec3(TexCoords, Layers.x)));
+    vec3 specular = light.specular * spec * vec3(texture(material.specular, vec3(TexCoords, Layers.y)));
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
@@ -2,19 +2,33 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aInstanceModel;
+layout (location = 7) in mat3 aInstanceNormalMatrix;
+layout (location = 10) in vec2 aInstanceLayers;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+flat out vec2 Layers;
+
+#include "camera.glsl"
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix;
+uniform vec2 layers;
 
 void main()
 {
+    // Матрицы берутся из атрибутов экземпляра или из uniform, в зависимости от варианта программы
+#ifdef INSTANCED
+    FragPos = vec3(aInstanceModel * vec4(aPos, 1.0));
+    Normal = aInstanceNormalMatrix * aNormal;
+    Layers = aInstanceLayers;
+#else
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = normalMatrix * aNormal;
+    Layers = layers;
+#endif
     TexCoords = aTexCoords;
 
     gl_Position = projection * view * vec4(FragPos, 1.0);
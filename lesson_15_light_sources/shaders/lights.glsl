@@ -0,0 +1,54 @@
+// Члены структур упорядочены под std140 (см. uniform_blocks.h)
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// Точечные источники хранятся в буфере текстуры, по 4 текселя на источник (см. clustered_lighting.cpp)
+struct PointLight {
+    vec3 position;
+    float radius;
+
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    vec3 specular;
+    float quadratic;
+};
+
+struct SpotLight {
+    vec3 position;
+    float cutOff;
+    vec3 direction;
+    float outerCutOff;
+
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    vec3 specular;
+    float quadratic;
+
+    bool activated;
+};
+
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    SpotLight spotLight;
+};
+
+uniform samplerBuffer pointLightData;
+
+PointLight FetchPointLight(int index)
+{
+    vec4 texel0 = texelFetch(pointLightData, 4 * index);
+    vec4 texel1 = texelFetch(pointLightData, 4 * index + 1);
+    vec4 texel2 = texelFetch(pointLightData, 4 * index + 2);
+    vec4 texel3 = texelFetch(pointLightData, 4 * index + 3);
+    return PointLight(texel0.xyz, texel0.w, texel1.xyz, texel1.w, texel2.xyz, texel2.w, texel3.xyz, texel3.w);
+}
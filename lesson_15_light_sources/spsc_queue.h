@@ -0,0 +1,49 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each side owns one index and only reads the other's, so push() and
+// pop() are a load, a copy and a release store, with no locks or CAS loops.
+// The indices are padded a cache line apart so the two threads never share one;
+// padding rather than alignas keeps the owner free of over-aligned new under C++11.
+template <class T, size_t Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+private:
+    static const size_t                 cm_cacheLine = 64;
+
+    char                                m_headPadding[cm_cacheLine];
+    std::atomic<size_t>                 m_head{0};          // next slot to read, written by the consumer
+    char                                m_tailPadding[cm_cacheLine - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t>                 m_tail{0};          // next slot to write, written by the producer
+    char                                m_slotsPadding[cm_cacheLine - sizeof(std::atomic<size_t>)];
+    T                                   m_slots[Capacity];
+public:
+    // Producer side; false when the queue is full
+    bool push(const T &value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        m_slots[tail & (Capacity - 1)] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; false when the queue is empty
+    bool pop(T *p_value)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        *p_value = m_slots[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif // SPSC_QUEUE_H
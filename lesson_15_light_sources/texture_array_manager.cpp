@@ -0,0 +1,213 @@
+#include "texture_array_manager.h"
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtDebug>
+
+#include <algorithm>
+
+namespace
+{
+    // Same neutral grey as the TextureLoader placeholder
+    const unsigned char cm_placeholder[4] = {128, 128, 128, 255};
+}
+
+TextureArrayManager::TextureArrayManager(UploadThread *p_uploadThread)
+    : mp_uploadThread(p_uploadThread)
+{
+    initializeOpenGLFunctions();
+
+    glGenTextures(1, &m_placeholder);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_placeholder);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, cm_placeholder);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+TextureArrayManager::~TextureArrayManager()
+{
+    for (Entry &entry: m_entries)
+        if (entry.loading)
+            entry.future.waitForFinished();
+
+    for (SizeClass &sizeClass: m_classes)
+    {
+        if (sizeClass.target != sizeClass.array)
+            glDeleteTextures(1, &sizeClass.target);
+        glDeleteTextures(1, &sizeClass.array);
+    }
+    glDeleteTextures(1, &m_placeholder);
+}
+
+unsigned int TextureArrayManager::request(const QString &fileName)
+{
+    // The same file requested twice shares one layer
+    for (unsigned int handle = 0; handle < m_entries.size(); ++handle)
+        if (m_entries[handle].fileName == fileName)
+            return handle;
+
+    Entry entry;
+    entry.fileName = fileName;
+    entry.future = QtConcurrent::run(&BakedTexture::load, fileName);
+    m_entries.push_back(entry);
+    ++m_loading;
+    return unsigned(m_entries.size() - 1);
+}
+
+int TextureArrayManager::findSizeClass(const BakedTexture &image)
+{
+    for (size_t i = 0; i < m_classes.size(); ++i)
+        if (m_classes[i].width == image.width() && m_classes[i].height == image.height() &&
+            m_classes[i].channels == image.channels())
+            return int(i);
+
+    SizeClass sizeClass;
+    sizeClass.width = image.width();
+    sizeClass.height = image.height();
+    sizeClass.channels = image.channels();
+    m_classes.push_back(sizeClass);
+    return int(m_classes.size() - 1);
+}
+
+bool TextureArrayManager::poll()
+{
+    // Layers and arrays the upload thread completed since the last call
+    bool changed = m_changed;
+    m_changed = false;
+    if (m_loading == 0)
+        return changed;
+
+    for (Entry &entry: m_entries)
+    {
+        if (!entry.loading || !entry.future.isFinished())
+            continue;
+
+        entry.loading = false;
+        --m_loading;
+        entry.p_image = entry.future.result();
+        entry.future = QFuture<std::shared_ptr<BakedTexture>>();
+        if (!entry.p_image)
+        {
+            qDebug() << "Failed to load texture!" << entry.fileName;
+            continue;
+        }
+
+        entry.sizeClass = findSizeClass(*entry.p_image);
+        SizeClass &sizeClass = m_classes[size_t(entry.sizeClass)];
+        entry.layer = unsigned(sizeClass.members.size());
+        sizeClass.members.push_back(unsigned(&entry - m_entries.data()));
+
+        // Growing rebuilds the whole size class in a new array, the old one is still
+        // sampled meanwhile. Capacity doubles, so each layer is re-uploaded O(1)
+        // times on average.
+        if (sizeClass.members.size() > sizeClass.capacity)
+            submit(unsigned(entry.sizeClass), sizeClass.members, true);
+        else
+            submit(unsigned(entry.sizeClass), {sizeClass.members.back()}, false);
+    }
+    return changed;
+}
+
+void TextureArrayManager::submit(unsigned int sizeClassIndex, const std::vector<unsigned int> &members, bool grow)
+{
+    SizeClass &sizeClass = m_classes[sizeClassIndex];
+    if (grow)
+    {
+        // The name is shared, the upload thread creates the storage behind it
+        sizeClass.capacity = std::max(2u, sizeClass.capacity * 2);
+        glGenTextures(1, &sizeClass.target);
+    }
+
+    std::vector<LayerUpload> layers;
+    for (unsigned int member: members)
+        layers.push_back({m_entries[member].p_image, m_entries[member].layer});
+
+    // Jobs run in order, so a layer written into target never precedes its allocation
+    const GLuint target = sizeClass.target;
+    const int width = sizeClass.width, height = sizeClass.height, channels = sizeClass.channels;
+    const unsigned int capacity = sizeClass.capacity;
+    ++m_uploading;
+    mp_uploadThread->submit([=](QOpenGLFunctions_3_3_Core *p_functions, PixelUnpackBuffer *p_unpackBuffer)
+    {
+        if (grow)
+            allocate(p_functions, target, width, height, channels, capacity);
+        for (const LayerUpload &layer: layers)
+            uploadLayer(p_functions, p_unpackBuffer, target, layer);
+    },
+    [this, sizeClassIndex, members, target]()
+    {
+        SizeClass &completed = m_classes[sizeClassIndex];
+        if (completed.array != target)
+        {
+            // Every layer of the old array is in the new one as well
+            if (completed.array)
+                glDeleteTextures(1, &completed.array);
+            completed.array = target;
+        }
+        for (unsigned int member: members)
+            m_entries[member].resident = true;
+        m_layerUploads += unsigned(members.size());
+        m_changed = true;
+
+        if (--m_uploading == 0 && m_loading == 0)
+            qDebug() << "Texture arrays ready:" << m_classes.size() << "arrays," << m_layerUploads << "layer uploads";
+    });
+}
+
+void TextureArrayManager::allocate(QOpenGLFunctions_3_3_Core *p_functions, GLuint array, int width, int height,
+                                   int channels, unsigned int capacity)
+{
+    GLenum format = PixelUnpackBuffer::format(channels);
+    int levels = 0;
+    p_functions->glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+    for ( ; ; width = std::max(1, width / 2), height = std::max(1, height / 2))
+    {
+        p_functions->glTexImage3D(GL_TEXTURE_2D_ARRAY, levels++, GLint(format), width, height, GLsizei(capacity), 0,
+                                  format, GL_UNSIGNED_BYTE, nullptr);
+        if (width == 1 && height == 1)
+            break;
+    }
+
+    if (format == GL_RED)
+    {
+        const GLint swizzle[4] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        p_functions->glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+    p_functions->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    p_functions->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    p_functions->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    p_functions->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    p_functions->glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    p_functions->glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void TextureArrayManager::uploadLayer(QOpenGLFunctions_3_3_Core *p_functions, PixelUnpackBuffer *p_unpackBuffer,
+                                      GLuint array, const LayerUpload &layer)
+{
+    const BakedTexture &image = *layer.p_image;
+    if (!p_unpackBuffer->stage(image))
+        return;
+
+    GLenum format = PixelUnpackBuffer::format(image.channels());
+    const std::vector<BakedTexture::Level> &levels = image.levels();
+
+    p_functions->glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+    for (size_t level = 0; level < levels.size(); ++level)
+        p_functions->glTexSubImage3D(GL_TEXTURE_2D_ARRAY, GLint(level), 0, 0, GLint(layer.layer),
+                                     GLsizei(levels[level].width), GLsizei(levels[level].height), 1,
+                                     format, GL_UNSIGNED_BYTE, p_unpackBuffer->levelOffset(image, level));
+    p_functions->glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    p_unpackBuffer->release();
+}
+
+GLuint TextureArrayManager::array(unsigned int handle) const
+{
+    const Entry &entry = m_entries[handle];
+    return entry.resident ? m_classes[size_t(entry.sizeClass)].array : m_placeholder;
+}
+
+float TextureArrayManager::layer(unsigned int handle) const
+{
+    return float(m_entries[handle].layer);
+}
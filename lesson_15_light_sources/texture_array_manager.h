@@ -0,0 +1,96 @@
+#ifndef TEXTURE_ARRAY_MANAGER_H
+#define TEXTURE_ARRAY_MANAGER_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QFuture>
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+#include <pixel_unpack_buffer.h>
+#include <texture_cache.h>
+#include <upload_thread.h>
+
+// Diffuse and specular texture handles of one surface material
+struct TextureMaterial
+{
+    unsigned int                        diffuse;
+    unsigned int                        specular;
+};
+
+// Packs textures of equal size and format into the layers of one
+// GL_TEXTURE_2D_ARRAY per size class, so objects with different materials can
+// share a bind and be drawn by one call with a per-instance layer index.
+// Images are loaded on the thread pool like in TextureLoader and written into
+// the arrays on the upload thread; until a layer is complete its handle
+// resolves to a 1x1 placeholder array. A growing size class is rebuilt into a
+// new array, which replaces the old one once all its layers are there.
+class TextureArrayManager : protected QOpenGLFunctions_3_3_Core
+{
+private:
+    struct Entry
+    {
+        QString                         fileName;
+        QFuture<std::shared_ptr<BakedTexture>> future;
+        std::shared_ptr<BakedTexture>   p_image;
+        int                             sizeClass = -1;
+        unsigned int                    layer = 0;
+        bool                            loading = true;
+        bool                            resident = false;
+    };
+
+    struct SizeClass
+    {
+        int                             width;
+        int                             height;
+        int                             channels;
+        GLuint                          array = 0;      // sampled by the render thread
+        GLuint                          target = 0;     // written by the newest upload job
+        unsigned int                    capacity = 0;
+        std::vector<unsigned int>       members;
+    };
+
+    // What an upload job needs of an entry, copied so the job never reads m_entries
+    struct LayerUpload
+    {
+        std::shared_ptr<BakedTexture>   p_image;
+        unsigned int                    layer;
+    };
+
+    UploadThread*                       mp_uploadThread;
+    std::vector<Entry>                  m_entries;
+    std::vector<SizeClass>              m_classes;
+    GLuint                              m_placeholder = 0;
+    unsigned int                        m_loading = 0;
+    unsigned int                        m_uploading = 0;
+    unsigned int                        m_layerUploads = 0;
+    bool                                m_changed = false;
+public:
+    explicit TextureArrayManager(UploadThread *p_uploadThread);
+    ~TextureArrayManager();
+
+    unsigned int request(const QString &fileName);
+    // Hands finished loads to the upload thread; returns true when any handle
+    // now resolves to a different array or layer. Call once per frame, after
+    // UploadThread::poll().
+    bool poll();
+
+    GLuint array(unsigned int handle) const;
+    float layer(unsigned int handle) const;
+
+    size_t arrays() const { return m_classes.size(); }
+    bool pending() const { return m_loading > 0 || m_uploading > 0; }
+    unsigned int layerUploads() const { return m_layerUploads; }
+private:
+    int findSizeClass(const BakedTexture &image);
+    void submit(unsigned int sizeClassIndex, const std::vector<unsigned int> &members, bool grow);
+
+    // Upload thread side
+    static void allocate(QOpenGLFunctions_3_3_Core *p_functions, GLuint array, int width, int height,
+                         int channels, unsigned int capacity);
+    static void uploadLayer(QOpenGLFunctions_3_3_Core *p_functions, PixelUnpackBuffer *p_unpackBuffer,
+                            GLuint array, const LayerUpload &layer);
+};
+
+#endif // TEXTURE_ARRAY_MANAGER_H
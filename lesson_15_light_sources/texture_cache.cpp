@@ -0,0 +1,226 @@
+#include "texture_cache.h"
+
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QDir>
+#include <QtDebug>
+
+#include <algorithm>
+#include <cstring>
+
+#include "stb_image.h"
+
+namespace
+{
+    const char          cm_magic[4] = {'Q', 'T', 'X', 'C'};
+    // Bump when the file layout or the filter changes
+    const quint32       cm_version = 1;
+
+    struct FileHeader
+    {
+        char            magic[4];
+        quint32         version;
+        char            sourceHash[20];
+        qint32          width;
+        qint32          height;
+        qint32          channels;
+        qint32          levels;
+        quint32         pad;
+    };
+    static_assert(sizeof(FileHeader) == 48, "FileHeader must match the on-disk layout");
+    static_assert(sizeof(BakedTexture::Level) == 24, "Level must match the on-disk layout");
+
+    QString cacheFileName(const QString &sourceFileName)
+    {
+        QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QString("/textures");
+        QDir().mkpath(directory);
+        QByteArray pathHash = QCryptographicHash::hash(sourceFileName.toUtf8(), QCryptographicHash::Sha1).toHex();
+        return directory + QString("/") + QString(pathHash) + QString(".tex");
+    }
+
+    quint64 alignedOffset(quint64 offset)
+    {
+        return (offset + 7) & ~quint64(7);
+    }
+}
+
+void TextureCache::downsample(const unsigned char *p_source, int width, int height, int channels,
+                              unsigned char *p_destination)
+{
+    const int outWidth = std::max(1, width / 2);
+    const int outHeight = std::max(1, height / 2);
+
+    // Horizontal pass into 16 bit sums (max 255 * 8), then the vertical pass
+    std::vector<unsigned short> rows(size_t(outWidth) * height * channels);
+    for (int y = 0; y < height; ++y)
+    {
+        const unsigned char *p_row = p_source + size_t(y) * width * channels;
+        unsigned short *p_out = rows.data() + size_t(y) * outWidth * channels;
+        for (int x = 0; x < outWidth; ++x)
+        {
+            const int x0 = std::max(2 * x - 1, 0) * channels;
+            const int x1 = std::min(2 * x, width - 1) * channels;
+            const int x2 = std::min(2 * x + 1, width - 1) * channels;
+            const int x3 = std::min(2 * x + 2, width - 1) * channels;
+            for (int c = 0; c < channels; ++c)
+                p_out[x * channels + c] = (unsigned short)(p_row[x0 + c] + 3 * p_row[x1 + c] +
+                                                           3 * p_row[x2 + c] + p_row[x3 + c]);
+        }
+    }
+
+    const size_t stride = size_t(outWidth) * channels;
+    for (int y = 0; y < outHeight; ++y)
+    {
+        const unsigned short *p_r0 = rows.data() + size_t(std::max(2 * y - 1, 0)) * stride;
+        const unsigned short *p_r1 = rows.data() + size_t(std::min(2 * y, height - 1)) * stride;
+        const unsigned short *p_r2 = rows.data() + size_t(std::min(2 * y + 1, height - 1)) * stride;
+        const unsigned short *p_r3 = rows.data() + size_t(std::min(2 * y + 2, height - 1)) * stride;
+        unsigned char *p_out = p_destination + size_t(y) * stride;
+        for (size_t i = 0; i < stride; ++i)
+            p_out[i] = (unsigned char)((p_r0[i] + 3 * p_r1[i] + 3 * p_r2[i] + p_r3[i] + 32) >> 6);
+    }
+}
+
+BakedTexture::~BakedTexture()
+{
+    if (mp_mapped)
+        m_file.unmap(mp_mapped);
+}
+
+std::shared_ptr<BakedTexture> BakedTexture::load(const QString &sourceFileName)
+{
+    // The source is mapped rather than read. It is hashed on every load: the hash
+    // stored in the cache file decides between hit and miss, and a miss bakes it in
+    QFile source(sourceFileName);
+    if (!source.open(QIODevice::ReadOnly))
+        return nullptr;
+    const qint64 sourceSize = source.size();
+    uchar *p_source = source.map(0, sourceSize);
+    if (!p_source)
+        return nullptr;
+
+    QByteArray sourceBytes = QByteArray::fromRawData(reinterpret_cast<const char*>(p_source), int(sourceSize));
+    QByteArray sourceHash = QCryptographicHash::hash(sourceBytes, QCryptographicHash::Sha1);
+
+    std::shared_ptr<BakedTexture> p_texture = std::make_shared<BakedTexture>();
+    QString cacheName = cacheFileName(sourceFileName);
+    if (p_texture->map(cacheName, sourceHash))
+    {
+        source.unmap(p_source);
+        return p_texture;
+    }
+
+    bool baked = p_texture->bake(sourceBytes, sourceHash);
+    source.unmap(p_source);
+    if (!baked)
+        return nullptr;
+
+    QSaveFile cache(cacheName);
+    if (!cache.open(QIODevice::WriteOnly) ||
+        cache.write(reinterpret_cast<const char*>(p_texture->m_storage.data()), qint64(p_texture->m_storage.size())) !=
+            qint64(p_texture->m_storage.size()) ||
+        !cache.commit())
+        qDebug() << "Failed to write texture cache" << cacheName;
+
+    return p_texture;
+}
+
+bool BakedTexture::map(const QString &cacheFileName, const QByteArray &sourceHash)
+{
+    m_file.setFileName(cacheFileName);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 fileSize = m_file.size();
+    if (fileSize < qint64(sizeof(FileHeader)))
+        return false;
+    uchar *p_mapped = m_file.map(0, fileSize);
+    if (!p_mapped)
+        return false;
+
+    // A different source hash means the image was edited since it was baked
+    FileHeader header;
+    std::memcpy(&header, p_mapped, sizeof(header));
+    bool valid = std::memcmp(header.magic, cm_magic, sizeof(cm_magic)) == 0 &&
+                 header.version == cm_version &&
+                 std::memcmp(header.sourceHash, sourceHash.constData(), sizeof(header.sourceHash)) == 0 &&
+                 header.levels > 0 && header.levels <= 32 &&
+                 qint64(sizeof(FileHeader) + header.levels * sizeof(Level)) <= fileSize;
+
+    if (valid)
+    {
+        m_levels.resize(size_t(header.levels));
+        std::memcpy(m_levels.data(), p_mapped + sizeof(FileHeader), m_levels.size() * sizeof(Level));
+        for (const Level &level: m_levels)
+            valid = valid && level.size == quint64(level.width) * level.height * quint64(header.channels) &&
+                    level.offset + level.size <= quint64(fileSize);
+    }
+
+    if (!valid)
+    {
+        m_levels.clear();
+        m_file.unmap(p_mapped);
+        m_file.close();
+        return false;
+    }
+
+    m_width = header.width;
+    m_height = header.height;
+    m_channels = header.channels;
+    mp_mapped = p_mapped;
+    return true;
+}
+
+bool BakedTexture::bake(const QByteArray &source, const QByteArray &sourceHash)
+{
+    int width, height, channels;
+    unsigned char *p_pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(source.constData()),
+                                                    source.size(), &width, &height, &channels, 0);
+    if (!p_pixels)
+        return false;
+
+    // Level table first, so the whole file can be laid out in one allocation
+    int levelCount = 1;
+    for (int size = std::max(width, height); size > 1; size /= 2)
+        ++levelCount;
+
+    m_levels.resize(size_t(levelCount));
+    quint64 offset = alignedOffset(sizeof(FileHeader) + m_levels.size() * sizeof(Level));
+    for (int i = 0; i < levelCount; ++i)
+    {
+        Level &level = m_levels[size_t(i)];
+        level.width = quint32(std::max(1, width >> i));
+        level.height = quint32(std::max(1, height >> i));
+        level.offset = offset;
+        level.size = quint64(level.width) * level.height * quint64(channels);
+        offset = alignedOffset(offset + level.size);
+    }
+    m_storage.assign(size_t(offset), 0);
+
+    FileHeader header = {};
+    std::memcpy(header.magic, cm_magic, sizeof(cm_magic));
+    header.version = cm_version;
+    std::memcpy(header.sourceHash, sourceHash.constData(), sizeof(header.sourceHash));
+    header.width = width;
+    header.height = height;
+    header.channels = channels;
+    header.levels = levelCount;
+    std::memcpy(m_storage.data(), &header, sizeof(header));
+    std::memcpy(m_storage.data() + sizeof(header), m_levels.data(), m_levels.size() * sizeof(Level));
+
+    std::memcpy(m_storage.data() + m_levels[0].offset, p_pixels, size_t(m_levels[0].size));
+    stbi_image_free(p_pixels);
+
+    for (size_t i = 1; i < m_levels.size(); ++i)
+    {
+        const Level &previous = m_levels[i - 1];
+        TextureCache::downsample(m_storage.data() + previous.offset, int(previous.width), int(previous.height),
+                                 channels, m_storage.data() + m_levels[i].offset);
+    }
+
+    m_width = width;
+    m_height = height;
+    m_channels = channels;
+    return true;
+}
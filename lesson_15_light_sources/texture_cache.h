@@ -0,0 +1,60 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <QFile>
+#include <QString>
+#include <QtGlobal>
+
+#include <memory>
+#include <vector>
+
+// Decoded image together with its full mip chain, as stored in the on-disk
+// texture cache. A cache hit keeps the file memory-mapped and data() points
+// straight into the mapping; a miss decodes the source, bakes the mips on the
+// CPU and writes a new cache file for the next start.
+class BakedTexture
+{
+public:
+    struct Level
+    {
+        quint32                         width;
+        quint32                         height;
+        quint64                         offset;     // from data()
+        quint64                         size;
+    };
+private:
+    int                                 m_width = 0;
+    int                                 m_height = 0;
+    int                                 m_channels = 0;
+    std::vector<Level>                  m_levels;
+
+    QFile                               m_file;
+    uchar*                              mp_mapped = nullptr;
+    std::vector<unsigned char>          m_storage;
+public:
+    ~BakedTexture();
+
+    // Returns nullptr when the source can be neither read from the cache nor decoded.
+    // Safe to call from worker threads.
+    static std::shared_ptr<BakedTexture> load(const QString &sourceFileName);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int channels() const { return m_channels; }
+    const std::vector<Level>& levels() const { return m_levels; }
+    const unsigned char* data() const { return mp_mapped ? mp_mapped : m_storage.data(); }
+    bool fromCache() const { return mp_mapped != nullptr; }
+private:
+    bool map(const QString &cacheFileName, const QByteArray &sourceHash);
+    bool bake(const QByteArray &source, const QByteArray &sourceHash);
+};
+
+namespace TextureCache
+{
+    // One 2x reduction with the separable [1 3 3 1] / 8 filter, edges clamped.
+    // Destination size is max(1, size / 2) in each direction.
+    void downsample(const unsigned char *p_source, int width, int height, int channels,
+                    unsigned char *p_destination);
+}
+
+#endif // TEXTURE_CACHE_H
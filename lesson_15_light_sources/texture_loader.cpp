@@ -0,0 +1,112 @@
+#include "texture_loader.h"
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtDebug>
+
+namespace
+{
+    // Neutral grey, so untextured objects stay visible but unobtrusive
+    const unsigned char cm_placeholder[4] = {128, 128, 128, 255};
+}
+
+TextureLoader::TextureLoader(UploadThread *p_uploadThread)
+    : mp_uploadThread(p_uploadThread)
+{
+    initializeOpenGLFunctions();
+}
+
+TextureLoader::~TextureLoader()
+{
+    for (PendingTexture &pending: m_pending)
+        pending.future.waitForFinished();
+}
+
+GLuint TextureLoader::request(const QString &fileName)
+{
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, cm_placeholder);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_pending.push_back({texture, fileName, QtConcurrent::run(&BakedTexture::load, fileName)});
+    return texture;
+}
+
+bool TextureLoader::poll()
+{
+    // Uploads the upload thread finished since the last call
+    bool uploaded = m_uploaded != m_reported;
+    m_reported = m_uploaded;
+    if (m_pending.empty())
+        return uploaded;
+
+    for (size_t i = 0; i < m_pending.size(); )
+    {
+        if (!m_pending[i].future.isFinished())
+        {
+            ++i;
+            continue;
+        }
+
+        std::shared_ptr<BakedTexture> p_image = m_pending[i].future.result();
+        if (p_image)
+        {
+            // The jobs own the image until the texture is complete
+            GLuint texture = m_pending[i].texture;
+            ++m_uploading;
+            mp_uploadThread->submit([texture, p_image](QOpenGLFunctions_3_3_Core *p_functions,
+                                                       PixelUnpackBuffer *p_unpackBuffer)
+            {
+                upload(p_functions, p_unpackBuffer, texture, *p_image);
+            },
+            [this, p_image]()
+            {
+                ++m_uploaded;
+                if (p_image->fromCache())
+                    ++m_cacheHits;
+                if (--m_uploading == 0 && m_pending.empty())
+                    qDebug() << "Textures ready:" << m_uploaded << "uploaded," << m_cacheHits << "from the baked cache";
+            });
+        }
+        else
+        {
+            qDebug() << "Failed to load texture!" << m_pending[i].fileName;
+        }
+
+        m_pending[i] = std::move(m_pending.back());
+        m_pending.pop_back();
+    }
+    return uploaded;
+}
+
+void TextureLoader::upload(QOpenGLFunctions_3_3_Core *p_functions, PixelUnpackBuffer *p_unpackBuffer,
+                           GLuint texture, const BakedTexture &image)
+{
+    if (!p_unpackBuffer->stage(image))
+        return;
+
+    GLenum format = PixelUnpackBuffer::format(image.channels());
+    const std::vector<BakedTexture::Level> &levels = image.levels();
+
+    p_functions->glBindTexture(GL_TEXTURE_2D, texture);
+    if (format == GL_RED)
+    {
+        const GLint swizzle[4] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        p_functions->glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+    for (size_t level = 0; level < levels.size(); ++level)
+        p_functions->glTexImage2D(GL_TEXTURE_2D, GLint(level), GLint(format), GLsizei(levels[level].width),
+                                  GLsizei(levels[level].height), 0, format, GL_UNSIGNED_BYTE,
+                                  p_unpackBuffer->levelOffset(image, level));
+    p_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(levels.size() - 1));
+    p_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    p_functions->glBindTexture(GL_TEXTURE_2D, 0);
+
+    p_unpackBuffer->release();
+}
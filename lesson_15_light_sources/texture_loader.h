@@ -0,0 +1,56 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QFuture>
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+#include <pixel_unpack_buffer.h>
+#include <texture_cache.h>
+#include <upload_thread.h>
+
+// Loads image files on the global thread pool and uploads them through a
+// pixel buffer object on the upload thread once they are ready. request()
+// returns a texture name right away which holds a 1x1 placeholder until the
+// real image arrives. Images come from the baked texture cache, so the mip
+// chain is never generated on the GPU.
+class TextureLoader : protected QOpenGLFunctions_3_3_Core
+{
+private:
+    struct PendingTexture
+    {
+        GLuint                          texture;
+        QString                         fileName;
+        QFuture<std::shared_ptr<BakedTexture>> future;
+    };
+
+    UploadThread*                       mp_uploadThread;
+    std::vector<PendingTexture>         m_pending;
+    unsigned int                        m_uploading = 0;
+
+    unsigned int                        m_uploaded = 0;
+    unsigned int                        m_reported = 0;
+    unsigned int                        m_cacheHits = 0;
+public:
+    explicit TextureLoader(UploadThread *p_uploadThread);
+    ~TextureLoader();
+
+    GLuint request(const QString &fileName);
+    // Hands every decode that has finished to the upload thread and returns true if
+    // any texture received its image since the last call; call once per frame,
+    // after UploadThread::poll()
+    bool poll();
+
+    bool pending() const { return !m_pending.empty() || m_uploading > 0; }
+    unsigned int uploaded() const { return m_uploaded; }
+    unsigned int cacheHits() const { return m_cacheHits; }
+private:
+    // Upload thread side
+    static void upload(QOpenGLFunctions_3_3_Core *p_functions, PixelUnpackBuffer *p_unpackBuffer,
+                       GLuint texture, const BakedTexture &image);
+};
+
+#endif // TEXTURE_LOADER_H
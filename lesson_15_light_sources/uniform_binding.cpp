@@ -0,0 +1,80 @@
+#include "uniform_binding.h"
+
+#include <cstring>
+
+UniformBinding::UniformBinding(QOpenGLShaderProgram *p_program)
+    : mp_program(p_program)
+{
+}
+
+int UniformBinding::resolve(const QByteArray &name)
+{
+    Slot slot;
+    slot.location = mp_program->uniformLocation(name);
+    m_stats.lookups++;
+
+    // Inactive uniforms keep their handle, set() just ignores them
+    m_slots.push_back(slot);
+    return static_cast<int>(m_slots.size()) - 1;
+}
+
+void UniformBinding::set(int handle, bool value)
+{
+    set(handle, static_cast<int>(value));
+}
+
+void UniformBinding::set(int handle, int value)
+{
+    if (needsUpload(handle, &value, 1))
+        mp_program->setUniformValue(m_slots[handle].location, value);
+}
+
+void UniformBinding::set(int handle, float value)
+{
+    if (needsUpload(handle, &value, 1))
+        mp_program->setUniformValue(m_slots[handle].location, value);
+}
+
+void UniformBinding::set(int handle, const QVector2D &value)
+{
+    float components[2] = {value.x(), value.y()};
+    if (needsUpload(handle, components, 2))
+        mp_program->setUniformValue(m_slots[handle].location, value);
+}
+
+void UniformBinding::set(int handle, const QVector3D &value)
+{
+    float components[3] = {value.x(), value.y(), value.z()};
+    if (needsUpload(handle, components, 3))
+        mp_program->setUniformValue(m_slots[handle].location, value);
+}
+
+void UniformBinding::set(int handle, const QMatrix3x3 &value)
+{
+    if (needsUpload(handle, value.constData(), 9))
+        mp_program->setUniformValue(m_slots[handle].location, value);
+}
+
+void UniformBinding::set(int handle, const QMatrix4x4 &value)
+{
+    if (needsUpload(handle, value.constData(), 16))
+        mp_program->setUniformValue(m_slots[handle].location, value);
+}
+
+bool UniformBinding::needsUpload(int handle, const void *p_value, int words)
+{
+    if (handle < 0 || m_slots[handle].location < 0)
+        return false;
+
+    Slot &slot = m_slots[handle];
+    if (slot.words == words && std::memcmp(slot.value, p_value, words * sizeof(unsigned int)) == 0)
+    {
+        m_stats.skipped++;
+        return false;
+    }
+
+    std::memcpy(slot.value, p_value, words * sizeof(unsigned int));
+    slot.words = words;
+    m_stats.uploads++;
+    return true;
+}
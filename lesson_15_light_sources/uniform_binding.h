@@ -0,0 +1,54 @@
+#ifndef UNIFORM_BINDING_H
+#define UNIFORM_BINDING_H
+
+#include <QOpenGLShaderProgram>
+#include <QMatrix4x4>
+#include <QVector2D>
+#include <QVector3D>
+
+#include <vector>
+
+struct UniformStats
+{
+    unsigned int    lookups = 0;
+    unsigned int    uploads = 0;
+    unsigned int    skipped = 0;
+};
+
+// Resolves uniform locations of a linked program once and keeps a shadow copy
+// of every uploaded value, so setting an unchanged value costs no GL call.
+// The program must be bound while set() is called. A relinked program gets a
+// new binding, shadow values are only valid for the program they went to.
+class UniformBinding
+{
+private:
+    struct Slot
+    {
+        int             location = -1;
+        int             words = 0;          // 0 until the first upload
+        unsigned int    value[16];
+    };
+
+    QOpenGLShaderProgram*               mp_program;
+    std::vector<Slot>                   m_slots;
+    UniformStats                        m_stats;
+public:
+    explicit UniformBinding(QOpenGLShaderProgram *p_program);
+
+    int resolve(const QByteArray &name);
+
+    void set(int handle, bool value);
+    void set(int handle, int value);
+    void set(int handle, float value);
+    void set(int handle, const QVector2D &value);
+    void set(int handle, const QVector3D &value);
+    void set(int handle, const QMatrix3x3 &value);
+    void set(int handle, const QMatrix4x4 &value);
+
+    const UniformStats& stats() const { return m_stats; }
+    void resetStats() { m_stats = UniformStats(); }
+private:
+    bool needsUpload(int handle, const void *p_value, int words);
+};
+
+#endif // UNIFORM_BINDING_H
@@ -0,0 +1,90 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <QVector3D>
+#include <QMatrix4x4>
+
+#include <algorithm>
+
+// Fixed binding points shared by every program
+enum UniformBlockBinding
+{
+    CameraBlockBinding = 0,
+    LightsBlockBinding = 1,
+    ClusterBlockBinding = 2
+};
+
+// CPU mirrors of the std140 blocks in the shaders. Members are ordered so that
+// every vec3 is followed by a scalar filling its 16-byte slot.
+
+struct CameraBlock
+{
+    float   view[16];
+    float   projection[16];
+    float   viewPos[3];
+    float   _pad0;
+};
+
+struct DirLightBlock
+{
+    float   direction[3];
+    float   _pad0;
+    float   ambient[3];
+    float   _pad1;
+    float   diffuse[3];
+    float   _pad2;
+    float   specular[3];
+    float   _pad3;
+};
+
+struct SpotLightBlock
+{
+    float   position[3];
+    float   cutOff;
+    float   direction[3];
+    float   outerCutOff;
+    float   ambient[3];
+    float   constant;
+    float   diffuse[3];
+    float   linear;
+    float   specular[3];
+    float   quadratic;
+    int     activated;
+    int     _pad0[3];
+};
+
+// Point lights are not here, they live in the clustered light buffers
+struct LightsBlock
+{
+    DirLightBlock       dirLight;
+    SpotLightBlock      spotLight;
+};
+
+struct ClusterBlock
+{
+    unsigned int    grid[4];        // tiles x, tiles y, depth slices, light count
+    float   sliceScale;
+    float   sliceBias;
+    float   tileWidth;
+    float   tileHeight;
+};
+
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock does not match std140 layout");
+static_assert(sizeof(DirLightBlock) == 64, "DirLightBlock does not match std140 layout");
+static_assert(sizeof(SpotLightBlock) == 96, "SpotLightBlock does not match std140 layout");
+static_assert(sizeof(LightsBlock) == 160, "LightsBlock does not match std140 layout");
+static_assert(sizeof(ClusterBlock) == 32, "ClusterBlock does not match std140 layout");
+
+inline void std140Copy(float *p_dest, const QVector3D &value)
+{
+    p_dest[0] = value.x();
+    p_dest[1] = value.y();
+    p_dest[2] = value.z();
+}
+
+inline void std140Copy(float *p_dest, const QMatrix4x4 &value)
+{
+    std::copy(value.constData(), value.constData() + 16, p_dest);
+}
+
+#endif // UNIFORM_BLOCKS_H
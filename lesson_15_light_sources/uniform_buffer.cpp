@@ -0,0 +1,51 @@
+#include "uniform_buffer.h"
+
+#include <QtDebug>
+
+#include <cstring>
+
+UniformBuffer::UniformBuffer(GLStateCache *p_stateCache, unsigned int bindingPoint, int size)
+    : mp_stateCache(p_stateCache),
+      m_bindingPoint(bindingPoint),
+      m_shadow(size)
+{
+    initializeOpenGLFunctions();
+
+    glGenBuffers(1, &m_UBO);
+    mp_stateCache->bindBuffer(GL_UNIFORM_BUFFER, m_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+
+    // Also sets the generic binding, to the buffer the cache already holds there
+    glBindBufferBase(GL_UNIFORM_BUFFER, m_bindingPoint, m_UBO);
+}
+
+UniformBuffer::~UniformBuffer()
+{
+    glDeleteBuffers(1, &m_UBO);
+}
+
+void UniformBuffer::attach(QOpenGLShaderProgram *p_program, const char *blockName)
+{
+    unsigned int blockIndex = glGetUniformBlockIndex(p_program->programId(), blockName);
+    if (blockIndex == GL_INVALID_INDEX)
+    {
+        qDebug() << "Uniform block" << blockName << "is not used by the program";
+        return;
+    }
+    glUniformBlockBinding(p_program->programId(), blockIndex, m_bindingPoint);
+}
+
+bool UniformBuffer::update(const void *p_data)
+{
+    if (m_shadowValid && std::memcmp(m_shadow.data(), p_data, m_shadow.size()) == 0)
+        return false;
+
+    std::memcpy(m_shadow.data(), p_data, m_shadow.size());
+    m_shadowValid = true;
+
+    mp_stateCache->bindBuffer(GL_UNIFORM_BUFFER, m_UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, m_shadow.size(), m_shadow.data());
+
+    m_uploads++;
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLShaderProgram>
+
+#include <vector>
+
+#include <gl_state_cache.h>
+
+// Uniform buffer bound to a fixed binding point. update() re-uploads the whole
+// block with one glBufferSubData, and only when its contents changed. The
+// generic GL_UNIFORM_BUFFER binding goes through the state cache, which tracks it.
+class UniformBuffer : protected QOpenGLFunctions_3_3_Core
+{
+private:
+    GLStateCache*                       mp_stateCache;
+    unsigned int                        m_UBO;
+    unsigned int                        m_bindingPoint;
+    std::vector<char>                   m_shadow;
+    bool                                m_shadowValid = false;
+    unsigned int                        m_uploads = 0;
+public:
+    UniformBuffer(GLStateCache *p_stateCache, unsigned int bindingPoint, int size);
+    ~UniformBuffer();
+
+    void attach(QOpenGLShaderProgram *p_program, const char *blockName);
+    bool update(const void *p_data);
+
+    unsigned int uploads() const { return m_uploads; }
+    void resetStats() { m_uploads = 0; }
+};
+
+#endif // UNIFORM_BUFFER_H
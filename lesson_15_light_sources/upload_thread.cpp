@@ -0,0 +1,144 @@
+#include "upload_thread.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QtDebug>
+
+UploadThread::UploadThread(QOpenGLContext *p_shareContext, QOffscreenSurface *p_surface)
+    : mp_surface(p_surface),
+      mp_context(nullptr),
+      mp_ownerThread(QThread::currentThread()),
+      mp_inlineUnpackBuffer(nullptr)
+{
+    m_renderFunctions.initializeOpenGLFunctions();
+
+    // Created here, then moved over to the upload thread
+    mp_context = new QOpenGLContext;
+    mp_context->setFormat(p_shareContext->format());
+    mp_context->setShareContext(p_shareContext);
+    m_threaded = mp_surface->isValid() && mp_context->create() &&
+                 QOpenGLContext::areSharing(mp_context, p_shareContext);
+
+    if (m_threaded)
+    {
+        mp_context->moveToThread(this);
+        start();
+    }
+    else
+    {
+        delete mp_context;
+        mp_context = nullptr;
+        mp_inlineUnpackBuffer = new PixelUnpackBuffer;
+    }
+    qDebug() << "Resource uploads:" << (m_threaded ? "shared context on the upload thread" : "inline, no shared context");
+}
+
+UploadThread::~UploadThread()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        // Jobs not started yet are dropped, the one running finishes
+        m_jobs.clear();
+        m_stopping = true;
+        m_wakeUp.wakeOne();
+    }
+    wait();
+
+    for (Completed &completed: m_completed)
+        if (completed.fence)
+            m_renderFunctions.glDeleteSync(completed.fence);
+
+    delete mp_inlineUnpackBuffer;
+    delete mp_context;
+}
+
+void UploadThread::submit(const UploadFunction &upload, const DoneFunction &done)
+{
+    if (!m_threaded)
+    {
+        // Same context: no fence needed, poll() still reports it a frame later
+        upload(&m_renderFunctions, mp_inlineUnpackBuffer);
+        m_completed.push_back({nullptr, done});
+        return;
+    }
+
+    // The job may use objects this context created during the current frame
+    m_renderFunctions.glFlush();
+
+    QMutexLocker locker(&m_mutex);
+    m_jobs.push_back({upload, done});
+    m_wakeUp.wakeOne();
+}
+
+bool UploadThread::poll()
+{
+    std::deque<Completed> signalled;
+    {
+        QMutexLocker locker(&m_mutex);
+        // In submission order, so a later job never overtakes the one it depends on
+        while (!m_completed.empty())
+        {
+            Completed &completed = m_completed.front();
+            if (completed.fence)
+            {
+                GLenum status = m_renderFunctions.glClientWaitSync(completed.fence, 0, 0);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                    break;
+                m_renderFunctions.glDeleteSync(completed.fence);
+            }
+            signalled.push_back(completed);
+            m_completed.pop_front();
+        }
+    }
+
+    // Outside the lock, a done function may submit the next job
+    for (Completed &completed: signalled)
+        completed.done();
+    m_finished += unsigned(signalled.size());
+    return !signalled.empty();
+}
+
+qint64 UploadThread::busyNs()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_busyNs;
+}
+
+void UploadThread::run()
+{
+    mp_context->makeCurrent(mp_surface);
+    QOpenGLFunctions_3_3_Core functions;
+    functions.initializeOpenGLFunctions();
+    PixelUnpackBuffer *p_unpackBuffer = new PixelUnpackBuffer;
+
+    QElapsedTimer timer;
+    for (;;)
+    {
+        Job job;
+        {
+            QMutexLocker locker(&m_mutex);
+            while (m_jobs.empty() && !m_stopping)
+                m_wakeUp.wait(&m_mutex);
+            if (m_stopping)
+                break;
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        timer.start();
+        job.upload(&functions, p_unpackBuffer);
+        GLsync fence = functions.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // The fence has to reach the GPU before another context can wait for it
+        functions.glFlush();
+        qint64 elapsed = timer.nsecsElapsed();
+
+        QMutexLocker locker(&m_mutex);
+        m_completed.push_back({fence, job.done});
+        m_busyNs += elapsed;
+    }
+
+    delete p_unpackBuffer;
+    mp_context->doneCurrent();
+    // Back to the thread that deletes it
+    mp_context->moveToThread(mp_ownerThread);
+}
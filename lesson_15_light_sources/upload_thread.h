@@ -0,0 +1,78 @@
+#ifndef UPLOAD_THREAD_H
+#define UPLOAD_THREAD_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <deque>
+#include <functional>
+
+#include <pixel_unpack_buffer.h>
+
+// Resource uploads off the render thread. The thread owns a QOffscreenSurface
+// and a context shared with the window, runs submitted upload jobs in order and
+// puts a fence behind each one. poll() on the render thread hands a job back,
+// by calling its done function, once the GPU has passed that fence, so the
+// render thread never sees a half-written texture or buffer. Objects written
+// by a job have to be bound again afterwards to see the new contents.
+// Without a shared context the jobs run inside submit() instead.
+class UploadThread : public QThread
+{
+public:
+    // Runs on the upload thread with its context current; must not touch
+    // anything the render thread owns besides the GL names it was given
+    typedef std::function<void(QOpenGLFunctions_3_3_Core *p_functions,
+                               PixelUnpackBuffer *p_unpackBuffer)> UploadFunction;
+    // Runs on the render thread from poll() once the upload has completed
+    typedef std::function<void()> DoneFunction;
+private:
+    struct Job
+    {
+        UploadFunction                  upload;
+        DoneFunction                    done;
+    };
+
+    struct Completed
+    {
+        GLsync                          fence;
+        DoneFunction                    done;
+    };
+
+    QOpenGLFunctions_3_3_Core           m_renderFunctions;
+    QOffscreenSurface*                  mp_surface;
+    QOpenGLContext*                     mp_context;
+    QThread*                            mp_ownerThread;     // creates and deletes the context
+    PixelUnpackBuffer*                  mp_inlineUnpackBuffer;
+    bool                                m_threaded = false;
+
+    QMutex                              m_mutex;
+    QWaitCondition                      m_wakeUp;
+    std::deque<Job>                     m_jobs;
+    std::deque<Completed>               m_completed;
+    bool                                m_stopping = false;
+
+    unsigned int                        m_finished = 0;
+    qint64                              m_busyNs = 0;       // upload thread time, guarded by m_mutex
+public:
+    // Called on the render thread with the window context current. The surface has
+    // to be created on the GUI thread and outlive the upload thread.
+    UploadThread(QOpenGLContext *p_shareContext, QOffscreenSurface *p_surface);
+    ~UploadThread();
+
+    void submit(const UploadFunction &upload, const DoneFunction &done);
+
+    // Once per frame on the render thread; returns true if any done function ran
+    bool poll();
+
+    bool threaded() const { return m_threaded; }
+    unsigned int finished() const { return m_finished; }
+    qint64 busyNs();
+protected:
+    void run() override;
+};
+
+#endif // UPLOAD_THREAD_H
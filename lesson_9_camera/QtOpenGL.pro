@@ -1,4 +1,4 @@
-QT       += core gui 3drender
+QT       += core gui
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -11,15 +11,21 @@ CONFIG += c++11 \
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    camera.cpp \
     main.cpp \
     renderwindow.cpp \
-    stb_image.cpp
+    stb_image.cpp \
+    transform_kernel.cpp
 
 HEADERS += \
+    aligned_allocator.h \
+    camera.h \
     direction.h \
+    fixed_timestep.h \
     keyboard_state.h \
     mouse_state.h \
-    renderwindow.h
+    renderwindow.h \
+    transform_kernel.h
 
 INCLUDEPATH += \
     $$PWD/include
@@ -0,0 +1,59 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <QMatrix4x4>
+#include <QQuaternion>
+#include <QVector3D>
+
+// Fly camera as a plain value: a position, a unit quaternion for the
+// orientation and a perspective lens. The view, projection and combined
+// matrices are built on first use after a change and cached until the next,
+// so a camera that did not move costs nothing per frame. The camera looks
+// down its local -Z with +Y up, like lookAt().
+class Camera
+{
+private:
+    QVector3D                           m_position = QVector3D(0.0f, 0.0f, 0.0f);
+    QQuaternion                         m_orientation;
+    float                               m_fov = 45.0f;
+    float                               m_aspectRatio = 1.0f;
+    float                               m_nearPlane = 0.1f;
+    float                               m_farPlane = 100.0f;
+
+    mutable QMatrix4x4                  m_viewMatrix;
+    mutable QMatrix4x4                  m_projectionMatrix;
+    mutable QMatrix4x4                  m_viewProjectionMatrix;
+    mutable bool                        m_viewDirty = true;
+    mutable bool                        m_projectionDirty = true;
+    mutable bool                        m_viewProjectionDirty = true;
+public:
+    void setPosition(const QVector3D &position);
+    // Orientation from a view direction and an up vector, which need not be unit length
+    void lookAlong(const QVector3D &position, const QVector3D &front, const QVector3D &up);
+    void setPerspective(float fov, float aspectRatio, float nearPlane, float farPlane);
+
+    void translateWorld(const QVector3D &offset);
+    // Angles in degrees about the camera's own axes: positive pan turns right,
+    // positive tilt looks up, roll turns about the view direction like QCamera::roll
+    void pan(float angle);
+    void tilt(float angle);
+    void roll(float angle);
+
+    const QVector3D& position() const { return m_position; }
+    const QQuaternion& orientation() const { return m_orientation; }
+    float fov() const { return m_fov; }
+    // Unit vectors
+    QVector3D viewVector() const { return m_orientation.rotatedVector(QVector3D(0.0f, 0.0f, -1.0f)); }
+    QVector3D upVector() const { return m_orientation.rotatedVector(QVector3D(0.0f, 1.0f, 0.0f)); }
+    QVector3D rightVector() const { return m_orientation.rotatedVector(QVector3D(1.0f, 0.0f, 0.0f)); }
+
+    const QMatrix4x4& viewMatrix() const;
+    const QMatrix4x4& projectionMatrix() const;
+    // projection * view
+    const QMatrix4x4& viewProjectionMatrix() const;
+private:
+    void rotateLocal(const QVector3D &axis, float angle);
+    void viewChanged() { m_viewDirty = m_viewProjectionDirty = true; }
+};
+
+#endif // CAMERA_H
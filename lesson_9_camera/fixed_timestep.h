@@ -0,0 +1,62 @@
+#ifndef FIXED_TIMESTEP_H
+#define FIXED_TIMESTEP_H
+
+#include <QtGlobal>
+#include <QVector3D>
+
+// Fixed-rate simulation clock. Every frame advance() gets the current time in
+// nanoseconds and returns how many simulation steps are due; the remainder it
+// carries over gives alpha(), where the frame lies between the previous and
+// the current simulation state. Updates always see the same step length, so
+// they are deterministic whatever the frame rate, and rendering interpolates.
+class FixedTimestep
+{
+private:
+    qint64                              m_stepNs;
+    int                                 m_maxSteps;
+    qint64                              m_lastNs = -1;
+    qint64                              m_accumulatorNs = 0;
+public:
+    explicit FixedTimestep(qint64 stepNs, int maxSteps = 8)
+        : m_stepNs(stepNs),
+          m_maxSteps(maxSteps)
+    {
+    }
+
+    int advance(qint64 nowNs)
+    {
+        if (m_lastNs < 0)
+            m_lastNs = nowNs;
+        m_accumulatorNs += nowNs - m_lastNs;
+        m_lastNs = nowNs;
+
+        int steps = int(m_accumulatorNs / m_stepNs);
+        m_accumulatorNs -= steps * m_stepNs;
+        // After a stall the backlog is dropped rather than simulated in one frame
+        return steps < m_maxSteps ? steps : m_maxSteps;
+    }
+
+    float alpha() const { return float(double(m_accumulatorNs) / double(m_stepNs)); }
+    float stepMs() const { return float(m_stepNs / 1e6); }
+    float stepSeconds() const { return float(m_stepNs / 1e9); }
+};
+
+// Camera placement as a simulation state, in the terms lookAt() takes
+struct CameraPose
+{
+    QVector3D                           position;
+    QVector3D                           front;
+    QVector3D                           up;
+
+    // One step turns the camera only a little, so a normalised lerp is as good as a slerp
+    static CameraPose interpolate(const CameraPose &from, const CameraPose &to, float alpha)
+    {
+        CameraPose pose;
+        pose.position = from.position + (to.position - from.position) * alpha;
+        pose.front = (from.front + (to.front - from.front) * alpha).normalized();
+        pose.up = (from.up + (to.up - from.up) * alpha).normalized();
+        return pose;
+    }
+};
+
+#endif // FIXED_TIMESTEP_H
@@ -9,6 +9,7 @@ struct KeyboardState
     bool    D_keyPressed = false;
     bool    Q_keyPressed = false;
     bool    E_keyPressed = false;
+    bool    Instancing_key_activated = true;
 };
 
 #endif // KEYBOARD_STATE_H
@@ -4,6 +4,7 @@
 #include <QtDebug>
 #include <QFile>
 
+#include <algorithm>
 #include <cassert>
 #include <math.h>
 #include "stb_image.h"
@@ -37,6 +38,7 @@ RenderWindow::~RenderWindow()
     glDeleteVertexArrays(1, &m_VAO);
     glDeleteBuffers(1, &m_VBO);
     glDeleteBuffers(1, &m_EBO);
+    glDeleteBuffers(1, &m_instanceVBO);
 }
 
 void RenderWindow::loadShaders(const QString& vertexShaderFileName,const QString& fragmentShaderFileName)
@@ -163,11 +165,9 @@ void RenderWindow::initializeGL()
 #endif
 
 #ifdef USE_QUATERNIONS
-    m_camera.setProjectionType(QCameraLens::PerspectiveProjection);
-    m_camera.setPosition(QVector3D(0.0f, 0.0f, 3.0f));
-    m_camera.setViewCenter(QVector3D(0.0f, 0.0f, -1.0f));
-    m_camera.setUpVector(QVector3D(0.0f, 1.0f, 0.0f));
+    m_camera.lookAlong(QVector3D(0.0f, 0.0f, 3.0f), QVector3D(0.0f, 0.0f, -1.0f), QVector3D(0.0f, 1.0f, 0.0f));
 #endif
+    m_previousCamera = cameraPose();
 
     m_cubePositions = {
       QVector3D( 0.0f,  0.0f,  0.0f),
@@ -182,6 +182,11 @@ void RenderWindow::initializeGL()
       QVector3D(-1.3f,  1.0f, -1.5f)
     };
 
+    m_cubeTransforms.clear();
+    for (const QVector3D &position: m_cubePositions)
+        m_cubeTransforms.add(position);
+    m_cubeInstanceData.resize(m_cubePositions.size() * 16);
+
 
     float vertices[] = {
         //vertex coords         //texture coords
@@ -254,6 +259,17 @@ void RenderWindow::initializeGL()
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
+        //Per-instance model matrix, one vec4 column per location
+    glGenBuffers(1, &m_instanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, m_cubePositions.size() * 16 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+    for (unsigned int column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float), (void*)(4 * column * sizeof(float)));
+        glEnableVertexAttribArray(2 + column);
+        glVertexAttribDivisor(2 + column, 1);
+    }
+
     glBindVertexArray(0);
 
 
@@ -267,13 +283,6 @@ void RenderWindow::resizeGL(int width, int height)
     m_lastMouseState.lastX = width/2;
     m_lastMouseState.lastY = height/2;
     QCursor::setPos(mapToGlobal(QPoint(width/2, height/2)));
-
-    m_projectionMatrix.setToIdentity();
-    m_projectionMatrix.perspective(m_lastMouseState.fov, (float)width/(float)height, 0.1f, 100.0f);
-#ifdef USE_QUATERNIONS
-    m_camera.setProjectionMatrix(m_projectionMatrix);
-#endif
-
 }
 
 void RenderWindow::keyPressEvent(QKeyEvent *p_key)
@@ -292,6 +301,8 @@ void RenderWindow::keyPressEvent(QKeyEvent *p_key)
         m_buttonsState.Q_keyPressed = true;
     if (p_key->key() == Qt::Key_E)
         m_buttonsState.E_keyPressed = true;
+    if (p_key->key() == Qt::Key_I)
+        m_buttonsState.Instancing_key_activated = !m_buttonsState.Instancing_key_activated;
 }
 
 void RenderWindow::keyReleaseEvent(QKeyEvent *p_key)
@@ -313,7 +324,7 @@ void RenderWindow::keyReleaseEvent(QKeyEvent *p_key)
 void RenderWindow::mouseMoveEvent(QMouseEvent * p_mouse)
 {
 
-    float cameraSpeed = cm_mouseSensitivity * m_frameDelta;
+    float cameraSpeed = cm_mouseSensitivity * m_timestep.stepMs();
 
 #ifdef QT_DEPRECATED_VERSION_5
     float xOffset = p_mouse->globalPos().x() - m_lastMouseState.lastX;
@@ -347,17 +358,24 @@ void RenderWindow::mouseMoveEvent(QMouseEvent * p_mouse)
     }
 
 #ifdef USE_QUATERNIONS
+    QQuaternion before = m_camera.orientation();
 //Yaw rotation
     m_camera.pan(xOffset);
 //Pitch rotation
     m_camera.tilt(yOffset);
+
+    // Mouse look is not simulated: the previous state turns along, so the
+    // interpolated camera shows the turn in the next frame already
+    QQuaternion turn = m_camera.orientation() * before.conjugated();
+    m_previousCamera.front = turn.rotatedVector(m_previousCamera.front);
+    m_previousCamera.up = turn.rotatedVector(m_previousCamera.up);
 #endif
 
 }
 
 void RenderWindow::wheelEvent(QWheelEvent *p_wheel)
 {
-    float cameraSpeed = cm_wheelSensitivity * m_frameDelta;
+    float cameraSpeed = cm_wheelSensitivity * m_timestep.stepMs();
 
         m_lastMouseState.fov -= p_wheel->angleDelta().y() * cameraSpeed;
     if(m_lastMouseState.fov < 5.0f)
@@ -370,34 +388,39 @@ void RenderWindow::wheelEvent(QWheelEvent *p_wheel)
 
 void RenderWindow::paintGL()
 {
-    defineFrameDelta();
-    processInput();
+    // Fixed-rate simulation steps, however long the last frame took
+    int steps = m_timestep.advance(m_frameTimer.nsecsElapsed());
+    for (int step = 0; step < steps; step++)
+    {
+        m_previousCamera = cameraPose();
+        m_previousRotation = m_rotation;
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        processInput();
 
-    static float rotation = 0;
-    rotation += 3.6f * static_cast<float>(m_frameDelta)/1000.0f;
-    if (rotation >= 360.0f)
-        rotation = 0.0f;
+        m_rotation += 3.6f * m_timestep.stepSeconds();
+        if (m_rotation >= 360.0f)
+        {
+            // Both states wrap, so the interpolation never runs backwards
+            m_rotation -= 360.0f;
+            m_previousRotation -= 360.0f;
+        }
+    }
 
-#ifdef USE_EULER_ANGLES
-    m_viewMatrix.setToIdentity();
-    m_viewMatrix.lookAt(m_cameraPosition,
-                        m_cameraPosition + m_cameraFront,
-                        m_cameraUp);
-#endif
+    // The frame lies between the last two simulation states
+    float alpha = m_timestep.alpha();
+    CameraPose camera = CameraPose::interpolate(m_previousCamera, cameraPose(), alpha);
+    float rotation = m_previousRotation + (m_rotation - m_previousRotation) * alpha;
 
-#ifdef USE_QUATERNIONS
-    m_viewMatrix.setToIdentity();
-    m_viewMatrix.lookAt(m_camera.position(),
-                        m_camera.position() + m_camera.viewVector(),
-                        m_camera.upVector());
-#endif
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Both only mark the matrices stale when something changed
+    m_frameCamera.lookAlong(camera.position, camera.front, camera.up);
+    m_frameCamera.setPerspective(m_lastMouseState.fov, (float)width()/(float)height(), 0.1f, 100.0f);
 
     mp_shaderProg->bind();
 
-    mp_shaderProg->setUniformValue(mp_shaderProg->uniformLocation("view"), m_viewMatrix);
-    mp_shaderProg->setUniformValue(mp_shaderProg->uniformLocation("projection"), m_projectionMatrix);
+    mp_shaderProg->setUniformValue(mp_shaderProg->uniformLocation("view"), m_frameCamera.viewMatrix());
+    mp_shaderProg->setUniformValue(mp_shaderProg->uniformLocation("projection"), m_frameCamera.projectionMatrix());
 
 
     glActiveTexture(GL_TEXTURE0);
@@ -406,16 +429,26 @@ void RenderWindow::paintGL()
     glBindTexture(GL_TEXTURE_2D, m_texture2);
     glBindVertexArray(m_VAO);
 
-    for (unsigned int i = 0; i < m_cubePositions.size(); i++)
-    {
-        m_modelMatrix.setToIdentity();
-        m_modelMatrix.translate(m_cubePositions[i]);
+    // The cubes spin every frame, so every transform is rebuilt each time
+    updateCubeTransforms(rotation);
 
-        m_modelMatrix.rotate(rotation * (i+1) * 10, 1.0f, 0.3f, 0.5f);
-        mp_shaderProg->setUniformValue(mp_shaderProg->uniformLocation("model"), m_modelMatrix);
+    if (m_buttonsState.Instancing_key_activated == true)
+    {
+        uploadCubeInstances();
 
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        mp_shaderProg->setUniformValue(mp_shaderProg->uniformLocation("instanced"), true);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 36, static_cast<GLsizei>(m_cubePositions.size()));
+    }
+    else
+    {
+        mp_shaderProg->setUniformValue(mp_shaderProg->uniformLocation("instanced"), false);
+        for (unsigned int i = 0; i < m_cubePositions.size(); i++)
+        {
+            m_modelMatrix = cubeModelMatrix(i);
+            mp_shaderProg->setUniformValue(mp_shaderProg->uniformLocation("model"), m_modelMatrix);
 
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+        }
     }
 
     mp_shaderProg->release();
@@ -423,13 +456,34 @@ void RenderWindow::paintGL()
     this->update();
 }
 
-void RenderWindow::processInput()
+QMatrix4x4 RenderWindow::cubeModelMatrix(unsigned int index) const
 {
+    const float *p_model = m_cubeInstanceData.data() + index * 16;
+    QMatrix4x4 model;
+    std::copy(p_model, p_model + 16, model.data());
+    return model;
+}
 
-    float cameraSpeed = cm_cameraSpeedFactor * m_frameDelta;
+void RenderWindow::updateCubeTransforms(float rotation)
+{
+    for (unsigned int i = 0; i < m_cubeTransforms.size(); i++)
+        m_cubeTransforms.setRotation(i, QQuaternion::fromAxisAndAngle(QVector3D(1.0f, 0.3f, 0.5f),
+                                                                      rotation * (i+1) * 10));
+    // All cubes at once, 4 or 8 per instruction, straight into the instance buffer layout
+    Transforms::update(&m_cubeTransforms, m_cubeInstanceData.data(), 16);
+}
 
-    m_projectionMatrix.setToIdentity();
-    m_projectionMatrix.perspective(m_lastMouseState.fov, (float)width()/(float)height(), 0.1f, 100.0f);
+void RenderWindow::uploadCubeInstances()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, m_cubeInstanceData.size() * sizeof(float),
+                 m_cubeInstanceData.data(), GL_DYNAMIC_DRAW);
+}
+
+void RenderWindow::processInput()
+{
+
+    float cameraSpeed = cm_cameraSpeedFactor * m_timestep.stepMs();
 
 #ifdef USE_EULER_ANGLES
     if (m_buttonsState.W_keyPressed == true)
@@ -473,20 +527,17 @@ void RenderWindow::processInput()
 #endif
 
 #ifdef USE_QUATERNIONS
-
-    m_camera.setProjectionMatrix(m_projectionMatrix);
-
     if (m_buttonsState.W_keyPressed == true)
-        m_camera.translateWorld(cameraSpeed * m_camera.viewVector());
+        m_camera.translateWorld(cm_forwardSpeedScale * cameraSpeed * m_camera.viewVector());
 
     if (m_buttonsState.S_keyPressed == true)
-        m_camera.translateWorld(-cameraSpeed * m_camera.viewVector());
+        m_camera.translateWorld(-cm_forwardSpeedScale * cameraSpeed * m_camera.viewVector());
 
     if (m_buttonsState.A_keyPressed == true)
-        m_camera.translateWorld(-QVector3D::normal(m_camera.viewVector(), m_camera.upVector()) * cameraSpeed);
+        m_camera.translateWorld(-m_camera.rightVector() * cameraSpeed);
 
     if (m_buttonsState.D_keyPressed == true)
-        m_camera.translateWorld(QVector3D::normal(m_camera.viewVector(), m_camera.upVector()) * cameraSpeed);
+        m_camera.translateWorld(m_camera.rightVector() * cameraSpeed);
 
     if (m_buttonsState.Q_keyPressed == true)
     {
@@ -509,10 +560,19 @@ void RenderWindow::processInput()
 
 }
 
-void RenderWindow::defineFrameDelta()
+CameraPose RenderWindow::cameraPose() const
 {
-    float currentFrameTime = m_frameTimer.elapsed();
-    m_frameDelta = currentFrameTime - m_lastFrameTime;
-    m_lastFrameTime = currentFrameTime;
+    CameraPose pose;
+#ifdef USE_EULER_ANGLES
+    pose.position = m_cameraPosition;
+    pose.front = m_cameraFront;
+    pose.up = m_cameraUp;
+#endif
 
+#ifdef USE_QUATERNIONS
+    pose.position = m_camera.position();
+    pose.front = m_camera.viewVector();
+    pose.up = m_camera.upVector();
+#endif
+    return pose;
 }
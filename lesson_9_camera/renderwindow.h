@@ -9,47 +9,58 @@
 #include <QOpenGLFunctions_3_3_Core>
 #include <QMatrix4x4>
 #include <QVector3D>
-#include <Qt3DRender/QCamera>
 
 #include <QElapsedTimer>
 
+#include <camera.h>
 #include <keyboard_state.h>
 #include <mouse_state.h>
 #include <direction.h>
+#include <fixed_timestep.h>
+#include <transform_kernel.h>
 
 
 #ifndef RENDERWINDOW_H
 #define RENDERWINDOW_H
 
-using namespace Qt3DRender;
-
 class RenderWindow : public QOpenGLWindow, protected QOpenGLFunctions_3_3_Core
 {
     Q_OBJECT
 private:
     const float                         cm_cameraSpeedFactor = 0.006f;
+    // QCamera kept the initial 4 unit eye-to-center distance in its view vector,
+    // which made walking that much faster than strafing
+    const float                         cm_forwardSpeedScale = 4.0f;
     const float                         cm_mouseSensitivity = 0.008f;
     const float                         cm_wheelSensitivity = 0.001f;
+    // 60 steps a second, the frame rate the speed factors above were tuned at
+    const qint64                        cm_simulationStepNs = 1000000000 / 60;
 
     unsigned int                        m_VBO, m_VAO, m_EBO;
+    unsigned int                        m_instanceVBO;
     unsigned int                        m_texture1, m_texture2;
     KeyboardState                       m_buttonsState;
     MouseState                          m_lastMouseState;
 
-    float                               m_frameDelta = 0.0f;
-    float                               m_lastFrameTime = 0.0f;
+    // The camera objects and m_rotation hold the current simulation state,
+    // these the one before the last step
+    FixedTimestep                       m_timestep{cm_simulationStepNs};
+    CameraPose                          m_previousCamera;
+    float                               m_previousRotation = 0.0f;
+    float                               m_rotation = 0.0f;
 
     std::vector<QVector3D>              m_cubePositions;
+    TransformsSoA                       m_cubeTransforms;
+    std::vector<float>                  m_cubeInstanceData;
 
     QOpenGLShader                       *mp_vertexShader;
     QOpenGLShader                       *mp_fragmentShader;
     QOpenGLShaderProgram                *mp_shaderProg;
 
     QMatrix4x4                          m_modelMatrix;
-    QMatrix4x4                          m_viewMatrix;
-    QMatrix4x4                          m_projectionMatrix;
-
-    QCamera                             m_camera;
+    Camera                              m_camera;
+    // The interpolated camera with the lens, the matrices of the frame being drawn
+    Camera                              m_frameCamera;
 
     Direction                           m_cameraDirection;
     QVector3D                           m_cameraPosition;
@@ -64,7 +75,10 @@ protected:
     void loadShaders(const QString &vertexShaderFileName, const QString &fragmentShaderFileName);
     void loadTextures(const QString &texture_1FileName, const QString &texture_2FileName);
     void processInput();
-    void defineFrameDelta();
+    CameraPose cameraPose() const;
+    QMatrix4x4 cubeModelMatrix(unsigned int index) const;
+    void updateCubeTransforms(float rotation);
+    void uploadCubeInstances();
 
     void initializeGL()                         override;
     void resizeGL(int width, int height)        override;
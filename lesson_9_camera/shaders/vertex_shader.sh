@@ -1,15 +1,18 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in mat4 aInstanceModel;
 
 out vec2 TexCoord;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform bool instanced;
  
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    mat4 worldModel = instanced ? aInstanceModel : model;
+    gl_Position = projection * view * worldModel * vec4(aPos, 1.0);
     TexCoord = aTexCoord;
 }
@@ -0,0 +1,293 @@
+#include "transform_kernel.h"
+
+#include <algorithm>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRANSFORMS_AVX
+#define TRANSFORMS_SSE
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORMS_SSE
+#endif
+
+void TransformsSoA::clear()
+{
+    for (AlignedArray<float> *p_array: {&positionX, &positionY, &positionZ, &rotationX, &rotationY, &rotationZ,
+                                       &rotationW, &scaleX, &scaleY, &scaleZ})
+        p_array->clear();
+    dirty.clear();
+}
+
+void TransformsSoA::reserve(unsigned int count)
+{
+    for (AlignedArray<float> *p_array: {&positionX, &positionY, &positionZ, &rotationX, &rotationY, &rotationZ,
+                                       &rotationW, &scaleX, &scaleY, &scaleZ})
+        p_array->reserve(count);
+    dirty.reserve(count);
+}
+
+unsigned int TransformsSoA::add(const QVector3D &position, const QQuaternion &rotation, const QVector3D &scale)
+{
+    positionX.push_back(position.x());
+    positionY.push_back(position.y());
+    positionZ.push_back(position.z());
+    rotationX.push_back(rotation.x());
+    rotationY.push_back(rotation.y());
+    rotationZ.push_back(rotation.z());
+    rotationW.push_back(rotation.scalar());
+    scaleX.push_back(scale.x());
+    scaleY.push_back(scale.y());
+    scaleZ.push_back(scale.z());
+    dirty.push_back(1);
+    return size() - 1;
+}
+
+void TransformsSoA::setPosition(unsigned int index, const QVector3D &position)
+{
+    positionX[index] = position.x();
+    positionY[index] = position.y();
+    positionZ[index] = position.z();
+    dirty[index] = 1;
+}
+
+void TransformsSoA::setRotation(unsigned int index, const QQuaternion &rotation)
+{
+    rotationX[index] = rotation.x();
+    rotationY[index] = rotation.y();
+    rotationZ[index] = rotation.z();
+    rotationW[index] = rotation.scalar();
+    dirty[index] = 1;
+}
+
+void TransformsSoA::setScale(unsigned int index, const QVector3D &scale)
+{
+    scaleX[index] = scale.x();
+    scaleY[index] = scale.y();
+    scaleZ[index] = scale.z();
+    dirty[index] = 1;
+}
+
+void TransformsSoA::markAllDirty()
+{
+    std::fill(dirty.begin(), dirty.end(), 1);
+}
+
+namespace
+{
+    // The same quaternion to matrix algebra for plain floats and for SIMD packs
+    inline float add(float a, float b) { return a + b; }
+    inline float sub(float a, float b) { return a - b; }
+    inline float mul(float a, float b) { return a * b; }
+    inline float div(float a, float b) { return a / b; }
+    inline void load(const float *p_source, float *p_value) { *p_value = *p_source; }
+    inline void splat(float value, float *p_value) { *p_value = value; }
+
+#if defined(TRANSFORMS_SSE)
+    inline __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+    inline __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+    inline __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+    inline __m128 div(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+    inline void load(const float *p_source, __m128 *p_value) { *p_value = _mm_loadu_ps(p_source); }
+    inline void splat(float value, __m128 *p_value) { *p_value = _mm_set1_ps(value); }
+#endif
+
+#if defined(TRANSFORMS_AVX)
+    inline __m256 add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+    inline __m256 sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+    inline __m256 mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+    inline __m256 div(__m256 a, __m256 b) { return _mm256_div_ps(a, b); }
+    inline void load(const float *p_source, __m256 *p_value) { *p_value = _mm256_loadu_ps(p_source); }
+    inline void splat(float value, __m256 *p_value) { *p_value = _mm256_set1_ps(value); }
+#endif
+
+    // Lane widths; naming the vector types through a typedef keeps their
+    // alignment attributes off the template arguments
+    struct Scalar { typedef float Pack; };
+#if defined(TRANSFORMS_SSE)
+    struct Sse { typedef __m128 Pack; };
+#endif
+#if defined(TRANSFORMS_AVX)
+    struct Avx { typedef __m256 Pack; };
+#endif
+
+    // Matrices of one object or of a group of objects, one per lane
+    template <typename Lanes>
+    struct Matrices
+    {
+        typedef typename Lanes::Pack Pack;
+
+        Pack    model[3][3];        // [column][row]: rotation column times that axis' scale
+        Pack    normal[3][3];       // rotation column divided by it, the inverse transpose of R * S
+        Pack    position[3];
+    };
+
+    template <typename Lanes>
+    void build(const TransformsSoA &transforms, unsigned int first, Matrices<Lanes> *p_matrices)
+    {
+        typedef typename Lanes::Pack Pack;
+        Pack x, y, z, w, scale[3], one, two;
+        load(&transforms.rotationX[first], &x);
+        load(&transforms.rotationY[first], &y);
+        load(&transforms.rotationZ[first], &z);
+        load(&transforms.rotationW[first], &w);
+        load(&transforms.scaleX[first], &scale[0]);
+        load(&transforms.scaleY[first], &scale[1]);
+        load(&transforms.scaleZ[first], &scale[2]);
+        load(&transforms.positionX[first], &p_matrices->position[0]);
+        load(&transforms.positionY[first], &p_matrices->position[1]);
+        load(&transforms.positionZ[first], &p_matrices->position[2]);
+        splat(1.0f, &one);
+        splat(2.0f, &two);
+
+        Pack x2 = mul(two, x), y2 = mul(two, y), z2 = mul(two, z);
+        Pack xx = mul(x, x2), yy = mul(y, y2), zz = mul(z, z2);
+        Pack xy = mul(x, y2), xz = mul(x, z2), yz = mul(y, z2);
+        Pack wx = mul(w, x2), wy = mul(w, y2), wz = mul(w, z2);
+
+        Pack rotation[3][3] = {
+            {sub(one, add(yy, zz)), add(xy, wz), sub(xz, wy)},
+            {sub(xy, wz), sub(one, add(xx, zz)), add(yz, wx)},
+            {add(xz, wy), sub(yz, wx), sub(one, add(xx, yy))}
+        };
+        for (int column = 0; column < 3; column++)
+            for (int row = 0; row < 3; row++)
+            {
+                p_matrices->model[column][row] = mul(rotation[column][row], scale[column]);
+                p_matrices->normal[column][row] = div(rotation[column][row], scale[column]);
+            }
+    }
+
+    void store(const Matrices<Scalar> &matrices, float *p_model, float *p_normal)
+    {
+        for (int column = 0; column < 3; column++)
+        {
+            for (int row = 0; row < 3; row++)
+                p_model[4 * column + row] = matrices.model[column][row];
+            p_model[4 * column + 3] = 0.0f;
+        }
+        for (int row = 0; row < 3; row++)
+            p_model[12 + row] = matrices.position[row];
+        p_model[15] = 1.0f;
+
+        if (p_normal != nullptr)
+            for (int column = 0; column < 3; column++)
+                for (int row = 0; row < 3; row++)
+                    p_normal[3 * column + row] = matrices.normal[column][row];
+    }
+
+#if defined(TRANSFORMS_SSE)
+    // Lanes hold one matrix element of four objects; a 4x4 transpose turns them
+    // into one matrix column per object
+    void store(const Matrices<Sse> &matrices, float *p_models, size_t modelStride,
+               float *p_normals, size_t normalStride)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        for (int column = 0; column < 4; column++)
+        {
+            __m128 rows[4] = {zero, zero, zero, zero};
+            for (int row = 0; row < 3; row++)
+                rows[row] = column < 3 ? matrices.model[column][row] : matrices.position[row];
+            if (column == 3)
+                rows[3] = _mm_set1_ps(1.0f);
+            _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+            for (int object = 0; object < 4; object++)
+                _mm_storeu_ps(p_models + object * modelStride + 4 * column, rows[object]);
+        }
+
+        if (p_normals == nullptr)
+            return;
+        for (int column = 0; column < 3; column++)
+        {
+            __m128 rows[4] = {matrices.normal[column][0], matrices.normal[column][1], matrices.normal[column][2], zero};
+            _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+            for (int object = 0; object < 4; object++)
+            {
+                float *p_column = p_normals + object * normalStride + 3 * column;
+                // The fourth lane spills into the next column, which is written after it;
+                // the last column must not run into whatever follows the matrix
+                if (column < 2)
+                {
+                    _mm_storeu_ps(p_column, rows[object]);
+                }
+                else
+                {
+                    _mm_storel_pi(reinterpret_cast<__m64*>(p_column), rows[object]);
+                    _mm_store_ss(p_column + 2, _mm_movehl_ps(rows[object], rows[object]));
+                }
+            }
+        }
+    }
+#endif
+
+    bool anyDirty(const unsigned char *p_flags, unsigned int count)
+    {
+        return std::any_of(p_flags, p_flags + count, [](unsigned char flag) { return flag != 0; });
+    }
+}
+
+unsigned int Transforms::update(TransformsSoA *p_transforms, unsigned int first, unsigned int last,
+                                float *p_models, size_t modelStride, float *p_normals, size_t normalStride)
+{
+    unsigned char *p_dirty = p_transforms->dirty.data();
+    unsigned int written = 0;
+    unsigned int i = first;
+
+#if defined(TRANSFORMS_AVX)
+    for (; i + 8 <= last; i += 8)
+    {
+        if (!anyDirty(p_dirty + i, 8))
+            continue;
+        Matrices<Avx> group;
+        build(*p_transforms, i, &group);
+
+        // The AVX lanes do not cross halves, so each half stores like an SSE group
+        for (int half = 0; half < 2; half++)
+        {
+            Matrices<Sse> quarter;
+            for (int column = 0; column < 3; column++)
+                for (int row = 0; row < 3; row++)
+                {
+                    quarter.model[column][row] = half == 0 ? _mm256_castps256_ps128(group.model[column][row])
+                                                           : _mm256_extractf128_ps(group.model[column][row], 1);
+                    quarter.normal[column][row] = half == 0 ? _mm256_castps256_ps128(group.normal[column][row])
+                                                            : _mm256_extractf128_ps(group.normal[column][row], 1);
+                }
+            for (int row = 0; row < 3; row++)
+                quarter.position[row] = half == 0 ? _mm256_castps256_ps128(group.position[row])
+                                                  : _mm256_extractf128_ps(group.position[row], 1);
+            unsigned int groupFirst = i + 4 * half;
+            store(quarter, p_models + groupFirst * modelStride, modelStride,
+                  p_normals != nullptr ? p_normals + groupFirst * normalStride : nullptr, normalStride);
+        }
+        std::fill(p_dirty + i, p_dirty + i + 8, 0);
+        written += 8;
+    }
+#endif
+
+#if defined(TRANSFORMS_SSE)
+    for (; i + 4 <= last; i += 4)
+    {
+        if (!anyDirty(p_dirty + i, 4))
+            continue;
+        Matrices<Sse> group;
+        build(*p_transforms, i, &group);
+        store(group, p_models + i * modelStride, modelStride,
+              p_normals != nullptr ? p_normals + i * normalStride : nullptr, normalStride);
+        std::fill(p_dirty + i, p_dirty + i + 4, 0);
+        written += 4;
+    }
+#endif
+
+    for (; i < last; i++)
+    {
+        if (p_dirty[i] == 0)
+            continue;
+        Matrices<Scalar> matrices;
+        build(*p_transforms, i, &matrices);
+        store(matrices, p_models + i * modelStride, p_normals != nullptr ? p_normals + i * normalStride : nullptr);
+        p_dirty[i] = 0;
+        written++;
+    }
+    return written;
+}
@@ -0,0 +1,60 @@
+#ifndef TRANSFORM_KERNEL_H
+#define TRANSFORM_KERNEL_H
+
+#include <QQuaternion>
+#include <QVector3D>
+
+#include <aligned_allocator.h>
+
+#include <cstddef>
+
+// Object transforms packed as structure of arrays: position, unit quaternion
+// rotation and per-axis scale. Setters raise the object's dirty flag, and
+// Transforms::update() rebuilds only flagged objects.
+struct TransformsSoA
+{
+    AlignedArray<float>         positionX;
+    AlignedArray<float>         positionY;
+    AlignedArray<float>         positionZ;
+    AlignedArray<float>         rotationX;
+    AlignedArray<float>         rotationY;
+    AlignedArray<float>         rotationZ;
+    AlignedArray<float>         rotationW;
+    AlignedArray<float>         scaleX;
+    AlignedArray<float>         scaleY;
+    AlignedArray<float>         scaleZ;
+    AlignedArray<unsigned char> dirty;
+
+    unsigned int size() const { return static_cast<unsigned int>(positionX.size()); }
+    void clear();
+    void reserve(unsigned int count);
+    unsigned int add(const QVector3D &position, const QQuaternion &rotation = QQuaternion(),
+                     const QVector3D &scale = QVector3D(1.0f, 1.0f, 1.0f));
+
+    void setPosition(unsigned int index, const QVector3D &position);
+    void setRotation(unsigned int index, const QQuaternion &rotation);
+    void setScale(unsigned int index, const QVector3D &scale);
+    // E.g. after the output buffer was reallocated
+    void markAllDirty();
+};
+
+namespace Transforms
+{
+    // Writes the column-major model matrix (16 floats) of every dirty object to
+    // p_models + index * modelStride and, when p_normals is not null, its normal
+    // matrix (9 floats, column-major 3x3) to p_normals + index * normalStride.
+    // Objects go through 4 (SSE) or 8 (AVX) at a time; a group with no dirty
+    // object is skipped. Clears the flags and returns the number of objects written.
+    // Objects in [first, last) only, so separate ranges can run on separate threads;
+    // ranges that start on a multiple of 8 keep the SIMD groups whole.
+    unsigned int update(TransformsSoA *p_transforms, unsigned int first, unsigned int last,
+                        float *p_models, size_t modelStride, float *p_normals = nullptr, size_t normalStride = 0);
+
+    inline unsigned int update(TransformsSoA *p_transforms, float *p_models, size_t modelStride,
+                               float *p_normals = nullptr, size_t normalStride = 0)
+    {
+        return update(p_transforms, 0, p_transforms->size(), p_models, modelStride, p_normals, normalStride);
+    }
+}
+
+#endif // TRANSFORM_KERNEL_H